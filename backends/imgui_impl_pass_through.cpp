@@ -41,7 +41,7 @@ void ImGui_ImplPassThrough_HandleInputEvent()
 {
 }
 
-bool ImGui_ImplPassThrough_Init(int width, int height)
+bool ImGui_ImplPassThrough_Init(int width, int height, int fb_width, int fb_height)
 {
     IMGUI_CHECKVERSION();
 
@@ -51,7 +51,8 @@ bool ImGui_ImplPassThrough_Init(int width, int height)
     ImGuiIO& io = ImGui::GetIO();
     io.BackendPlatformName = "imgui_impl_rk_gles";
     io.DisplaySize = ImVec2((float)width, (float)height);
-    io.DisplayFramebufferScale = ImVec2(1.0f, 1.0f);
+    // a canvas smaller than the screen renders everything scaled down, the display plane scales it back up
+    io.DisplayFramebufferScale = ImVec2((float)fb_width / width, (float)fb_height / height);
     return true;
 }
 
@@ -21,7 +21,7 @@
 #ifndef IMGUI_DISABLE
 
 // Follow "Getting Started" link and check examples/ folder to learn about using backends!
-IMGUI_IMPL_API bool     ImGui_ImplPassThrough_Init(int width, int height);
+IMGUI_IMPL_API bool     ImGui_ImplPassThrough_Init(int width, int height, int fb_width, int fb_height);
 IMGUI_IMPL_API void     ImGui_ImplPassThrough_HandleInputEvent();
 IMGUI_IMPL_API void     ImGui_ImplPassThrough_Shutdown();
 IMGUI_IMPL_API void     ImGui_ImplPassThrough_NewFrame();
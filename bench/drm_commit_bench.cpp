@@ -0,0 +1,199 @@
+/**
+ * Per-commit CPU cost of building a plane update the old way (string map lookups, fresh request,
+ * every property) against a PlaneCommit template (resolved IDs, reused request, FB_ID only).
+ *
+ * ./drm_commit_bench [/dev/dri/card0] [iterations]
+ *
+ * Flips between two dumb framebuffers on a plane of the active CRTC. Commits are TEST_ONLY, nothing reaches the screen.
+ * TEST_ONLY commits still need DRM master: run it from a VT with no display server holding the card,
+ * otherwise the kernel refuses every commit with EACCES and the bench stops.
+ */
+#include "drm.hpp"
+#include "frame_timing.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libdrm/drm_fourcc.h>
+
+
+// the GEM handle outlives the framebuffer, destroy_dumb_fb() frees both
+static uint32_t create_dumb_fb(int drm_fd, int width, int height, uint32_t& handle) {
+    uint32_t pitch = 0;
+    uint64_t size = 0;
+    handle = 0;
+    if (drmModeCreateDumbBuffer(drm_fd, width, height, 32, 0, &handle, &pitch, &size)) {
+        return 0;
+    }
+    uint32_t handles[4] = {handle, 0, 0, 0};
+    uint32_t pitches[4] = {pitch, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    uint64_t modifiers[4] = {DRM_FORMAT_MOD_LINEAR, 0, 0, 0};
+    uint32_t fb_id = 0;
+    if (drmModeAddFB2WithModifiers(drm_fd, width, height, DRM_FORMAT_ARGB8888, handles, pitches, offsets, modifiers, &fb_id, DRM_MODE_FB_MODIFIERS)) {
+        return 0;
+    }
+    return fb_id;
+}
+
+static void destroy_dumb_fb(int drm_fd, uint32_t fb_id, uint32_t handle) {
+    if (fb_id) {
+        drmModeRmFB(drm_fd, fb_id);
+    }
+    if (handle) {
+        drm_mode_destroy_dumb destroy{};
+        destroy.handle = handle;
+        drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+}
+
+static void print_result(const char* name, const LatencyHistogram& build, const LatencyHistogram& commit) {
+    printf("%-10s build avg %6.2fus p99 %6.2fus | TEST_ONLY commit avg %6.2fus p99 %6.2fus\n", name,
+           build.mean_ms() * 1000, build.percentile(0.99) * 1000,
+           commit.mean_ms() * 1000, commit.percentile(0.99) * 1000);
+}
+
+int main(int argc, char** argv) {
+    const char* device = argc > 1 ? argv[1] : "/dev/dri/card0";
+    int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+
+    int drm_fd = open(device, O_RDWR);
+    if (drm_fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", device);
+        return 1;
+    }
+    drmSetClientCap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+    if (drmSetClientCap(drm_fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+        fprintf(stderr, "No atomic modesetting on %s\n", device);
+        return 1;
+    }
+
+    // first active CRTC and a plane that can sit on it
+    drmModeRes* resources = drmModeGetResources(drm_fd);
+    uint32_t crtc_id = 0;
+    int crtc_index = 0;
+    int width = 0;
+    int height = 0;
+    for (int i = 0; resources && i < resources->count_crtcs && !crtc_id; i++) {
+        drmModeCrtc* crtc = drmModeGetCrtc(drm_fd, resources->crtcs[i]);
+        if (crtc && crtc->mode_valid) {
+            crtc_id = crtc->crtc_id;
+            crtc_index = i;
+            width = crtc->mode.hdisplay;
+            height = crtc->mode.vdisplay;
+        }
+        drmModeFreeCrtc(crtc);
+    }
+    uint32_t plane_id = 0;
+    drmModePlaneRes* plane_resources = drmModeGetPlaneResources(drm_fd);
+    for (uint32_t i = 0; plane_resources && i < plane_resources->count_planes && !plane_id; i++) {
+        drmModePlane* plane = drmModeGetPlane(drm_fd, plane_resources->planes[i]);
+        if (plane && (plane->possible_crtcs & (1u << crtc_index)) && plane->crtc_id == crtc_id) {
+            plane_id = plane->plane_id;
+        }
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(plane_resources);
+    drmModeFreeResources(resources);
+    if (!crtc_id || !plane_id) {
+        fprintf(stderr, "No active CRTC with a plane on %s\n", device);
+        return 1;
+    }
+
+    uint32_t handles[2] = {0, 0};
+    uint32_t fb_ids[2] = {create_dumb_fb(drm_fd, width, height, handles[0]), create_dumb_fb(drm_fd, width, height, handles[1])};
+    if (!fb_ids[0] || !fb_ids[1]) {
+        fprintf(stderr, "Failed to create %dx%d dumb framebuffers\n", width, height);
+        destroy_dumb_fb(drm_fd, fb_ids[0], handles[0]);
+        destroy_dumb_fb(drm_fd, fb_ids[1], handles[1]);
+        close(drm_fd);
+        return 1;
+    }
+
+    PlaneCommit plane;
+    if (!plane.resolve(drm_fd, plane_id)) {
+        destroy_dumb_fb(drm_fd, fb_ids[0], handles[0]);
+        destroy_dumb_fb(drm_fd, fb_ids[1], handles[1]);
+        close(drm_fd);
+        return 1;
+    }
+    plane.set_layer(crtc_id, fb_ids[0], width, height, 0);
+    // leave the plane at its own zpos
+    plane.prop_ids[PlaneCommit::ZPOS] = 0;
+    // what find_planes() used to keep per plane
+    std::map<uint32_t, std::map<std::string, uint32_t>> panel_prop_ids;
+    for (int p = 0; p < PlaneCommit::PROP_COUNT; p++) {
+        if (plane.prop_ids[p]) {
+            panel_prop_ids[plane_id][PlaneCommit::prop_name((PlaneCommit::Prop)p)] = plane.prop_ids[p];
+        }
+    }
+    printf("plane %u on crtc %u, %dx%d, %d iterations\n", plane_id, crtc_id, width, height, iterations);
+
+    // without master every commit fails in the ioctl's permission check, there would be nothing to time
+    drmModeAtomicReqPtr probe = drmModeAtomicAlloc();
+    plane.add_changed(probe);
+    int ret = drmModeAtomicCommit(drm_fd, probe, DRM_MODE_ATOMIC_TEST_ONLY, nullptr);
+    drmModeAtomicFree(probe);
+    if (ret == -EACCES) {
+        fprintf(stderr, "TEST_ONLY commit on %s refused with EACCES, the bench needs DRM master (stop the display server)\n", device);
+        destroy_dumb_fb(drm_fd, fb_ids[0], handles[0]);
+        destroy_dumb_fb(drm_fd, fb_ids[1], handles[1]);
+        close(drm_fd);
+        return 1;
+    }
+
+    LatencyHistogram build(0.0005, 2000);
+    LatencyHistogram commit(0.001, 2000);
+    int failures = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = monotonic_ns();
+        drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+        for (int p = 0; p < PlaneCommit::PROP_COUNT; p++) {
+            uint32_t prop_id = panel_prop_ids[plane_id][PlaneCommit::prop_name((PlaneCommit::Prop)p)];
+            if (prop_id) {
+                uint64_t value = p == PlaneCommit::FB_ID ? fb_ids[i & 1] : plane.values[p];
+                drmModeAtomicAddProperty(req, plane_id, prop_id, value);
+            }
+        }
+        uint64_t built = monotonic_ns();
+        failures += drmModeAtomicCommit(drm_fd, req, DRM_MODE_ATOMIC_TEST_ONLY, nullptr) < 0;
+        drmModeAtomicFree(req);
+        uint64_t end = monotonic_ns();
+        build.add(built - start);
+        commit.add(end - built);
+    }
+    print_result("map+alloc", build, commit);
+
+    build.clear();
+    commit.clear();
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    plane.mark_committed();
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = monotonic_ns();
+        drmModeAtomicSetCursor(req, 0);
+        plane.set(PlaneCommit::FB_ID, fb_ids[(i + 1) & 1]);
+        plane.add_changed(req);
+        uint64_t built = monotonic_ns();
+        failures += drmModeAtomicCommit(drm_fd, req, DRM_MODE_ATOMIC_TEST_ONLY, nullptr) < 0;
+        // as if the flip landed
+        plane.mark_committed();
+        uint64_t end = monotonic_ns();
+        build.add(built - start);
+        commit.add(end - built);
+    }
+    drmModeAtomicFree(req);
+    print_result("template", build, commit);
+
+    if (failures) {
+        printf("%d TEST_ONLY commits were rejected, commit times include the failure path\n", failures);
+    }
+
+    destroy_dumb_fb(drm_fd, fb_ids[0], handles[0]);
+    destroy_dumb_fb(drm_fd, fb_ids[1], handles[1]);
+    close(drm_fd);
+    return 0;
+}
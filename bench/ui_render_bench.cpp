@@ -0,0 +1,247 @@
+/**
+ * UI frame cost off the device: the canvas renderer headless on EGL_MESA_platform_surfaceless (llvmpipe
+ * without a GPU), driven through the same imgui_main_begin_frame/imgui_main_end_frame as the render thread,
+ * with a swept number of synthetic detection boxes.
+ *
+ * ./ui_render_bench [--size WxH] [--canvas WxH] [--frames n] [--detections 0,8,32,128] [--video] [--max-ms ms]
+ *                   [--font ttf] [--imgui-overlay]
+ *
+ * Boxes go through DetectionOverlay as in hdmimix, or through ImGui with --imgui-overlay or when the font
+ * (default ./font/Roboto-Medium.ttf) cannot be loaded.
+ * CPU time covers begin_frame to end_frame returning, GPU time comes from GL_TIME_ELAPSED queries around the
+ * same span. --video composes a synthetic NV12 dma-buf under the UI, as GPU composition does. --max-ms exits
+ * with 1 when any p99 goes over it, so CI catches overlay regressions.
+ */
+#include "egl_renderer.hpp"
+#include "gpu_timer.hpp"
+#include "detection_overlay.hpp"
+#include "dma_heap.hpp"
+#include "frame_timing.hpp"
+
+#include "imgui.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <libdrm/drm_fourcc.h>
+
+extern void imgui_main_pre(int width, int height, int fb_width, int fb_height);
+extern void imgui_main_post();
+extern void imgui_main_begin_frame();
+extern bool imgui_main_end_frame(bool force, const std::function<void()>& underlay, const std::function<void()>& overlay);
+
+
+static void print_usage(const char* argv0) {
+    printf("Usage: %s [--size WxH] [--canvas WxH] [--frames n] [--detections 0,8,32,128] [--video] [--max-ms ms]\n"
+           "       [--font ttf] [--imgui-overlay]\n", argv0);
+}
+
+// a grid over the input, shifted a little every frame as live boxes would be
+static void fill_detections(std::vector<Detection>& out, int count, int frame, int width, int height) {
+    static const char* labels[] = {"person", "car", "bicycle", "dog"};
+    out.clear();
+    int cols = 1;
+    while (cols * cols < count) {
+        cols++;
+    }
+    int cell_w = width / cols;
+    int cell_h = height / cols;
+    for (int i = 0; i < count; i++) {
+        int x = (i % cols) * cell_w + frame % 8;
+        int y = (i / cols) * cell_h + frame % 8;
+        out.push_back(Detection{labels[i % 4], 0.5f + (i % 50) / 100.0f, x + cell_w / 8, y + cell_h / 4, x + cell_w * 7 / 8, y + cell_h});
+    }
+}
+
+// luma ramp, neutral chroma. -1 if nothing the GPU can import could be allocated
+static int create_nv12_frame(DmaHeapAllocator& allocator, int width, int height) {
+    size_t size = (size_t)width * height * 3 / 2;
+    int fd = allocator.alloc(size);
+    if (fd < 0 || allocator.backend() == DmaHeapAllocator::Backend::MEMFD) {
+        fprintf(stderr, "No dma-heap or udmabuf, --video needs a real dma-buf\n");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    uint8_t* data = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            data[y * width + x] = 16 + (x + y) * 219 / (width + height);
+        }
+    }
+    memset(data + (size_t)width * height, 128, (size_t)width * height / 2);
+    munmap(data, size);
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    int width = 1920;
+    int height = 1080;
+    int canvas_w = 0;
+    int canvas_h = 0;
+    int frames = 300;
+    std::vector<int> counts = {0, 1, 8, 32, 128};
+    bool video = false;
+    double max_ms = 0;
+    const char* font = "./font/Roboto-Medium.ttf";
+    bool imgui_overlay = false;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--size") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--canvas") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &canvas_w, &canvas_h) != 2 || canvas_w <= 0 || canvas_h <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            frames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--detections") == 0 && has_value) {
+            counts.clear();
+            for (char* p = argv[++i]; *p; ) {
+                counts.push_back(std::max(0, (int)strtol(p, &p, 10)));
+                if (*p == ',') {
+                    p++;
+                } else if (*p) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+            }
+        } else if (strcmp(argv[i], "--video") == 0) {
+            video = true;
+        } else if (strcmp(argv[i], "--max-ms") == 0 && has_value) {
+            max_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--font") == 0 && has_value) {
+            font = argv[++i];
+        } else if (strcmp(argv[i], "--imgui-overlay") == 0) {
+            imgui_overlay = true;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!canvas_w) {
+        canvas_w = width;
+        canvas_h = height;
+    }
+
+    EGLBufRenderer renderer(-1, canvas_w, canvas_h);
+    if (!renderer.initialize() || !renderer.bind_context_to_thread()) {
+        return 1;
+    }
+    imgui_main_pre(width, height, canvas_w, canvas_h);
+    GpuTimer timer;
+    timer.init();
+    DetectionOverlay overlay;
+    if (!imgui_overlay) {
+        overlay.init(font);
+    }
+    overlay.resize(width, height);
+    std::function<void()> draw_overlay = [&overlay]() {
+        overlay.draw();
+    };
+
+    DmaHeapAllocator allocator;
+    int video_fd = video ? create_nv12_frame(allocator, width, height) : -1;
+    if (video && video_fd < 0) {
+        return 1;
+    }
+    LayerGeometry geometry;
+    std::function<void()> underlay;
+    if (video_fd >= 0) {
+        underlay = [&renderer, video_fd, width, height, &geometry]() {
+            if (!renderer.compose_video(0, video_fd, width, height, DRM_FORMAT_NV12, geometry)) {
+                glClearColor(0, 0, 0, 1);
+                glClear(GL_COLOR_BUFFER_BIT);
+            }
+        };
+    }
+
+    printf("input %dx%d, canvas %dx%d, %d frames per count, %s overlay%s%s\n", width, height, canvas_w, canvas_h, frames,
+           overlay.ready() ? "instanced" : "ImGui", video_fd >= 0 ? ", video composed" : "", timer.ready() ? "" : ", no GPU times");
+    std::vector<Detection> detections;
+    bool over_budget = false;
+    for (int count : counts) {
+        LatencyHistogram cpu(0.01, 5000);
+        LatencyHistogram gpu(0.01, 5000);
+        int vertices = 0;
+        // the first frames build the font atlas and compile shaders, llvmpipe's first timer result is garbage
+        int warmup = 10;
+        for (int frame = -warmup; frame < frames; frame++) {
+            fill_detections(detections, count, frame, width, height);
+            uint64_t start = monotonic_ns();
+            if (!renderer.begin_frame()) {
+                fprintf(stderr, "No canvas buffer to draw into\n");
+                return 1;
+            }
+            bool timed = timer.begin();
+            imgui_main_begin_frame();
+            if (overlay.ready()) {
+                overlay.set(detections.data(), detections.size());
+            } else {
+                draw_detections(detections.data(), detections.size());
+            }
+            imgui_main_end_frame(true, underlay, draw_overlay);
+            if (timed) {
+                timer.end();
+            }
+            uint64_t end = monotonic_ns();
+            // the render thread waits for a canvas to come back before drawing the next, never more than the ring ahead
+            glFinish();
+            uint64_t elapsed_ns;
+            while (timer.poll(&elapsed_ns)) {
+                if (frame >= 0) {
+                    gpu.add(elapsed_ns);
+                }
+            }
+            if (frame >= 0) {
+                cpu.add(end - start);
+                vertices = ImGui::GetDrawData()->TotalVtxCount;
+            }
+        }
+        uint64_t elapsed_ns;
+        while (timer.poll(&elapsed_ns, true)) {
+            gpu.add(elapsed_ns);
+        }
+        // ImGui's vertices, the instanced overlay adds none
+        printf("detections %4d: %6d vtx | cpu avg %7.3fms p99 %7.3fms", count, vertices, cpu.mean_ms(), cpu.percentile(0.99));
+        if (gpu.count) {
+            printf(" | gpu avg %7.3fms p99 %7.3fms", gpu.mean_ms(), gpu.percentile(0.99));
+        }
+        printf("\n");
+        if (max_ms > 0 && (cpu.percentile(0.99) > max_ms || (gpu.count && gpu.percentile(0.99) > max_ms))) {
+            over_budget = true;
+        }
+    }
+    if (timer.disjoint) {
+        printf("%llu GPU times dropped as disjoint\n", (unsigned long long)timer.disjoint);
+    }
+
+    timer.close();
+    overlay.close();
+    renderer.release_video();
+    imgui_main_post();
+    renderer.close();
+    if (video_fd >= 0) {
+        close(video_fd);
+    }
+    if (over_budget) {
+        printf("p99 over the %.3fms budget\n", max_ms);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "buffer_tuner.hpp"
+#include "frame_timing.hpp"
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+
+void BufferTuner::on_frame(const v4l2_buffer& vbuf) {
+    uint64_t now = monotonic_ns();
+    if (window_start_ns == 0) {
+        window_start_ns = now;
+        last_starvation_events = source.leases.totals().starvation_events;
+        source.leases.take_window_out_ns_max();
+    }
+
+    if (last_sequence >= 0 && vbuf.sequence > (uint32_t)last_sequence + 1) {
+        window_drops += vbuf.sequence - last_sequence - 1;
+    }
+    last_sequence = vbuf.sequence;
+    window_frames++;
+
+    if (now - window_start_ns >= (uint64_t)window_ms * 1000000ull) {
+        evaluate(now);
+        window_start_ns = now;
+        window_frames = 0;
+        window_drops = 0;
+    }
+}
+
+bool BufferTuner::apply(int target) {
+    int allocated = source.leases.size();
+    if (target <= allocated) {
+        source.leases.set_active(target);
+        return true;
+    }
+    source.leases.set_active(allocated);
+    int first = source.buf_count;
+    int added = source.add_buffers(target - allocated);
+    if (added > 0 && on_buffers_added) {
+        on_buffers_added(first, added);
+    }
+    return added > 0;
+}
+
+void BufferTuner::evaluate(uint64_t now_ns) {
+    if (window_frames == 0) {
+        return;
+    }
+    auto totals = source.leases.totals();
+    uint64_t starved = totals.starvation_events - last_starvation_events;
+    last_starvation_events = totals.starvation_events;
+    uint64_t out_max = source.leases.take_window_out_ns_max();
+
+    double frame_ns = (double)(now_ns - window_start_ns) / window_frames;
+    // every buffer out of the driver for out_max, plus one queued to receive the next frame
+    int needed = (int)(out_max / frame_ns) + 2;
+    int active = source.leases.active_count();
+
+    int target = active;
+    const char* decision = "keep";
+    if (starved > 0 || window_drops > 0) {
+        calm_windows = 0;
+        if (active < max_buffers) {
+            target = active + 1;
+            decision = "grow";
+        }
+    } else if (needed < active && active > min_buffers) {
+        if (++calm_windows >= shrink_after_windows) {
+            calm_windows = 0;
+            target = active - 1;
+            decision = "shrink";
+        }
+    } else {
+        calm_windows = 0;
+    }
+
+    if (target != active && !apply(target)) {
+        decision = "grow failed";
+        target = active;
+    }
+
+    double buffer_mb = source.buf_count ? source.buffer_bytes() / 1048576.0 / source.buf_count : 0.0;
+    uint64_t frames = window_frames + window_drops;
+    printf("[TUNE] %s -> %d buffers (%.1fMB, %d allocated %.1fMB), out max %.2fms, need %d, starved %llu, drops %llu/%llu (%.2f%%)\n",
+           decision, target, target * buffer_mb, source.buf_count, source.buf_count * buffer_mb,
+           out_max / 1e6, needed, (unsigned long long)starved,
+           (unsigned long long)window_drops, (unsigned long long)frames, frames ? 100.0 * window_drops / frames : 0.0);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <linux/videodev2.h>
+
+#include "frame_source.hpp"
+
+/**
+ * Sizes the capture buffer pool from what consumers actually do.
+ *
+ * Every window it looks at the longest dequeue-to-requeue time, driver starvation and sequence gaps.
+ * Starving or dropping grows the pool by one, several calm windows in a row shrink it by one.
+ * Growing first un-parks buffers and only then allocates with add_buffers (CREATE_BUFS).
+ * Shrinking parks buffers: V4L2 cannot free single buffers mid-stream, their memory comes back at the next reallocation.
+ */
+class BufferTuner {
+public:
+    BufferTuner(FrameSource& source, int min_buffers, int max_buffers, int window_ms = 5000)
+        : min_buffers(min_buffers), max_buffers(max_buffers), window_ms(window_ms), source(source) {}
+
+    // call from the capture callback
+    void on_frame(const v4l2_buffer& vbuf);
+
+    // buffers [first, first + count) were allocated, import them wherever the old ones are
+    std::function<void(int first, int count)> on_buffers_added;
+
+    int min_buffers;
+    int max_buffers;
+    int window_ms;
+    // calm windows needed before giving a buffer back
+    int shrink_after_windows = 3;
+
+private:
+    void evaluate(uint64_t now_ns);
+    bool apply(int target);
+
+    FrameSource& source;
+
+    uint64_t window_start_ns = 0;
+    uint64_t window_frames = 0;
+    uint64_t window_drops = 0;
+    uint64_t last_starvation_events = 0;
+    int64_t last_sequence = -1;
+    int calm_windows = 0;
+};
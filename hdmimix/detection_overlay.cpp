@@ -0,0 +1,299 @@
+#include "detection_overlay.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <algorithm>
+
+#include "imgui.h"
+
+// ImGui builds its own copy static, this one is private to the overlay
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "imstb_truetype.h"
+
+
+// glyphs are baked at this pixel height, the distance field covers sdf_padding pixels either side of the edge
+static const float atlas_px = 48;
+static const int sdf_padding = 6;
+static const unsigned char sdf_edge = 128;
+static const int atlas_width = 512;
+
+// the corners come from gl_VertexID, everything else is per instance
+static const char* vertex_source = R"(#version 300 es
+layout(location = 0) in vec4 rect;
+layout(location = 1) in vec4 uv;
+layout(location = 2) in vec4 color;
+layout(location = 3) in float line;
+uniform vec2 screen;
+out vec2 frag_uv;
+out vec2 frag_local;
+flat out vec2 frag_size;
+flat out float frag_line;
+out vec4 frag_color;
+void main() {
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    frag_uv = mix(uv.xy, uv.zw, corner);
+    frag_local = corner * rect.zw;
+    frag_size = rect.zw;
+    frag_line = line;
+    frag_color = color;
+    // the FBO's first row in memory is GL's bottom one, so screen y runs up in clip space
+    gl_Position = vec4((rect.xy + frag_local) / screen * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// highp: box coordinates are pixels of a 4K input, mediump cannot tell them apart
+static const char* fragment_source = R"(#version 300 es
+precision highp float;
+uniform sampler2D atlas;
+in vec2 frag_uv;
+in vec2 frag_local;
+flat in vec2 frag_size;
+flat in float frag_line;
+in vec4 frag_color;
+out vec4 color;
+void main() {
+    float alpha;
+    if (frag_line > 0.0) {
+        // outline, the quad's outer frag_line pixels
+        vec2 edge = min(frag_local, frag_size - frag_local);
+        alpha = clamp(frag_line - min(edge.x, edge.y) + 0.5, 0.0, 1.0);
+    } else {
+        // the glyph edge sits at 128 in the field, smoothed over about one screen pixel at any size
+        float d = texture(atlas, frag_uv).r;
+        float w = max(fwidth(d) * 0.7, 0.001);
+        alpha = smoothstep(128.0 / 255.0 - w, 128.0 / 255.0 + w, d);
+    }
+    if (alpha <= 0.0) {
+        discard;
+    }
+    color = vec4(frag_color.rgb, frag_color.a * alpha);
+}
+)";
+
+void draw_detections(const Detection* detections, int count) {
+    char text[256]{};
+    ImDrawList* drawlist = ImGui::GetForegroundDrawList();
+    for (int i = 0; i < count; i++) {
+        const Detection& d = detections[i];
+        sprintf(text, "%s %.1f%%", d.label, d.prop * 100);
+        drawlist->AddRect(ImVec2(d.x1, d.y1), ImVec2(d.x2, d.y2), IM_COL32(0, 255, 0, 255), 0.0f, ImDrawFlags_RoundCornersAll, 3.0f);
+        drawlist->AddText(nullptr, 128, ImVec2(d.x1, d.y1 - 128), IM_COL32(255, 0, 0, 255), text);
+    }
+}
+
+bool DetectionOverlay::init(const char* font_path) {
+    if (ready()) {
+        return true;
+    }
+    if (!gl_load() || !bake_atlas(font_path)) {
+        return false;
+    }
+    program = gl_link_program(vertex_source, fragment_source);
+    if (!program) {
+        glDeleteTextures(1, &atlas);
+        atlas = 0;
+        return false;
+    }
+    gl.UseProgram(program);
+    gl.Uniform1i(gl.GetUniformLocation(program, "atlas"), 0);
+    screen_loc = gl.GetUniformLocation(program, "screen");
+    gl.UseProgram(0);
+
+    gl.GenVertexArrays(1, &vao);
+    gl.GenBuffers(1, &vbo);
+    gl.BindVertexArray(vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+    gl.VertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, rect));
+    gl.VertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, uv));
+    gl.VertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), (void*)offsetof(Instance, color));
+    gl.VertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, line));
+    for (GLuint i = 0; i < 4; i++) {
+        gl.EnableVertexAttribArray(i);
+        gl.VertexAttribDivisor(i, 1);
+    }
+    gl.BindVertexArray(0);
+    gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+    upload = true;
+    printf("Detection overlay: instanced, SDF labels from %s\n", font_path);
+    return true;
+}
+
+void DetectionOverlay::close() {
+    if (program) {
+        gl.DeleteProgram(program);
+        gl.DeleteVertexArrays(1, &vao);
+        gl.DeleteBuffers(1, &vbo);
+        glDeleteTextures(1, &atlas);
+    }
+    program = 0;
+    vao = 0;
+    vbo = 0;
+    atlas = 0;
+}
+
+bool DetectionOverlay::bake_atlas(const char* font_path) {
+    FILE* fp = fopen(font_path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Failed to open overlay font %s\n", font_path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    std::vector<unsigned char> ttf(std::max(size, 0L));
+    bool read = size > 0 && fread(ttf.data(), size, 1, fp) == 1;
+    fclose(fp);
+    stbtt_fontinfo font;
+    if (!read || !stbtt_InitFont(&font, ttf.data(), stbtt_GetFontOffsetForIndex(ttf.data(), 0))) {
+        fprintf(stderr, "Failed to load overlay font %s\n", font_path);
+        return false;
+    }
+    float scale = stbtt_ScaleForPixelHeight(&font, atlas_px);
+    int font_ascent, font_descent, line_gap;
+    stbtt_GetFontVMetrics(&font, &font_ascent, &font_descent, &line_gap);
+    ascent = font_ascent * scale;
+
+    // shelf packed, a blank texel between glyphs so filtering does not bleed
+    struct Bitmap {
+        unsigned char* data;
+        int w, h, x, y;
+    } bitmaps[95];
+    int x = 0, y = 0, row_h = 0;
+    for (int i = 0; i < 95; i++) {
+        Bitmap& b = bitmaps[i];
+        int xoff = 0, yoff = 0;
+        b.data = stbtt_GetCodepointSDF(&font, scale, 32 + i, sdf_padding, sdf_edge, sdf_edge / (float)sdf_padding, &b.w, &b.h, &xoff, &yoff);
+        if (!b.data) {
+            // blank, e.g. the space
+            b.w = b.h = 0;
+        }
+        if (x + b.w > atlas_width) {
+            x = 0;
+            y += row_h + 1;
+            row_h = 0;
+        }
+        b.x = x;
+        b.y = y;
+        x += b.w + 1;
+        row_h = std::max(row_h, b.h);
+
+        int advance, lsb;
+        stbtt_GetCodepointHMetrics(&font, 32 + i, &advance, &lsb);
+        Glyph& g = glyphs[i];
+        g = Glyph();
+        g.advance = advance * scale;
+        g.x = xoff;
+        g.y = yoff;
+        g.w = b.w;
+        g.h = b.h;
+    }
+    int atlas_height = std::max(y + row_h, 1);
+    std::vector<unsigned char> pixels(atlas_width * atlas_height, 0);
+    for (int i = 0; i < 95; i++) {
+        Bitmap& b = bitmaps[i];
+        for (int row = 0; row < b.h; row++) {
+            memcpy(&pixels[(b.y + row) * atlas_width + b.x], b.data + row * b.w, b.w);
+        }
+        Glyph& g = glyphs[i];
+        g.uv[0] = b.x / (float)atlas_width;
+        g.uv[1] = b.y / (float)atlas_height;
+        g.uv[2] = (b.x + b.w) / (float)atlas_width;
+        g.uv[3] = (b.y + b.h) / (float)atlas_height;
+        if (b.data) {
+            stbtt_FreeSDF(b.data, nullptr);
+        }
+    }
+
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlas_width, atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+void DetectionOverlay::resize(int width, int height) {
+    this->width = width;
+    this->height = height;
+}
+
+void DetectionOverlay::add_label(const char* text, float x, float y, const uint8_t color[4]) {
+    float scale = text_size / atlas_px;
+    float baseline = y + ascent * scale;
+    for (const char* c = text; *c; c++) {
+        unsigned char ch = *c;
+        const Glyph& g = glyphs[ch >= 32 && ch < 127 ? ch - 32 : '?' - 32];
+        if (g.w > 0) {
+            building.push_back(Instance{
+                {x + g.x * scale, baseline + g.y * scale, g.w * scale, g.h * scale},
+                {g.uv[0], g.uv[1], g.uv[2], g.uv[3]},
+                {color[0], color[1], color[2], color[3]},
+                0,
+            });
+        }
+        x += g.advance * scale;
+    }
+}
+
+void DetectionOverlay::set(const Detection* detections, int count) {
+    static const uint8_t box_color[4] = {0, 255, 0, 255};
+    static const uint8_t text_color[4] = {255, 0, 0, 255};
+    char text[256];
+    building.clear();
+    for (int i = 0; i < count; i++) {
+        const Detection& d = detections[i];
+        // centered on the box edge, as ImGui strokes it
+        float half = line_width / 2;
+        building.push_back(Instance{
+            {d.x1 - half, d.y1 - half, d.x2 - d.x1 + line_width, d.y2 - d.y1 + line_width},
+            {0, 0, 0, 0},
+            {box_color[0], box_color[1], box_color[2], box_color[3]},
+            line_width,
+        });
+        snprintf(text, sizeof(text), "%s %.1f%%", d.label, d.prop * 100);
+        // a line above the box
+        add_label(text, d.x1, d.y1 - text_size, text_color);
+    }
+    // every field is 4 bytes wide, no padding to compare
+    if (building.size() != instances.size()
+        || memcmp(building.data(), instances.data(), building.size() * sizeof(Instance)) != 0) {
+        instances.swap(building);
+        dirty = true;
+        upload = true;
+    }
+}
+
+void DetectionOverlay::draw() {
+    dirty = false;
+    if (!ready() || instances.empty() || width <= 0 || height <= 0) {
+        return;
+    }
+    gl.BindVertexArray(vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (upload) {
+        // fresh storage, frames still on the GPU keep reading the old one
+        gl.BufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STREAM_DRAW);
+        upload = false;
+    }
+    glDisable(GL_SCISSOR_TEST);
+    glEnable(GL_BLEND);
+    // as ImGui blends, the canvas alpha is what the plane below shows through
+    gl.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    gl.UseProgram(program);
+    gl.Uniform2f(screen_loc, width, height);
+    gl.ActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    gl.DrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances.size());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    gl.UseProgram(0);
+    gl.BindVertexArray(0);
+    gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisable(GL_BLEND);
+}
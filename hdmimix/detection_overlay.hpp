@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "gl_loader.hpp"
+
+/**
+ * One detection box, in input pixels as ImGui lays out.
+ */
+struct Detection {
+    const char* label;
+    float prop;
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+};
+
+/**
+ * boxes and their labels into ImGui's foreground draw list, between imgui_main_begin_frame and imgui_main_end_frame.
+ * what DetectionOverlay falls back to without a font
+ */
+void draw_detections(const Detection* detections, int count);
+
+/**
+ * Draws a frame's detection boxes and labels in one instanced call instead of through ImGui.
+ *
+ * Every box outline and every label glyph is one instance: a quad in input pixels, an atlas rect and a color.
+ * set() packs them into a single instance buffer, draw() uploads it when it changed and issues one
+ * glDrawArraysInstanced, so the GL work per frame does not grow with the detection count.
+ *
+ * Labels come from a signed distance field atlas baked once from a TTF with the stb_truetype copy
+ * ImGui bundles, sharp at any text size where ImGui scales up a bitmap.
+ *
+ * init, close and draw run on the thread whose context is current.
+ */
+class DetectionOverlay {
+public:
+    // atlas, shader and buffers, once the context is current. font is the TTF labels are drawn with
+    bool init(const char* font_path);
+    // with the context current
+    void close();
+
+    bool ready() const { return program != 0; }
+
+    // input size, what detection coordinates are in
+    void resize(int width, int height);
+
+    // the boxes of the frame being drawn, replacing the last ones
+    void set(const Detection* detections, int count);
+
+    // set() brought something the last draw() did not show
+    bool changed() const { return dirty; }
+
+    // into the bound framebuffer, on top of what is there
+    void draw();
+
+    // label height in input pixels
+    float text_size = 128;
+    float line_width = 3;
+
+private:
+    // one quad, laid out as the vertex attributes read it
+    struct Instance {
+        // x, y, w, h in input pixels
+        float rect[4];
+        // atlas u0, v0, u1, v1, unused for boxes
+        float uv[4];
+        // r, g, b, a
+        uint8_t color[4];
+        // outline width for boxes, 0 for glyphs
+        float line;
+    };
+
+    struct Glyph {
+        float advance = 0;
+        // quad relative to the pen on the baseline, at the atlas size
+        float x = 0, y = 0, w = 0, h = 0;
+        float uv[4] = {};
+    };
+
+    bool bake_atlas(const char* font_path);
+    void add_label(const char* text, float x, float y, const uint8_t color[4]);
+
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint atlas = 0;
+    GLint screen_loc = -1;
+
+    int width = 0;
+    int height = 0;
+
+    // printable ASCII from ' '
+    Glyph glyphs[95];
+    // ascent at the atlas size, the label's top to its baseline
+    float ascent = 0;
+
+    std::vector<Instance> instances;
+    // the next frame's, swapped in when it differs
+    std::vector<Instance> building;
+    bool dirty = false;
+    // instances holds more than the GPU has
+    bool upload = false;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <gbm.h>
+#include <xf86drmMode.h>
+
+#include "layer_geometry.hpp"
+
+/**
+ * What the presenter needs from a display: framebuffers for capture buffers and canvas bos,
+ * two planes (passthrough video below, canvas above) staged and committed together, flip events,
+ * and explicit fences: the canvas waits for the renderer's fence, a commit hands out one for when it is on screen.
+ *
+ * DRMDevice drives real KMS, SoftwareDisplay emulates it in memory.
+ * Not thread-safe, callers serialize (Presenter::with_device).
+ */
+class DisplayBackend {
+public:
+    // user_data is what was given to the commit() that asked for the event
+    using flip_handler_t = void (*)(unsigned int sequence, uint64_t flip_ns, void* user_data);
+
+    virtual ~DisplayBackend() = default;
+
+    virtual bool close() = 0;
+
+    // capture buffer index -> framebuffer, importing an index again replaces its framebuffer
+    virtual int import_dmabuf(int index, int dmabuf_fd) = 0;
+    virtual void release_dmabufs() = 0;
+    // ARGB8888 canvas from the renderer, imported once per bo
+    virtual uint32_t import_canvas_buf_bo(gbm_bo* bo) = 0;
+    virtual void release_canvas_bufs() = 0;
+    // input size or format changed, every framebuffer is dropped
+    virtual bool set_format(int width, int height, int pixfmt) = 0;
+
+    /**
+     * source frame rate, the next modeset picks the mode of the input size with the closest refresh. 0: no preference
+     */
+    virtual void set_refresh_hint(double hz) = 0;
+    // refresh of the mode being scanned out, 0 if unknown
+    virtual double output_refresh_hz() const = 0;
+    // variable refresh is on, vblanks follow the commits and there is no drift to schedule around
+    virtual bool vrr_active() const = 0;
+
+    /**
+     * crop, scale and rotate the video plane, for every following set_passthrough.
+     * checked with a TEST_ONLY commit once a capture buffer is imported.
+     * @return false if the plane cannot do it, video_on_plane() is false until a geometry is accepted
+     */
+    virtual bool set_video_geometry(const LayerGeometry& geometry) = 0;
+
+    // a plane scans out the capture buffers, false if the video has to be drawn into the canvas
+    virtual bool video_on_plane() const = 0;
+    virtual void set_passthrough(int index) = 0;
+    // in_fence_fd: shown once it signals, -1 if the bo is ready. the caller keeps the fd until the commit returned
+    virtual void set_canvas(uint32_t canvas_fb_id, int in_fence_fd) = 0;
+    /**
+     * DRM_MODE_ATOMIC_* / DRM_MODE_PAGE_FLIP_EVENT flags
+     * @return 1 committed, 0 nothing changed, -errno otherwise (-EBUSY: a nonblocking commit is still pending)
+     */
+    virtual int commit(uint32_t flags, void* user_data = nullptr) = 0;
+    /**
+     * after a commit that changed the canvas: sync_file signaled when it is on screen, so whatever it replaced
+     * is free from then on. owned by the caller, -1 if the display has none
+     */
+    virtual int take_out_fence() = 0;
+
+    // readable when flip events are waiting for handle_events()
+    virtual int event_fd() const = 0;
+    virtual void handle_events(flip_handler_t on_flip) = 0;
+
+    // for gbm_create_device, the renderer allocates its canvas bos there
+    virtual int gbm_fd() const = 0;
+};
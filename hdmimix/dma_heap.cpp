@@ -0,0 +1,148 @@
+#include "dma_heap.hpp"
+
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-heap.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+
+
+int DmaHeapAllocator::alloc_dma_heap(size_t size) {
+    std::string path = "/dev/dma_heap/" + heap;
+    int heap_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (heap_fd < 0) {
+        if (errno == ENOENT) {
+            dma_heap_missing = true;
+        } else {
+            std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        }
+        return -1;
+    }
+    dma_heap_allocation_data data{};
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    int ret = ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data);
+    ::close(heap_fd);
+    if (ret < 0) {
+        std::cerr << "Failed to allocate from " << path << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    return data.fd;
+}
+
+int DmaHeapAllocator::alloc_memfd(size_t size) {
+    int fd = memfd_create("hdmimix-buf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        std::cerr << "Failed to create memfd: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        std::cerr << "Failed to resize memfd: " << strerror(errno) << std::endl;
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int DmaHeapAllocator::alloc_udmabuf(size_t size) {
+    int dev_fd = ::open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev_fd < 0) {
+        return -1;
+    }
+    // udmabuf wants page aligned, shrink-sealed memfds
+    size_t page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+
+    int mem_fd = alloc_memfd(size);
+    if (mem_fd < 0) {
+        ::close(dev_fd);
+        return -1;
+    }
+    if (fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+        ::close(mem_fd);
+        ::close(dev_fd);
+        return -1;
+    }
+    udmabuf_create create{};
+    create.memfd = mem_fd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = size;
+    int fd = ioctl(dev_fd, UDMABUF_CREATE, &create);
+    // the dma-buf keeps its own reference to the pages
+    ::close(mem_fd);
+    ::close(dev_fd);
+    return fd;
+}
+
+DmaHeapAllocator& DmaHeapAllocator::shared() {
+    static DmaHeapAllocator allocator;
+    return allocator;
+}
+
+int DmaHeapAllocator::alloc(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int fd = -1;
+    if (!dma_heap_missing) {
+        // ENOMEM now does not mean the heap is gone, the next buffer tries it again
+        fd = alloc_dma_heap(size);
+        if (fd >= 0) {
+            last_backend = Backend::DMA_HEAP;
+            return fd;
+        }
+    }
+    if (!udmabuf_failed) {
+        fd = alloc_udmabuf(size);
+        if (fd >= 0) {
+            last_backend = Backend::UDMABUF;
+            return fd;
+        }
+        udmabuf_failed = true;
+    }
+    fd = alloc_memfd(size);
+    if (fd >= 0) {
+        last_backend = Backend::MEMFD;
+    }
+    return fd;
+}
+
+int DmaHeapAllocator::alloc_heap(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int fd = alloc_dma_heap(size);
+    if (fd < 0) {
+        if (dma_heap_missing) {
+            std::cerr << "No /dev/dma_heap/" << heap << std::endl;
+        }
+        return -1;
+    }
+    last_backend = Backend::DMA_HEAP;
+    return fd;
+}
+
+const char* DmaHeapAllocator::backend_name(Backend backend) {
+    switch (backend) {
+    case Backend::DMA_HEAP:
+        return "dma-heap";
+    case Backend::UDMABUF:
+        return "udmabuf";
+    case Backend::MEMFD:
+        return "memfd";
+    default:
+        return "none";
+    }
+}
+
+bool dmabuf_sync(int dma_fd, uint64_t flags) {
+    struct dma_buf_sync sync{};
+    sync.flags = flags;
+    int ret;
+    do {
+        ret = ioctl(dma_fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+    return ret == 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <mutex>
+
+/**
+ * Allocates DMABUF fds for buffers that do not come from a driver.
+ *
+ * Tries /dev/dma_heap/<heap> first, then memfd + /dev/udmabuf (still a real dma-buf, importable by DRM),
+ * and finally a plain memfd, which is only good for CPU consumers but keeps tests running anywhere.
+ * A missing heap node is not tried again, a heap that is only out of memory is.
+ */
+class DmaHeapAllocator {
+public:
+    enum class Backend {
+        NONE,
+        DMA_HEAP,
+        UDMABUF,
+        MEMFD,
+    };
+
+    DmaHeapAllocator(const std::string heap = "system") : heap(heap) {}
+
+    /**
+     * the one allocator for capture, conversion and replay buffers, so all of them come from the same heap.
+     * set heap before the first alloc.
+     */
+    static DmaHeapAllocator& shared();
+
+    /**
+     * thread-safe
+     * @return fd owned by the caller, or -1
+     */
+    int alloc(size_t size);
+    /**
+     * from the heap only, for buffers whose consumer needs that memory (a CMA heap for hdmirx).
+     * thread-safe
+     * @return fd owned by the caller, or -1 after printing why
+     */
+    int alloc_heap(size_t size);
+
+    Backend backend() const { return last_backend; }
+    static const char* backend_name(Backend backend);
+
+    std::string heap;
+
+private:
+    int alloc_dma_heap(size_t size);
+    int alloc_udmabuf(size_t size);
+    int alloc_memfd(size_t size);
+
+    std::mutex mutex;
+    Backend last_backend = Backend::NONE;
+    // /dev/dma_heap/<heap> does not exist
+    bool dma_heap_missing = false;
+    bool udmabuf_failed = false;
+};
+
+/**
+ * DMA_BUF_IOCTL_SYNC wrapper. flags are DMA_BUF_SYNC_* bits.
+ * plain memfds reject the ioctl, which is fine since they have no cache maintenance to do.
+ */
+bool dmabuf_sync(int dma_fd, uint64_t flags);
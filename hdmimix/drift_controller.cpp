@@ -0,0 +1,163 @@
+#include "drift_controller.hpp"
+#include "frame_timing.hpp"
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+
+// a step this far off the average means the clock changed (new mode, new source), start averaging again
+static bool off_period(double step_ns, int64_t steps, double period_ns) {
+    return period_ns > 0 && fabs(step_ns - steps * period_ns) > period_ns / 4;
+}
+
+void DriftController::set_nominal_refresh(double hz) {
+    if (hz > 0 && out_base_sequence == flip_sequence) {
+        out_period_ns = 1e9 / hz;
+    }
+}
+
+void DriftController::set_enabled(bool enabled) {
+    if (this->enabled != enabled) {
+        this->enabled = enabled;
+        target = -1;
+    }
+}
+
+uint64_t DriftController::vblank_ns(int64_t sequence) const {
+    return flip_ns + (int64_t)llround((sequence - flip_sequence) * out_period_ns);
+}
+
+void DriftController::resync(uint64_t capture_ns) {
+    // the first vblank the frame can make with guard to spare
+    double ahead = (double)capture_ns + guard_ms * 1e6 - (double)flip_ns;
+    target = flip_sequence + (int64_t)ceil(ahead / out_period_ns);
+    slack_ns = (double)vblank_ns(target) - (double)capture_ns;
+}
+
+DriftController::Decision DriftController::on_capture(uint64_t capture_ns) {
+    Decision decision;
+    uint64_t previous_ns = this->capture_ns;
+    this->capture_ns = capture_ns;
+
+    int64_t elapsed = 1;
+    if (previous_ns && capture_ns > previous_ns) {
+        double step_ns = (double)(capture_ns - previous_ns);
+        if (in_period_ns > 0) {
+            elapsed = std::max<int64_t>(1, llround(step_ns / in_period_ns));
+        }
+        if (in_frames == 0 || off_period(step_ns, elapsed, in_period_ns)) {
+            in_base_ns = previous_ns;
+            in_frames = 0;
+            elapsed = 1;
+            target = -1;
+        }
+        in_frames += elapsed;
+        in_period_ns = (double)(capture_ns - in_base_ns) / in_frames;
+    }
+
+    if (!have_flip || out_period_ns <= 0) {
+        return decision;
+    }
+    if (!enabled || target < 0) {
+        resync(capture_ns);
+    } else {
+        target += elapsed;
+        double slack = (double)vblank_ns(target) - (double)capture_ns;
+        if (fabs(slack - slack_ns) > out_period_ns / 2) {
+            // stalled or jumped (no flips for a while, signal change), start from the natural vblank
+            resync(capture_ns);
+        } else {
+            slack_ns += (slack - slack_ns) / 16;
+            double guard_ns = guard_ms * 1e6;
+            if (slack_ns < guard_ns) {
+                target++;
+                slack_ns += out_period_ns;
+                scheduled_repeats++;
+            } else if (slack_ns > out_period_ns + guard_ns + hysteresis_ms * 1e6) {
+                // the previous frame is already committed for the vblank before, so this one is the drop:
+                // held until the next frame supersedes it and takes over its vblank
+                target--;
+                slack_ns -= out_period_ns;
+                scheduled_drops++;
+                decision.not_before_ns = capture_ns + (uint64_t)(in_period_ns * 3 / 2);
+                return decision;
+            }
+        }
+    }
+    decision.target = target;
+
+    uint64_t earlier_vblank_ns = vblank_ns(target - 1);
+    if (enabled && earlier_vblank_ns > capture_ns) {
+        // committed now it could still latch the earlier vblank
+        decision.not_before_ns = earlier_vblank_ns + 500000;
+    }
+    return decision;
+}
+
+void DriftController::on_flip(unsigned int sequence, uint64_t flip_ns, bool video, int64_t target) {
+    int64_t unwrapped = have_flip ? flip_sequence + (int32_t)(sequence - last_raw_sequence) : sequence;
+    last_raw_sequence = sequence;
+    if (!have_flip || unwrapped <= flip_sequence || flip_ns <= this->flip_ns) {
+        have_flip = true;
+        out_base_sequence = unwrapped;
+        out_base_ns = flip_ns;
+        last_video_sequence = -1;
+        this->target = -1;
+    } else {
+        int64_t steps = unwrapped - flip_sequence;
+        if (off_period((double)(flip_ns - this->flip_ns), steps, out_period_ns)) {
+            out_base_sequence = flip_sequence;
+            out_base_ns = this->flip_ns;
+            this->target = -1;
+        }
+        out_period_ns = (double)(flip_ns - out_base_ns) / (unwrapped - out_base_sequence);
+    }
+    flip_sequence = unwrapped;
+    this->flip_ns = flip_ns;
+
+    if (!video) {
+        return;
+    }
+    if (last_video_sequence >= 0) {
+        int64_t gap = unwrapped - last_video_sequence - 1;
+        // longer gaps are the source pausing, not drift
+        if (gap > 0 && gap < 8) {
+            repeats += gap;
+        }
+    }
+    last_video_sequence = unwrapped;
+    if (target >= 0 && target != unwrapped) {
+        missed++;
+    }
+}
+
+void DriftController::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    bool first = last_report_ns == 0;
+    last_report_ns = now;
+    if (first || in_period_ns <= 0 || out_period_ns <= 0) {
+        return;
+    }
+    // slack gained per ns of input, positive: input is faster and frames pile up towards a drop
+    double drift = (out_period_ns - in_period_ns) / in_period_ns;
+    char next[64] = "no slip expected";
+    if (!enabled) {
+        snprintf(next, sizeof(next), "VRR, not scheduled");
+    } else if (target >= 0 && fabs(drift) > 1e-7) {
+        double guard_ns = guard_ms * 1e6;
+        double until_ns = drift > 0 ? (out_period_ns + guard_ns + hysteresis_ms * 1e6 - slack_ns) / drift
+                                    : (slack_ns - guard_ns) / -drift;
+        snprintf(next, sizeof(next), "next %s in %.0fs", drift > 0 ? "drop" : "repeat", until_ns / 1e9);
+    }
+    printf("[DRIFT] in %.3fHz out %.3fHz, drift %+.3fms/s, slack %.2fms, %s, scheduled %llu drops %llu repeats, "
+           "%llu repeats, %llu missed\n",
+           1e9 / in_period_ns, 1e9 / out_period_ns, drift * 1e3, slack_ns / 1e6, next,
+           (unsigned long long)scheduled_drops, (unsigned long long)scheduled_repeats,
+           (unsigned long long)repeats, (unsigned long long)missed);
+    scheduled_drops = scheduled_repeats = repeats = missed = 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Capture and display run on separate clocks, even a matched mode is 60.01 in vs 60.00 out.
+ * The slack from a capture to the vblank it lands on walks by the period difference every frame;
+ * left alone it eventually sits right at the commit deadline and capture jitter decides per frame,
+ * which shows as a burst of alternating drops and repeats.
+ *
+ * Every frame gets a target vblank, one after the previous frame's target (input gaps counted in).
+ * While the smoothed slack to it stays inside [guard, period + guard + hysteresis] nothing changes;
+ * frames whose target is a vblank later than the next one are held until that earlier vblank passed.
+ * Leaving the band slips exactly once: below it the target moves a vblank later (one repeat), above it the frame
+ * is held until the next one supersedes it and takes over its vblank (one drop).
+ *
+ * Not thread-safe, Presenter calls it under its mutex.
+ */
+class DriftController {
+public:
+    struct Decision {
+        // commit not before this, 0 commits right away
+        uint64_t not_before_ns = 0;
+        // vblank sequence the frame is meant for, -1 if unknown
+        int64_t target = -1;
+    };
+
+    // on every submitted video frame
+    Decision on_capture(uint64_t capture_ns);
+    // on every flip, video: the flip brought target's frame on screen
+    void on_flip(unsigned int sequence, uint64_t flip_ns, bool video, int64_t target);
+    // display refresh before the first flips measured it, e.g. the mode's refresh
+    void set_nominal_refresh(double hz);
+    // only measure, never hold (VRR: the display follows the commits)
+    void set_enabled(bool enabled);
+
+    // prints rates, drift and slips, at most every interval_ms
+    void report(int interval_ms = 5000);
+
+    double guard_ms = 2.0;
+    double hysteresis_ms = 2.0;
+
+    uint64_t scheduled_drops = 0;
+    uint64_t scheduled_repeats = 0;
+    // vblanks without a new frame between two video flips
+    uint64_t repeats = 0;
+    // video flips on a different vblank than targeted
+    uint64_t missed = 0;
+
+private:
+    uint64_t vblank_ns(int64_t sequence) const;
+    void resync(uint64_t capture_ns);
+
+    bool enabled = true;
+
+    // output: last flip, and the period averaged since out_base
+    bool have_flip = false;
+    int64_t flip_sequence = 0;
+    uint64_t flip_ns = 0;
+    int64_t out_base_sequence = 0;
+    uint64_t out_base_ns = 0;
+    double out_period_ns = 0;
+    // unwraps the 32-bit kernel counter
+    unsigned int last_raw_sequence = 0;
+    int64_t last_video_sequence = -1;
+
+    // input: last capture, and the period averaged over in_frames since in_base_ns
+    uint64_t capture_ns = 0;
+    uint64_t in_base_ns = 0;
+    int64_t in_frames = 0;
+    double in_period_ns = 0;
+
+    int64_t target = -1;
+    double slack_ns = 0;
+
+    uint64_t last_report_ns = 0;
+};
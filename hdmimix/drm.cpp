@@ -3,16 +3,103 @@
 #include <iostream>
 #include <unistd.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <libdrm/drm_fourcc.h>
 #include <sys/mman.h>
+#include <mutex>
+#include <set>
 
 
+// outputs on one card share its fd, and with it the CRTCs and planes handed out so far
+struct DrmCard {
+    int fd = -1;
+    int refs = 0;
+    // KMS object ids are unique across object types
+    std::set<uint32_t> claimed;
+};
+static std::mutex cards_mutex;
+static std::map<std::string, DrmCard> cards;
+
+static int acquire_card(const std::string& device) {
+    std::lock_guard<std::mutex> lock(cards_mutex);
+    DrmCard& card = cards[device];
+    if (card.refs == 0) {
+        // nonblocking: presenters of every output poll this fd, whoever reads an event must not block on the next one
+        card.fd = ::open(device.c_str(), O_RDWR | O_CLOEXEC | O_NONBLOCK);
+        if (card.fd < 0) {
+            cards.erase(device);
+            return -1;
+        }
+    }
+    card.refs++;
+    return card.fd;
+}
+
+static void release_card(const std::string& device) {
+    std::lock_guard<std::mutex> lock(cards_mutex);
+    auto it = cards.find(device);
+    if (it == cards.end()) {
+        return;
+    }
+    if (--it->second.refs == 0) {
+        drmClose(it->second.fd);
+        cards.erase(it);
+    }
+}
+
+// "HDMI-A-1" like the kernel and drm_info name it
+static std::string connector_type_name(const drmModeConnector* connector) {
+    static const char* names[] = {
+        "Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO", "LVDS", "Component",
+        "DIN", "DP", "HDMI-A", "HDMI-B", "TV", "eDP", "Virtual", "DSI", "DPI", "Writeback", "SPI", "USB",
+    };
+    const char* type = connector->connector_type < sizeof(names) / sizeof(names[0]) ? names[connector->connector_type] : "Unknown";
+    return std::string(type) + "-" + std::to_string(connector->connector_type_id);
+}
+
+// @return property id, 0 if the object has none by that name
+static uint32_t find_property(int fd, uint32_t object_id, uint32_t object_type, const char* name, uint64_t* value = nullptr) {
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object_id, object_type);
+    if (!props) {
+        return 0;
+    }
+    uint32_t prop_id = 0;
+    for (uint32_t i = 0; i < props->count_props && !prop_id; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+        if (!prop) {
+            continue;
+        }
+        if (strcmp(prop->name, name) == 0) {
+            prop_id = prop->prop_id;
+            if (value) {
+                *value = props->prop_values[i];
+            }
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+    return prop_id;
+}
+
+bool DRMDevice::claim(uint32_t object_id) {
+    std::lock_guard<std::mutex> lock(cards_mutex);
+    return cards[device].claimed.insert(object_id).second;
+}
+
+void DRMDevice::unclaim(uint32_t object_id) {
+    std::lock_guard<std::mutex> lock(cards_mutex);
+    auto it = cards.find(device);
+    if (it != cards.end()) {
+        it->second.claimed.erase(object_id);
+    }
+}
+
 bool DRMDevice::open_not_closing_on_failure() {
     // 1. Open the DRM device
-    drm_fd = ::open(device.c_str(), O_RDWR);
+    drm_fd = acquire_card(device);
     if (drm_fd < 0) {
         std::cerr << "Failed to open DRM device" << std::endl;
         return false;
@@ -29,92 +116,217 @@ bool DRMDevice::open_not_closing_on_failure() {
         return false;
     }
     
-    // Find a connected connector
-    for (int i = 0; i < resources->count_connectors; i++) {
-        connector = drmModeGetConnector(drm_fd, resources->connectors[i]);
-        if (connector->connection == DRM_MODE_CONNECTED) {
-            break;
+    return find_connector() && find_planes();
+}
+
+bool DRMDevice::find_connector() {
+    for (int i = 0; i < resources->count_connectors && !connector; i++) {
+        drmModeConnector* candidate = drmModeGetConnector(drm_fd, resources->connectors[i]);
+        if (!candidate) {
+            continue;
+        }
+        bool wanted = connector_name.empty() || connector_name == connector_type_name(candidate)
+                      || connector_name == std::to_string(candidate->connector_id);
+        if (wanted && candidate->connection == DRM_MODE_CONNECTED && claim(candidate->connector_id)) {
+            connector = candidate;
+        } else {
+            drmModeFreeConnector(candidate);
         }
-        connector = nullptr;
     }
-    
+
     if (!connector) {
-        std::cerr << "No connected connector found" << std::endl;
+        std::cerr << "No connected connector found" << (connector_name.empty() ? "" : " for " + connector_name) << std::endl;
         return false;
     }
-    
+
     conn_id = connector->connector_id;
-    
-    // Find encoder and CRTC
+
+    // Find encoder and CRTC: keep the one already driving the connector, else any free one it can use
     crtc_id = 0;
     drmModeEncoder* encoder = drmModeGetEncoder(drm_fd, connector->encoder_id);
     if (encoder) {
-        crtc_id = encoder->crtc_id;
+        if (encoder->crtc_id && claim(encoder->crtc_id)) {
+            crtc_id = encoder->crtc_id;
+        }
         drmModeFreeEncoder(encoder);
     }
-    
+    for (int i = 0; i < connector->count_encoders && !crtc_id; i++) {
+        encoder = drmModeGetEncoder(drm_fd, connector->encoders[i]);
+        if (!encoder) {
+            continue;
+        }
+        for (int j = 0; j < resources->count_crtcs && !crtc_id; j++) {
+            if ((encoder->possible_crtcs & (1u << j)) && claim(resources->crtcs[j])) {
+                crtc_id = resources->crtcs[j];
+            }
+        }
+        drmModeFreeEncoder(encoder);
+    }
+    if (!crtc_id) {
+        std::cerr << "No free CRTC for connector " << connector_type_name(connector) << std::endl;
+        return false;
+    }
+    for (int i = 0; i < resources->count_crtcs; i++) {
+        if (resources->crtcs[i] == crtc_id) {
+            crtc_index = i;
+        }
+    }
+
+    uint64_t capable = 0;
+    vrr_capable = find_property(drm_fd, conn_id, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable", &capable) && capable;
+    vrr_prop_id = find_property(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED");
+    vrr_committed = -1;
+    conn_crtc_prop_id = find_property(drm_fd, conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+    mode_id_prop_id = find_property(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+    active_prop_id = find_property(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+    out_fence_prop_id = find_property(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR");
+
+    printf("Output %s: connector %u, crtc %u%s\n", connector_type_name(connector).c_str(), conn_id, crtc_id,
+           vrr_capable && vrr_prop_id ? ", VRR capable" : "");
+    select_mode();
+    return true;
+}
+
+double DRMDevice::mode_refresh_hz(const drmModeModeInfo& mode) {
+    if (mode.htotal == 0 || mode.vtotal == 0) {
+        return mode.vrefresh;
+    }
+    // vrefresh is rounded, 59.94 and 60.00 both say 60
+    double hz = mode.clock * 1000.0 / ((double)mode.htotal * mode.vtotal);
+    if (mode.flags & DRM_MODE_FLAG_INTERLACE) {
+        hz *= 2;
+    }
+    if (mode.flags & DRM_MODE_FLAG_DBLSCAN) {
+        hz /= 2;
+    }
+    if (mode.vscan > 1) {
+        hz /= mode.vscan;
+    }
+    return hz;
+}
+
+void DRMDevice::select_mode() {
+    if (!connector) {
+        return;
+    }
+    const drmModeModeInfo* best = nullptr;
+    auto better = [this](const drmModeModeInfo& a, const drmModeModeInfo& b) {
+        bool a_interlaced = a.flags & DRM_MODE_FLAG_INTERLACE;
+        if (a_interlaced != (bool)(b.flags & DRM_MODE_FLAG_INTERLACE)) {
+            return !a_interlaced;
+        }
+        if (refresh_hint > 0) {
+            double da = fabs(mode_refresh_hz(a) - refresh_hint);
+            double db = fabs(mode_refresh_hz(b) - refresh_hint);
+            if (fabs(da - db) > 0.001) {
+                return da < db;
+            }
+        }
+        return (a.type & DRM_MODE_TYPE_PREFERRED) && !(b.type & DRM_MODE_TYPE_PREFERRED);
+    };
+    for (int i = 0; i < connector->count_modes; i++) {
+        const drmModeModeInfo& candidate = connector->modes[i];
+        if (candidate.hdisplay == width && candidate.vdisplay == height && (!best || better(candidate, *best))) {
+            best = &candidate;
+        }
+    }
+    if (!best && connector->count_modes > 0) {
+        best = &connector->modes[0];
+        fprintf(stderr, "Output %s has no %dx%d mode, using %s\n", connector_type_name(connector).c_str(), width, height, best->name);
+    }
+    if (best && best != mode) {
+        printf("Output %s: mode %dx%d@%.3fHz%s (source %.3fHz)\n", connector_type_name(connector).c_str(), best->hdisplay, best->vdisplay,
+               mode_refresh_hz(*best), best->flags & DRM_MODE_FLAG_INTERLACE ? " interlaced" : "", refresh_hint);
+    }
+    mode = best;
+}
 
+void DRMDevice::set_refresh_hint(double hz) {
+    refresh_hint = hz;
+    select_mode();
+    if (!canvas_fb_ids.empty() && mode != modeset_mode) {
+        // the canvas ring is imported already, no import is left to set the new rate
+        stage_modeset();
+    }
+}
+
+bool DRMDevice::find_planes() {
     drmModePlaneRes* plane_resources = drmModeGetPlaneResources(drm_fd);
     if (!plane_resources) {
         std::cerr << "Failed to get plane resources" << std::endl;
         return false;
     }
 
-    plane_id_support_input_pixfmt = -1;
-
+    // set_format looks again, the video format decides which planes can take it
+    plane_caps.clear();
+    plane_props.clear();
     // use drm_info instead, no more manual dump
-    for (int i = 0; i < plane_resources->count_planes; i++) {
+    for (uint32_t i = 0; i < plane_resources->count_planes; i++) {
         drmModePlane* plane = drmModeGetPlane(drm_fd, plane_resources->planes[i]);
-        bool support_input_pixfmt = false;
-        bool support_alpha = false;
-        for (int j = 0; j < plane->count_formats; j++) {
-            uint32_t c = plane->formats[j];
-            if (c == pixfmt) {
-                support_input_pixfmt = true;
-            }
-            if (c == DRM_FORMAT_ARGB8888) {
-                support_alpha = true;
-            }
+        if (!plane) {
+            continue;
         }
-        drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drm_fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
-        PlaneType plane_type = PlaneType::PLANE_TYPE_PRIMARY;
-
-        std::map<std::string, uint32_t> cur_prop_ids;
-        for (int j = 0; j < props->count_props; j++) {
-            drmModePropertyPtr prop = drmModeGetProperty(drm_fd, props->props[j]);
-            if (prop) {
-                cur_prop_ids[prop->name] = prop->prop_id;
-                if (drm_property_type_is(prop, DRM_MODE_PROP_ENUM)) {
-                    if(strcmp(prop->name, "type") == 0) {
-                        if (strcmp(prop->enums[props->prop_values[j]].name, "Overlay") == 0) {
-                            plane_type = PlaneType::PLANE_TYPE_OVERLAY;
-                        } else if (strcmp(prop->enums[props->prop_values[j]].name, "Cursor") == 0) {
-                            plane_type = PlaneType::PLANE_TYPE_CURSOR;
-                        } else if (strcmp(prop->enums[props->prop_values[j]].name, "Primary") == 0) {
-                            plane_type = PlaneType::PLANE_TYPE_PRIMARY;
-                        }
-                    }
-                }
-                drmModeFreeProperty(prop);
-            }
+        if (!(plane->possible_crtcs & (1u << crtc_index))) {
+            drmModeFreePlane(plane);
+            continue;
         }
-        panel_prop_ids[plane->plane_id] = cur_prop_ids;
-        if (support_input_pixfmt && plane_id_support_input_pixfmt < 0 && plane_type != PlaneType::PLANE_TYPE_CURSOR) {
-            plane_id_support_input_pixfmt = plane->plane_id;
-            plane_type_support_input_pixfmt = plane_type;
+        PlaneCaps caps;
+        caps.plane_id = plane->plane_id;
+        caps.formats.assign(plane->formats, plane->formats + plane->count_formats);
+        drmModeFreePlane(plane);
+
+        uint64_t type = DRM_PLANE_TYPE_OVERLAY;
+        find_property(drm_fd, caps.plane_id, DRM_MODE_OBJECT_PLANE, "type", &type);
+        caps.type = type == DRM_PLANE_TYPE_PRIMARY ? PlaneType::PLANE_TYPE_PRIMARY
+                  : type == DRM_PLANE_TYPE_CURSOR  ? PlaneType::PLANE_TYPE_CURSOR
+                                                   : PlaneType::PLANE_TYPE_OVERLAY;
+        // without zpos the driver stacks primary, overlays, cursor
+        caps.zpos_min = caps.zpos_max = caps.type == PlaneType::PLANE_TYPE_PRIMARY ? 0
+                                      : caps.type == PlaneType::PLANE_TYPE_OVERLAY ? 1 + i
+                                                                                   : 1 + plane_resources->count_planes + i;
+        uint32_t zpos_prop_id = find_property(drm_fd, caps.plane_id, DRM_MODE_OBJECT_PLANE, "zpos", &caps.zpos_min);
+        drmModePropertyPtr zpos_prop = zpos_prop_id ? drmModeGetProperty(drm_fd, zpos_prop_id) : nullptr;
+        if (zpos_prop) {
+            if (!(zpos_prop->flags & DRM_MODE_PROP_IMMUTABLE) && drm_property_type_is(zpos_prop, DRM_MODE_PROP_RANGE)
+                && zpos_prop->count_values == 2) {
+                caps.zpos_min = zpos_prop->values[0];
+                caps.zpos_max = zpos_prop->values[1];
+            } else {
+                // immutable: the current value is the only one
+                caps.zpos_max = caps.zpos_min;
+            }
+            drmModeFreeProperty(zpos_prop);
         }
-        if (support_alpha && plane_type == PlaneType::PLANE_TYPE_PRIMARY && plane_id_canvas < 0) {
-            plane_id_canvas = plane->plane_id;
+
+        PlaneCommit props;
+        if (!props.resolve(drm_fd, caps.plane_id)) {
+            continue;
         }
-        
-        drmModeFreePlane(plane);
+        caps.rotations = props.supported_rotations;
+        plane_props[caps.plane_id] = props;
+        plane_caps.push_back(caps);
     }
     drmModeFreePlaneResources(plane_resources);
 
-    if (plane_id_support_input_pixfmt < 0) {
-        std::cerr << "No suitable plane found for format " << pixfmt << std::endl;
-        return false;
+    if (!atomic_req) {
+        atomic_req = drmModeAtomicAlloc();
+        if (!atomic_req) {
+            std::cerr << "Failed to allocate atomic request" << std::endl;
+            return false;
+        }
+    }
+
+    if (layers.empty()) {
+        layers.resize(2);
+        layers[VIDEO_LAYER].request.role = LayerRole::VIDEO;
+        // no plane takes the input format: the renderer composites it on the GPU
+        layers[VIDEO_LAYER].request.composable = true;
+        layers[CANVAS_LAYER].request.role = LayerRole::CANVAS;
+        layers[CANVAS_LAYER].request.format = DRM_FORMAT_ARGB8888;
     }
+    layers[VIDEO_LAYER].request.format = pixfmt;
+    update_canvas_request();
+    update_video_request();
 
     /*
     drmModeCrtcPtr crtc_info = drmModeGetCrtc(drm_fd, crtc_id);
@@ -127,10 +339,226 @@ bool DRMDevice::open_not_closing_on_failure() {
     drmModeFreeCrtc(crtc_info);
     */
 
-    printf("Plane ID: overlay=%d (for hdmi passthrough), primary=%d (unused canvas)\n", plane_id_support_input_pixfmt, plane_id_canvas);
+    if (!allocate_planes()) {
+        std::cerr << "No suitable plane found for format " << pixfmt << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void DRMDevice::update_video_request() {
+    // a rejected geometry is composed by the renderer, the plane is only allocated for the full frame
+    LayerGeometry g = video_rejected ? LayerGeometry() : video_geometry;
+    layers[VIDEO_LAYER].request.geometry = g.resolved(width, height, width, height);
+}
+
+void DRMDevice::update_canvas_request() {
+    LayerGeometry g;
+    g.src = {0, 0, canvas_width ? canvas_width : width, canvas_height ? canvas_height : height};
+    g.dst = {0, 0, width, height};
+    layers[CANVAS_LAYER].request.geometry = g.resolved(g.src.w, g.src.h, width, height);
+}
+
+bool DRMDevice::stage_modeset() {
+    if (!mode || !conn_crtc_prop_id || !mode_id_prop_id || !active_prop_id) {
+        std::cerr << "Cannot set the mode with an atomic commit" << std::endl;
+        return false;
+    }
+    if (mode_blob_id) {
+        // the CRTC state holds its own reference
+        drmModeDestroyPropertyBlob(drm_fd, mode_blob_id);
+        mode_blob_id = 0;
+    }
+    int ret = drmModeCreatePropertyBlob(drm_fd, mode, sizeof(*mode), &mode_blob_id);
+    if (ret) {
+        std::cerr << "Failed to create mode blob: " << strerror(-ret) << std::endl;
+        return false;
+    }
+    modeset_mode = mode;
+    modeset_pending = true;
+    return true;
+}
+
+int DRMDevice::add_modeset(drmModeAtomicReqPtr req) const {
+    if (drmModeAtomicAddProperty(req, conn_id, conn_crtc_prop_id, crtc_id) < 0
+        || drmModeAtomicAddProperty(req, crtc_id, mode_id_prop_id, mode_blob_id) < 0
+        || drmModeAtomicAddProperty(req, crtc_id, active_prop_id, 1) < 0) {
+        return -ENOMEM;
+    }
+    return 3;
+}
+
+uint32_t DRMDevice::probe_fb(int layer) const {
+    if (layer == VIDEO_LAYER) {
+        for (uint32_t fb_id : passthrough_fb_ids) {
+            if (fb_id) {
+                return fb_id;
+            }
+        }
+        return 0;
+    }
+    return canvas_fb_ids.empty() ? 0 : canvas_fb_ids.begin()->second;
+}
+
+bool DRMDevice::test_assignment(const std::vector<PlaneCaps>& planes, const std::vector<PlaneAssignment>& assignment) {
+    drmModeAtomicSetCursor(atomic_req, 0);
+    std::set<uint32_t> used;
+    int probed = 0;
+    for (size_t i = 0; i < layers.size(); i++) {
+        if (assignment[i].plane < 0) {
+            continue;
+        }
+        uint32_t plane_id = planes[assignment[i].plane].plane_id;
+        used.insert(plane_id);
+        uint32_t fb_id = probe_fb(i);
+        if (fb_id == 0) {
+            // nothing imported yet, format and zpos range have to do until it is
+            continue;
+        }
+        PlaneCommit probe = plane_props[plane_id];
+        probe.set_layer(crtc_id, fb_id, layers[i].request.geometry, assignment[i].zpos);
+        if (probe.add_changed(atomic_req) < 0) {
+            return false;
+        }
+        probed++;
+    }
+    if (probed == 0) {
+        return true;
+    }
+    if (modeset_pending && add_modeset(atomic_req) < 0) {
+        return false;
+    }
+    // planes this output would give up are off, as in the commit after it
+    for (uint32_t plane_id : owned_planes) {
+        const PlaneCommit& props = plane_props[plane_id];
+        if (!used.count(plane_id) && props.plane_id) {
+            drmModeAtomicAddProperty(atomic_req, plane_id, props.prop_ids[PlaneCommit::FB_ID], 0);
+            drmModeAtomicAddProperty(atomic_req, plane_id, props.prop_ids[PlaneCommit::CRTC_ID], 0);
+        }
+    }
+    uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY | (modeset_pending ? DRM_MODE_ATOMIC_ALLOW_MODESET : 0);
+    return drmModeAtomicCommit(drm_fd, atomic_req, flags, nullptr) == 0;
+}
+
+bool DRMDevice::allocate_planes() {
+    // claims of every output on the card hold still until the result is claimed too
+    std::lock_guard<std::mutex> lock(cards_mutex);
+    std::set<uint32_t>& claimed = cards[device].claimed;
+    std::vector<PlaneCaps> planes;
+    for (const PlaneCaps& caps : plane_caps) {
+        if (!claimed.count(caps.plane_id) || owned_planes.count(caps.plane_id)) {
+            planes.push_back(caps);
+        }
+    }
+
+    // the allocator takes layers bottom to top by role
+    std::vector<size_t> order(layers.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return layers[a].request.role < layers[b].request.role; });
+    std::vector<LayerRequest> requests;
+    std::vector<uint32_t> preferred;
+    for (size_t i : order) {
+        requests.push_back(layers[i].request);
+        preferred.push_back(layers[i].plane.plane_id);
+    }
+    std::vector<PlaneAssignment> sorted;
+    bool found = allocator.allocate(requests, planes, preferred, [&](const std::vector<PlaneAssignment>& assignment) {
+        std::vector<PlaneAssignment> by_layer(layers.size());
+        for (size_t k = 0; k < order.size(); k++) {
+            by_layer[order[k]] = assignment[k];
+        }
+        return test_assignment(planes, by_layer);
+    }, sorted);
+    if (!found) {
+        fprintf(stderr, "Output %s: no plane assignment for %zu layers passed %d TEST_ONLY commits\n",
+                connector_type_name(connector).c_str(), layers.size(), allocator.tests);
+        return false;
+    }
 
+    std::set<uint32_t> used;
+    std::string summary;
+    for (size_t k = 0; k < order.size(); k++) {
+        Layer& layer = layers[order[k]];
+        const PlaneAssignment& assignment = sorted[k];
+        uint32_t plane_id = assignment.plane >= 0 ? planes[assignment.plane].plane_id : 0;
+        if (plane_id != layer.plane.plane_id) {
+            PlaneCommit moved = plane_id ? plane_props[plane_id] : PlaneCommit();
+            // whatever was staged shows on the new plane with the next commit
+            memcpy(moved.values, layer.plane.values, sizeof(moved.values));
+            layer.plane = moved;
+        }
+        layer.assignment = assignment;
+        if (plane_id) {
+            used.insert(plane_id);
+            layer.plane.set(PlaneCommit::ZPOS, assignment.zpos);
+        }
+        if (!layer.request.enabled) {
+            continue;
+        }
+        char line[96];
+        if (plane_id) {
+            snprintf(line, sizeof(line), "%s%s -> plane %u %s zpos %llu", summary.empty() ? "" : ", ", layer_role_name(layer.request.role),
+                     plane_id, planes[assignment.plane].type_name(), (unsigned long long)assignment.zpos);
+        } else {
+            snprintf(line, sizeof(line), "%s%s -> canvas", summary.empty() ? "" : ", ", layer_role_name(layer.request.role));
+        }
+        summary += line;
+    }
+    for (uint32_t plane_id : used) {
+        claimed.insert(plane_id);
+        owned_planes.insert(plane_id);
+        released_planes.erase(plane_id);
+    }
+    for (uint32_t plane_id : owned_planes) {
+        if (!used.count(plane_id)) {
+            released_planes.insert(plane_id);
+        }
+    }
+    printf("Output %s planes: %s (%d TEST_ONLY)\n", connector_type_name(connector).c_str(), summary.c_str(), allocator.tests);
     return true;
+}
+
+bool DRMDevice::set_format(int width, int height, int pixfmt) {
+    release_dmabufs();
+    release_canvas_bufs();
+    this->width = width;
+    this->height = height;
+    this->pixfmt = pixfmt;
+    select_mode();
+    // the passthrough plane may not scan out the new format
+    return find_planes();
+}
 
+void DRMDevice::release_dmabufs() {
+    while (!passthrough_fb_ids.empty()) {
+        if (passthrough_fb_ids.back()) {
+            drmModeRmFB(drm_fd, passthrough_fb_ids.back());
+        }
+        passthrough_fb_ids.pop_back();
+    }
+    // removing the framebuffer turned the plane off, it stays out of commits until staged again
+    if (!layers.empty()) {
+        layers[VIDEO_LAYER].plane.invalidate();
+        layers[VIDEO_LAYER].plane.set(PlaneCommit::FB_ID, 0);
+    }
+}
+
+void DRMDevice::release_canvas_bufs() {
+    while (!canvas_fb_ids.empty()) {
+        auto it = canvas_fb_ids.begin();
+        drmModeRmFB(drm_fd, it->second);
+        canvas_fb_ids.erase(it);
+    }
+    // the next canvas may come in another size, and the CRTC may be off without a framebuffer
+    canvas_width = 0;
+    canvas_height = 0;
+    modeset_mode = nullptr;
+    if (!layers.empty()) {
+        layers[CANVAS_LAYER].plane.invalidate();
+        layers[CANVAS_LAYER].plane.set(PlaneCommit::FB_ID, 0);
+    }
 }
 
 bool DRMDevice::close() {
@@ -138,7 +566,17 @@ bool DRMDevice::close() {
         return false;
     }
 
+    for (uint32_t plane_id : owned_planes) {
+        unclaim(plane_id);
+    }
+    owned_planes.clear();
+    released_planes.clear();
+    if (crtc_id) {
+        unclaim(crtc_id);
+        crtc_id = 0;
+    }
     if (connector) {
+        unclaim(connector->connector_id);
         drmModeFreeConnector(connector);
         connector = nullptr;
     }
@@ -148,15 +586,19 @@ bool DRMDevice::close() {
         resources = nullptr;
     }
 
-    while(!passthrough_fd_ids.empty()) {
-        drmModeRmFB(drm_fd, passthrough_fd_ids.back());
-        passthrough_fd_ids.pop_back();
+    release_dmabufs();
+    release_canvas_bufs();
+
+    if (atomic_req) {
+        drmModeAtomicFree(atomic_req);
+        atomic_req = nullptr;
     }
-    while (!canvas_fb_ids.empty()) {
-        auto it = canvas_fb_ids.begin();
-        drmModeRmFB(drm_fd, it->second);
-        canvas_fb_ids.erase(it);
+    if (mode_blob_id) {
+        drmModeDestroyPropertyBlob(drm_fd, mode_blob_id);
+        mode_blob_id = 0;
     }
+    modeset_mode = nullptr;
+    modeset_pending = false;
 
     if (dumb_buf_ptr) {
         munmap(dumb_buf_ptr, dumb_buf_size);
@@ -168,31 +610,24 @@ bool DRMDevice::close() {
         dumb_buf_handle = 0;
     }
 
-    if (drm_fd >= 0) {
-        drmClose(drm_fd);
-    }
+    // the last output on the card closes it
+    release_card(device);
     drm_fd = -1;
     
     return true;
 }
 
 int DRMDevice::import_dmabuf(int index, int dmabuf_fd) {
-    assert(index == passthrough_fd_ids.size());
-    
+    if (index < 0) {
+        return -1;
+    }
+
     if (pixfmt != DRM_FORMAT_NV12 && pixfmt != DRM_FORMAT_NV24) {
         std::cerr << "Unsupported pixel format: " << pixfmt << std::endl;
         return -1;
     }
     int ret;
-    
-    drmModeModeInfo* mode = nullptr;
-	for (int i = 0; i < connector->count_modes; ++i) {
-        mode = &connector->modes[i];
-        if (mode->hdisplay == width && mode->vdisplay == height) {
-            break;
-        }
-    }
-    
+
     uint32_t bo_handle = 0;
     if (drmPrimeFDToHandle(drm_fd, dmabuf_fd, &bo_handle) < 0) {
         std::cerr << "Failed to import DMA buffer" << std::endl;
@@ -212,7 +647,7 @@ int DRMDevice::import_dmabuf(int index, int dmabuf_fd) {
     modifiers[1] = DRM_FORMAT_MOD_LINEAR;
 
     uint32_t fb_id = 0;
-    ret = drmModeAddFB2WithModifiers(drm_fd, width, height, 
+    ret = drmModeAddFB2WithModifiers(drm_fd, width, height,
                                     pixfmt, 
                                     handles, pitches, offsets, 
                                     modifiers, &fb_id, 
@@ -222,10 +657,16 @@ int DRMDevice::import_dmabuf(int index, int dmabuf_fd) {
         fprintf(stderr, "Failed to add FB: %s\n", strerror(-ret));
         return -1;
     }
-    passthrough_fd_ids.push_back(fb_id);
+    if (index >= (int)passthrough_fb_ids.size()) {
+        passthrough_fb_ids.resize(index + 1, 0);
+    }
+    if (passthrough_fb_ids[index]) {
+        drmModeRmFB(drm_fd, passthrough_fb_ids[index]);
+    }
+    passthrough_fb_ids[index] = fb_id;
 
     printf("Successfully created FB with ID %u\n", fb_id);
-    return passthrough_fd_ids.size() - 1;
+    return index;
 }
 
 uint32_t DRMDevice::create_canvas_buf_dumb() {
@@ -234,7 +675,7 @@ uint32_t DRMDevice::create_canvas_buf_dumb() {
         return 0;
     }
 
-    if (plane_id_canvas < 0) {
+    if (layers.empty() || layers[CANVAS_LAYER].plane.plane_id == 0) {
         std::cerr << "No canvas plane available" << std::endl;
         return 0;
     }
@@ -283,14 +724,7 @@ uint32_t DRMDevice::create_canvas_buf_dumb() {
 
     canvas_fb_ids[nullptr] = canvas_fb_id;
 
-    drmModeModeInfo* mode = nullptr;
-	for (int i = 0; i < connector->count_modes; ++i) {
-        mode = &connector->modes[i];
-        if (mode->hdisplay == width && mode->vdisplay == height) {
-            break;
-        }
-    }
-	drmModeSetCrtc(drm_fd, crtc_id, canvas_fb_id, 0, 0, &conn_id, 1, mode);
+	drmModeSetCrtc(drm_fd, crtc_id, canvas_fb_id, 0, 0, &conn_id, 1, const_cast<drmModeModeInfo*>(mode));
 
     return canvas_fb_id;
 }
@@ -320,7 +754,10 @@ uint32_t DRMDevice::import_canvas_buf_bo(gbm_bo* bo)
     uint32_t pitches[4] = {canvas_pitch, 0, 0, 0};
     uint32_t offsets[4] = {fb2_offset, 0, 0, 0};
     uint64_t modifiers[4] = {canvas_modifiers, 0, 0, 0};
-    int ret = drmModeAddFB2WithModifiers(drm_fd, width, height,
+    // a reduced canvas comes in its own size
+    int bo_width = gbm_bo_get_width(bo);
+    int bo_height = gbm_bo_get_height(bo);
+    int ret = drmModeAddFB2WithModifiers(drm_fd, bo_width, bo_height,
                                          DRM_FORMAT_ARGB8888,
                                          handles, pitches, offsets,
                                          modifiers, &canvas_fb_id,
@@ -331,127 +768,331 @@ uint32_t DRMDevice::import_canvas_buf_bo(gbm_bo* bo)
         return 0;
     }
 
+    bool first = canvas_fb_ids.empty();
     canvas_fb_ids[bo] = canvas_fb_id;
+    if (first) {
+        // the canvas plane scales it to the screen
+        canvas_width = bo_width;
+        canvas_height = bo_height;
+        update_canvas_request();
+    }
 
-    drmModeModeInfo* mode = nullptr;
-	for (int i = 0; i < connector->count_modes; ++i) {
-        mode = &connector->modes[i];
-        if (mode->hdisplay == width && mode->vdisplay == height) {
-            break;
+    // only the first bo of a format sets the mode, the rest of the ring is just framebuffers
+    bool legacy = mode && mode != modeset_mode && bo_width >= mode->hdisplay && bo_height >= mode->vdisplay;
+    if (legacy) {
+        drmModeSetCrtc(drm_fd, crtc_id, canvas_fb_id, 0, 0, &conn_id, 1, const_cast<drmModeModeInfo*>(mode));
+        modeset_mode = mode;
+        // the legacy call reprogrammed the primary plane, zpos and alpha go out with the next commit
+        for (Layer& layer : layers) {
+            layer.plane.invalidate();
+        }
+    } else if (mode != modeset_mode && !stage_modeset()) {
+        return 0;
+    }
+    if (!primary_plane_id) {
+        // whichever primary plane the legacy call put the canvas on, or the one already on the CRTC
+        for (const PlaneCaps& caps : plane_caps) {
+            drmModePlane* plane = caps.type == PlaneType::PLANE_TYPE_PRIMARY ? drmModeGetPlane(drm_fd, caps.plane_id) : nullptr;
+            if (plane && plane->crtc_id == crtc_id && (!legacy || plane->fb_id == canvas_fb_id)) {
+                primary_plane_id = caps.plane_id;
+            }
+            drmModeFreePlane(plane);
         }
     }
-
-	drmModeSetCrtc(drm_fd, crtc_id, canvas_fb_id, 0, 0, &conn_id, 1, mode);
-    
-
-    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
-    if (!req) {
-        std::cerr << "Failed to allocate atomic request" << std::endl;
-        return false;
+    bool primary_used = false;
+    for (const Layer& layer : layers) {
+        primary_used |= primary_plane_id && layer.plane.plane_id == primary_plane_id;
     }
-    uint32_t plane_id = plane_id_canvas;
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_ID"], crtc_id);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["FB_ID"], canvas_fb_id);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_X"], 0);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_Y"], 0);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_W"], width);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_H"], height);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_X"], 0);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_Y"], 0);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_W"], width << 16);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_H"], height << 16);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_VISIBLE"], 1);
-    // alpha
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["alpha"], 65535);
-    drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["zpos"], 11);
-    ret = drmModeAtomicCommit(drm_fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_NONBLOCK, nullptr);
-    drmModeAtomicFree(req);
-    if (ret < 0 && ret != -EBUSY) {
-        // a few EBUSY is normal.
-        std::cerr << "Failed to commit atomic request: " << strerror(-ret) << std::endl;
-        return false;
+    if (primary_plane_id && !primary_used) {
+        // the canvas has another plane, it must not show twice
+        released_planes.insert(primary_plane_id);
+    }
+    if (first) {
+        // a canvas to TEST_ONLY with, its plane may not scan it out after all
+        allocate_planes();
     }
 
     return canvas_fb_id;
 }
 
-bool DRMDevice::display(int index, uint32_t canvas_fb_id) {
-    if (passthrough_fd_ids.empty()) {
-        std::cerr << "No framebuffer IDs available" << std::endl;
-        return false;
+bool DRMDevice::set_video_geometry(const LayerGeometry& geometry) {
+    video_geometry = geometry;
+    video_rejected = false;
+    update_video_request();
+    // rotation the planes lack, scaler limits: some other stacking may still take it
+    if (allocate_planes()) {
+        return true;
     }
+    const LayerGeometry& g = layers[VIDEO_LAYER].request.geometry;
+    fprintf(stderr, "No plane shows the video at src %dx%d+%d+%d -> dst %dx%d+%d+%d rotation 0x%x\n",
+            g.src.w, g.src.h, g.src.x, g.src.y, g.dst.w, g.dst.h, g.dst.x, g.dst.y, g.rotation);
+    // the renderer composes the video into the canvas instead
+    video_rejected = true;
+    update_video_request();
+    allocate_planes();
+    return false;
+}
+
+bool DRMDevice::video_on_plane() const {
+    return !video_rejected && !layers.empty() && layers[VIDEO_LAYER].plane.plane_id != 0;
+}
 
+void DRMDevice::set_passthrough(int index) {
+    if (index < 0 || index >= (int)passthrough_fb_ids.size() || passthrough_fb_ids[index] == 0) {
+        std::cerr << "No framebuffer for buffer " << index << std::endl;
+        return;
+    }
+    Layer& video = layers[VIDEO_LAYER];
+    if (video.plane.plane_id == 0) {
+        return;
+    }
     /*
-    int ret = drmModeSetPlane(drm_fd, plane_id_support_input_pixfmt, crtc_id, passthrough_fd_ids[index], 0,
+    int ret = drmModeSetPlane(drm_fd, plane_id_support_input_pixfmt, crtc_id, passthrough_fb_ids[index], 0,
         0, 0, width, height,
         0, 0, width << 16, height << 16);
     */
-    
     // legacy API above cause a few frame-drops a little bit, so use atomic API instead.
-    
-    int ret = 0;
+    video.plane.set_layer(crtc_id, passthrough_fb_ids[index], video.request.geometry, video.assignment.zpos);
+}
 
-    if (index != cur_passthrough_fd_index) {
-        cur_passthrough_fd_index = index;
-        drmModeAtomicReqPtr req = drmModeAtomicAlloc();
-        if (!req) {
-            std::cerr << "Failed to allocate atomic request" << std::endl;
-            return false;
+void DRMDevice::set_canvas(uint32_t canvas_fb_id, int in_fence_fd) {
+    Layer& canvas = layers[CANVAS_LAYER];
+    if (canvas_fb_id == 0 || canvas.plane.plane_id == 0) {
+        return;
+    }
+    canvas.plane.set_layer(crtc_id, canvas_fb_id, canvas.request.geometry, canvas.assignment.zpos);
+    // the kernel holds the flip until the renderer's fence signals, without one it waits on the bo's implicit fence
+    canvas.plane.set_in_fence(in_fence_fd);
+    canvas_staged = true;
+}
+
+int DRMDevice::take_out_fence() {
+    int fd = out_fence;
+    out_fence = -1;
+    return fd;
+}
+
+int DRMDevice::commit(uint32_t flags, void* user_data) {
+    drmModeAtomicSetCursor(atomic_req, 0);
+    int count = 0;
+    for (Layer& layer : layers) {
+        PlaneCommit& plane = layer.plane;
+        // never staged since the last format change, or composited
+        if (plane.plane_id == 0 || plane.values[PlaneCommit::FB_ID] == 0) {
+            continue;
         }
-        uint32_t plane_id = plane_id_support_input_pixfmt;
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_ID"], crtc_id);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["FB_ID"], passthrough_fd_ids[index]);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_X"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_Y"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_W"], width);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_H"], height);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_X"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_Y"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_W"], width << 16);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_H"], height << 16);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_VISIBLE"], 1);
-        // alpha
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["alpha"], 65535);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["zpos"], 10);
-        ret = drmModeAtomicCommit(drm_fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_NONBLOCK, nullptr);
-        drmModeAtomicFree(req);
-        if (ret < 0 && ret != -EBUSY) {
-            // a few EBUSY is normal.
-            std::cerr << "Failed to commit atomic request: " << strerror(-ret) << std::endl;
-            return false;
+        int added = plane.add_changed(atomic_req);
+        // in the request now, set_canvas stages it again for a retry. the caller closes the fd
+        plane.clear_in_fence();
+        if (added < 0) {
+            std::cerr << "Failed to build atomic request" << std::endl;
+            return -ENOMEM;
+        }
+        count += added;
+    }
+    for (uint32_t plane_id : released_planes) {
+        const PlaneCommit& props = plane_props[plane_id];
+        if (drmModeAtomicAddProperty(atomic_req, plane_id, props.prop_ids[PlaneCommit::FB_ID], 0) < 0
+            || drmModeAtomicAddProperty(atomic_req, plane_id, props.prop_ids[PlaneCommit::CRTC_ID], 0) < 0) {
+            std::cerr << "Failed to build atomic request" << std::endl;
+            return -ENOMEM;
+        }
+        count += 2;
+    }
+    bool want_out_fence = canvas_staged && out_fence_prop_id && !(flags & DRM_MODE_ATOMIC_TEST_ONLY);
+    canvas_staged = false;
+    if (want_out_fence) {
+        if (out_fence >= 0) {
+            // nobody took the last one
+            ::close(out_fence);
+            out_fence = -1;
+        }
+        if (drmModeAtomicAddProperty(atomic_req, crtc_id, out_fence_prop_id, (uint64_t)(uintptr_t)&out_fence) < 0) {
+            std::cerr << "Failed to build atomic request" << std::endl;
+            return -ENOMEM;
+        }
+    }
+    if (modeset_pending) {
+        int added = add_modeset(atomic_req);
+        if (added < 0) {
+            std::cerr << "Failed to build atomic request" << std::endl;
+            return added;
         }
+        count += added;
     }
+    int vrr = use_vrr && vrr_capable;
+    if (vrr_prop_id && vrr != vrr_committed) {
+        if (drmModeAtomicAddProperty(atomic_req, crtc_id, vrr_prop_id, vrr) < 0) {
+            std::cerr << "Failed to build atomic request" << std::endl;
+            return -ENOMEM;
+        }
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    // steady-state flips never modeset, a commit that would have to fails instead of blanking the screen
+    if (modeset_pending) {
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+    // the event can be read on another presenter's thread before the ioctl returns here
+    bool wants_event = (flags & DRM_MODE_PAGE_FLIP_EVENT) && !(flags & DRM_MODE_ATOMIC_TEST_ONLY);
+    void* previous_user_data = wants_event ? flip_user_data.exchange(user_data) : nullptr;
+    int ret = drmModeAtomicCommit(drm_fd, atomic_req, flags, this);
+    if (ret < 0) {
+        out_fence = -1;
+        if (wants_event) {
+            // no event comes for this one, a flip still pending keeps its owner
+            flip_user_data = previous_user_data;
+        }
+        // not applied, the same properties go out again with the next commit
+        return ret;
+    }
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+        return 1;
+    }
+    for (Layer& layer : layers) {
+        if (layer.plane.plane_id != 0 && layer.plane.values[PlaneCommit::FB_ID] != 0) {
+            layer.plane.mark_committed();
+        }
+    }
+    // off now, other outputs may take them
+    for (uint32_t plane_id : released_planes) {
+        if (owned_planes.erase(plane_id)) {
+            unclaim(plane_id);
+        }
+    }
+    released_planes.clear();
+    modeset_pending = false;
+    if (vrr_prop_id && vrr != vrr_committed) {
+        vrr_committed = vrr;
+        if (use_vrr) {
+            printf("Output %s: VRR %s\n", connector_type_name(connector).c_str(), vrr ? "on" : "off");
+        }
+    }
+    return 1;
+}
 
-    if (canvas_fb_id != 0 && canvas_fb_id != cur_canvas_fb_id) {
-        cur_canvas_fb_id = canvas_fb_id;
-        drmModeAtomicReqPtr req = drmModeAtomicAlloc();
-        if (!req) {
-            std::cerr << "Failed to allocate atomic request" << std::endl;
-            return false;
+// the fd is shared, an event read here may belong to another output: user_data says which
+static thread_local DisplayBackend::flip_handler_t active_flip_handler = nullptr;
+
+void DRMDevice::handle_events(flip_handler_t on_flip) {
+    drmEventContext ctx{};
+    ctx.version = 2;
+    ctx.page_flip_handler = page_flip_handler;
+    active_flip_handler = on_flip;
+    drmHandleEvent(drm_fd, &ctx);
+    active_flip_handler = nullptr;
+}
+
+void DRMDevice::page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void* user_data) {
+    DRMDevice* device = static_cast<DRMDevice*>(user_data);
+    void* flip_user_data = device ? device->flip_user_data.load() : nullptr;
+    // an event nobody asked a user_data for has nobody to tell
+    if (active_flip_handler && flip_user_data) {
+        // flip timestamps are CLOCK_MONOTONIC, same as V4L2
+        active_flip_handler(sequence, (uint64_t)tv_sec * 1000000000ull + (uint64_t)tv_usec * 1000ull, flip_user_data);
+    }
+}
+
+const char* PlaneCommit::prop_name(Prop prop) {
+    static const char* names[PROP_COUNT] = {
+        "CRTC_ID", "FB_ID", "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+        "SRC_X", "SRC_Y", "SRC_W", "SRC_H", "CRTC_VISIBLE", "alpha", "zpos", "rotation",
+    };
+    return names[prop];
+}
+
+bool PlaneCommit::resolve(int drm_fd, uint32_t plane_id) {
+    *this = PlaneCommit();
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE);
+    if (!props) {
+        std::cerr << "Failed to get properties of plane " << plane_id << std::endl;
+        return false;
+    }
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(drm_fd, props->props[i]);
+        if (!prop) {
+            continue;
         }
-        uint32_t plane_id = plane_id_canvas;
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_ID"], crtc_id);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["FB_ID"], canvas_fb_id);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_X"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_Y"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_W"], width);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_H"], height);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_X"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_Y"], 0);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_W"], width << 16);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["SRC_H"], height << 16);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["CRTC_VISIBLE"], 1);
-        // alpha
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["alpha"], 65535);
-        drmModeAtomicAddProperty(req, plane_id, panel_prop_ids[plane_id]["zpos"], 11);
-        ret = drmModeAtomicCommit(drm_fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_ATOMIC_NONBLOCK, nullptr);
-        drmModeAtomicFree(req);
-        if (ret < 0 && ret != -EBUSY) {
-            // a few EBUSY is normal.
-            std::cerr << "Failed to commit atomic request: " << strerror(-ret) << std::endl;
-            return false;
+        for (int p = 0; p < PROP_COUNT && !(prop->flags & DRM_MODE_PROP_IMMUTABLE); p++) {
+            // an immutable zpos is read, never committed
+            if (strcmp(prop->name, prop_name((Prop)p)) == 0) {
+                prop_ids[p] = prop->prop_id;
+                break;
+            }
+        }
+        if (strcmp(prop->name, "IN_FENCE_FD") == 0) {
+            in_fence_prop_id = prop->prop_id;
+        }
+        if (strcmp(prop->name, "rotation") == 0 && drm_property_type_is(prop, DRM_MODE_PROP_BITMASK)) {
+            // bitmask enums carry the bit number
+            supported_rotations = 0;
+            for (int e = 0; e < prop->count_enums; e++) {
+                supported_rotations |= 1u << prop->enums[e].value;
+            }
         }
+        drmModeFreeProperty(prop);
     }
+    drmModeFreeObjectProperties(props);
 
+    if (!prop_ids[CRTC_ID] || !prop_ids[FB_ID]) {
+        std::cerr << "Plane " << plane_id << " has no CRTC_ID/FB_ID property" << std::endl;
+        return false;
+    }
+    this->plane_id = plane_id;
     return true;
-}
\ No newline at end of file
+}
+
+void PlaneCommit::set_layer(uint32_t crtc_id, uint32_t fb_id, int width, int height, uint64_t zpos) {
+    LayerGeometry full;
+    full.src = {0, 0, width, height};
+    full.dst = full.src;
+    set_layer(crtc_id, fb_id, full, zpos);
+}
+
+void PlaneCommit::set_layer(uint32_t crtc_id, uint32_t fb_id, const LayerGeometry& geometry, uint64_t zpos) {
+    values[CRTC_ID] = crtc_id;
+    values[FB_ID] = fb_id;
+    // CRTC_X/Y are signed, a PiP window may hang off the left or top edge
+    values[CRTC_X] = (uint64_t)(int64_t)geometry.dst.x;
+    values[CRTC_Y] = (uint64_t)(int64_t)geometry.dst.y;
+    values[CRTC_W] = geometry.dst.w;
+    values[CRTC_H] = geometry.dst.h;
+    // SRC_* are 16.16 fixed point
+    values[SRC_X] = (uint64_t)geometry.src.x << 16;
+    values[SRC_Y] = (uint64_t)geometry.src.y << 16;
+    values[SRC_W] = (uint64_t)geometry.src.w << 16;
+    values[SRC_H] = (uint64_t)geometry.src.h << 16;
+    values[CRTC_VISIBLE] = 1;
+    values[ALPHA] = 65535;
+    values[ZPOS] = zpos;
+    values[ROTATION] = geometry.rotation;
+}
+
+int PlaneCommit::add_changed(drmModeAtomicReqPtr req) const {
+    int count = 0;
+    for (int p = 0; p < PROP_COUNT; p++) {
+        if (!prop_ids[p] || (has_committed && values[p] == committed[p])) {
+            continue;
+        }
+        if (drmModeAtomicAddProperty(req, plane_id, prop_ids[p], values[p]) < 0) {
+            return -1;
+        }
+        count++;
+    }
+    // only with a new framebuffer, the one on screen was waited for already
+    bool new_fb = !has_committed || values[FB_ID] != committed[FB_ID];
+    if (in_fence_fd >= 0 && in_fence_prop_id && new_fb) {
+        if (drmModeAtomicAddProperty(req, plane_id, in_fence_prop_id, in_fence_fd) < 0) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+void PlaneCommit::mark_committed() {
+    memcpy(committed, values, sizeof(committed));
+    has_committed = true;
+}
@@ -5,23 +5,83 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <atomic>
 #include <gbm.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-enum class PlaneType {
-    PLANE_TYPE_PRIMARY,
-    PLANE_TYPE_OVERLAY,
-    PLANE_TYPE_CURSOR,
+#include "display_backend.hpp"
+#include "plane_allocator.hpp"
+
+/**
+ * Plane property IDs resolved once, and the state last committed to the plane.
+ * add_changed() only puts what differs from that state into a request, so a steady-state flip is one FB_ID.
+ */
+struct PlaneCommit {
+    enum Prop {
+        CRTC_ID,
+        FB_ID,
+        CRTC_X,
+        CRTC_Y,
+        CRTC_W,
+        CRTC_H,
+        SRC_X,
+        SRC_Y,
+        SRC_W,
+        SRC_H,
+        CRTC_VISIBLE,
+        ALPHA,
+        ZPOS,
+        ROTATION,
+        PROP_COUNT
+    };
+    static const char* prop_name(Prop prop);
+
+    // looks up every Prop on the plane, missing ones (0) are never committed
+    bool resolve(int drm_fd, uint32_t plane_id);
+
+    // full-screen layer, SRC and CRTC rects both width x height
+    void set_layer(uint32_t crtc_id, uint32_t fb_id, int width, int height, uint64_t zpos);
+    // geometry must be resolved
+    void set_layer(uint32_t crtc_id, uint32_t fb_id, const LayerGeometry& geometry, uint64_t zpos);
+    void set(Prop prop, uint64_t value) { values[prop] = value; }
+    // sent with the next add_changed() only, a fence is not plane state
+    void set_in_fence(int fd) { in_fence_fd = fd; }
+
+    // @return number of properties added, -1 on allocation failure
+    int add_changed(drmModeAtomicReqPtr req) const;
+    // call after the commit carrying add_changed() succeeded
+    void mark_committed();
+    // after any commit attempt, the caller closes the fd
+    void clear_in_fence() { in_fence_fd = -1; }
+    // plane state changed behind our back (legacy SetCrtc, new format): next commit is full
+    void invalidate() { has_committed = false; }
+
+    uint32_t plane_id = 0;
+    uint32_t prop_ids[PROP_COUNT] = {};
+    uint64_t values[PROP_COUNT] = {};
+    uint64_t committed[PROP_COUNT] = {};
+    bool has_committed = false;
+    // IN_FENCE_FD, 0 if the plane has none
+    uint32_t in_fence_prop_id = 0;
+    int in_fence_fd = -1;
+    // DRM_MODE_ROTATE_* | DRM_MODE_REFLECT_* the plane accepts, only ROTATE_0 without a rotation property
+    uint32_t supported_rotations = DRM_MODE_ROTATE_0;
 };
 
-class DRMDevice {
+class DRMDevice : public DisplayBackend {
 public:
-    DRMDevice(std::string device, int width, int height, int pixfmt) : device(device), width(width), height(height), pixfmt(pixfmt) {
+    /**
+     * connector: name like "HDMI-A-1" or a connector id, empty for the first connected one not driven yet.
+     * every output on a card shares one fd (only one can be DRM master), CRTC and planes are claimed per output.
+     */
+    DRMDevice(std::string device, int width, int height, int pixfmt, std::string connector_name = "")
+        : width(width), height(height), pixfmt(pixfmt), device(device), connector_name(connector_name) {
         open();
     }
 
-    ~DRMDevice() {
+    ~DRMDevice() override {
         close();
     }
 
@@ -32,27 +92,58 @@ public:
         }
         return true;
     }
-    bool close();
-    
+    bool close() override;
+
     // Return the index of the framebuffer
-    int import_dmabuf(int index, int dmabuf_fd);
+    int import_dmabuf(int index, int dmabuf_fd) override;
+    // drop all imported capture framebuffers, import_dmabuf starts again at index 0
+    void release_dmabufs() override;
+
+    /**
+     * input resolution or format changed: drops every framebuffer and picks planes again.
+     * capture buffers must be imported again, canvas bos get new framebuffers on next import.
+     */
+    bool set_format(int width, int height, int pixfmt) override;
+    void release_canvas_bufs() override;
+
+    // takes effect with the next canvas import, or the next commit once the canvas is imported
+    void set_refresh_hint(double hz) override;
+    double output_refresh_hz() const override { return mode ? mode_refresh_hz(*mode) : 0; }
+    bool vrr_active() const override { return vrr_committed == 1; }
+    static double mode_refresh_hz(const drmModeModeInfo& mode);
 
-    uint32_t import_canvas_buf_bo(gbm_bo* bo);
+    uint32_t import_canvas_buf_bo(gbm_bo* bo) override;
     uint32_t create_canvas_buf_dumb();
 
-    enum class PlaneType {
-        PLANE_TYPE_OVERLAY,
-        PLANE_TYPE_CURSOR,
-        PLANE_TYPE_PRIMARY
-    };
+    /**
+     * stage plane updates, nothing reaches the screen until commit()
+     */
+    bool set_video_geometry(const LayerGeometry& geometry) override;
+    bool video_on_plane() const override;
+    void set_passthrough(int index) override;
+    void set_canvas(uint32_t canvas_fb_id, int in_fence_fd) override;
+    /**
+     * one atomic commit carrying the staged changes of every plane.
+     * with DRM_MODE_PAGE_FLIP_EVENT, user_data comes back in the flip event.
+     * @return 1 committed, 0 nothing changed, -errno otherwise (-EBUSY: a nonblocking commit is still pending)
+     */
+    int commit(uint32_t flags, void* user_data = nullptr) override;
+    int take_out_fence() override;
 
-    bool display(int index, uint32_t canvas_fb_id);
+    int event_fd() const override { return drm_fd; }
+    // drmHandleEvent
+    void handle_events(flip_handler_t on_flip) override;
+    int gbm_fd() const override { return drm_fd; }
 
     int width = 0;
     int height = 0;
     int pixfmt = 0;
 
     std::string device;
+    std::string connector_name;
+
+    // turn VRR_ENABLED on with the next commit if the connector is vrr_capable
+    bool use_vrr = false;
 
     unsigned char* dumb_buf_ptr = nullptr;
     uint64_t dumb_buf_size = 0;
@@ -60,29 +151,109 @@ public:
     int drm_fd = -1;
 private:
     bool open_not_closing_on_failure();
+    // every plane the CRTC can use, then allocate_planes()
+    bool find_planes();
+    /**
+     * layers onto planes, TEST_ONLY with whatever framebuffers are imported, format-only for layers without.
+     * runs again once the first capture buffer or canvas of a format is imported
+     */
+    bool allocate_planes();
+    bool test_assignment(const std::vector<PlaneCaps>& planes, const std::vector<PlaneAssignment>& assignment);
+    // layer geometry from video_geometry, the full frame once it was rejected
+    void update_video_request();
+    // canvas layer geometry: the canvas bo, scaled to the screen if it is smaller
+    void update_canvas_request();
+    /**
+     * drmModeSetCrtc wants a framebuffer covering the mode, a reduced canvas is not one.
+     * the mode goes out with the next atomic commit instead
+     */
+    bool stage_modeset();
+    // connector CRTC_ID, MODE_ID and ACTIVE, the number of properties added or -errno
+    int add_modeset(drmModeAtomicReqPtr req) const;
+    // an imported framebuffer the layer could show, 0 if none
+    uint32_t probe_fb(int layer) const;
+    bool find_connector();
+    // the mode of width x height with the refresh closest to refresh_hint, the preferred one on a tie
+    void select_mode();
+    // CRTC and planes other outputs on this card must not use
+    bool claim(uint32_t object_id);
+    void unclaim(uint32_t object_id);
+    static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void* user_data);
 
     uint32_t conn_id = 0;
     uint32_t crtc_id = 0;
+    // position in resources->crtcs, for plane possible_crtcs
+    int crtc_index = -1;
 
-    int plane_id_support_input_pixfmt = -1;
-    PlaneType plane_type_support_input_pixfmt = PlaneType::PLANE_TYPE_PRIMARY;
+    // planes the CRTC can use, and their properties resolved once
+    std::vector<PlaneCaps> plane_caps;
+    std::map<uint32_t, PlaneCommit> plane_props;
+    // the plane the legacy drmModeSetCrtc shows the canvas on, or fbcon left on the CRTC
+    uint32_t primary_plane_id = 0;
+    // claimed by this output, layers use some of them
+    std::set<uint32_t> owned_planes;
+    // no layer on them any more, turned off and unclaimed with the next commit
+    std::set<uint32_t> released_planes;
+    PlaneAllocator allocator;
+
+    struct Layer {
+        LayerRequest request;
+        PlaneAssignment assignment;
+        // plane_id 0 without a plane
+        PlaneCommit plane;
+    };
+    enum { VIDEO_LAYER, CANVAS_LAYER };
+    // VIDEO_LAYER and CANVAS_LAYER, by z order
+    std::vector<Layer> layers;
+    // no plane takes video_geometry, video_on_plane() is false and the renderer composes the video
+    bool video_rejected = false;
 
-    int plane_id_canvas = -1;
-    int pixfmt_cursor = 0;
     uint32_t dumb_buf_handle = 0;
 
     drmModeRes* resources = nullptr;
     drmModeConnector* connector = nullptr;
+    // into connector->modes
+    const drmModeModeInfo* mode = nullptr;
+    double refresh_hint = 0;
 
-    std::vector<uint32_t> passthrough_fd_ids;
+    // first canvas bo of a format, 0 before it: the screen size
+    int canvas_width = 0;
+    int canvas_height = 0;
+    // connector CRTC_ID, CRTC MODE_ID and ACTIVE, for stage_modeset
+    uint32_t conn_crtc_prop_id = 0;
+    uint32_t mode_id_prop_id = 0;
+    uint32_t active_prop_id = 0;
+    uint32_t mode_blob_id = 0;
+    // last set on the CRTC, by drmModeSetCrtc or by mode_blob_id going out while modeset_pending
+    const drmModeModeInfo* modeset_mode = nullptr;
+    bool modeset_pending = false;
+
+    bool vrr_capable = false;
+    // CRTC VRR_ENABLED, 0 if the driver has none
+    uint32_t vrr_prop_id = 0;
+    // -1 until the first commit set it either way
+    int vrr_committed = -1;
+
+    // CRTC OUT_FENCE_PTR, 0 if the driver has none
+    uint32_t out_fence_prop_id = 0;
+    // set_canvas staged a new canvas, the next commit asks for an out fence
+    bool canvas_staged = false;
+    // the kernel writes the fd here, s32
+    int32_t out_fence = -1;
+
+    // by capture buffer index, 0 where nothing is imported
+    std::vector<uint32_t> passthrough_fb_ids;
+    // as requested, resolved against the current size into the video layer's request
+    LayerGeometry video_geometry;
     std::map<gbm_bo*, uint32_t> canvas_fb_ids;
-    std::map<uint32_t, std::map<std::string, uint32_t>> panel_prop_ids;
+    // allocated once, rewound with drmModeAtomicSetCursor for every commit
+    drmModeAtomicReqPtr atomic_req = nullptr;
+    // the kernel gets this device as user_data, one flip is pending at most.
+    // written by this output's presenter before the commit ioctl, read by whichever presenter on the card reads the event
+    std::atomic<void*> flip_user_data{nullptr};
 
     // int crtc_width = 0;
     // int crtc_height = 0;
 
     uint64_t support_dumb_buffer = 0;
-
-    int cur_passthrough_fd_index = -1;
-    uint32_t cur_canvas_fb_id = 0;
 };
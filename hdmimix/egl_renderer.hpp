@@ -1,35 +1,53 @@
 #pragma once
 
 #include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <gbm.h>
+#include <vector>
 
+#include "gl_loader.hpp"
+#include "video_compositor.hpp"
+
+/**
+ * Renders the canvas into a fixed ring of scanout bos instead of a gbm_surface.
+ *
+ * The bos are allocated in initialize() and resize(), so outputs import all of them as framebuffers
+ * before the first frame and no flip ever has to add one (or modeset) mid-stream. Each bo is an
+ * EGLImage behind its own FBO, the context itself is surfaceless.
+ *
+ * Headless (drm_fd < 0) the display comes from EGL_MESA_platform_surfaceless and the ring is plain
+ * renderbuffers, nothing can scan out but every GL call is the same. For measuring UI cost off the device.
+ */
 class EGLBufRenderer {
 public:
-    EGLBufRenderer(int drm_fd, int width, int height) 
-        : drm_fd(drm_fd), width(width), height(height), initialized(false){}
+    EGLBufRenderer(int drm_fd, int width, int height, int ring_size = 3)
+        : drm_fd(drm_fd), width(width), height(height), ring_size(ring_size), initialized(false){}
     
     ~EGLBufRenderer() {
         close();
     }
 
     void close() {
+        // GL objects went with the context, the images and bos are freed here
+        for (Slot& slot : ring) {
+            slot.rbo = 0;
+            slot.fbo = 0;
+        }
+        free_ring();
+        video.close();
         if (egl_display != EGL_NO_DISPLAY && egl_context != EGL_NO_CONTEXT) {
             eglDestroyContext(egl_display, egl_context);
             egl_context = EGL_NO_CONTEXT;
         }
-        if (egl_display != EGL_NO_DISPLAY && egl_surface != EGL_NO_SURFACE) {
-            eglDestroySurface(egl_display, egl_surface);
-            egl_surface = EGL_NO_SURFACE;
-        }
         if (egl_display != EGL_NO_DISPLAY) {
             eglTerminate(egl_display);
             egl_display = EGL_NO_DISPLAY;
         }
-        if (gbm_surface != nullptr) {
-            gbm_surface_destroy(gbm_surface);
-            gbm_surface = nullptr;
-        }
         if (gbm_device != nullptr) {
             gbm_device_destroy(gbm_device);
             gbm_device = nullptr;
@@ -38,19 +56,22 @@ public:
     }
     
     bool initialize() {
-        gbm_device = gbm_create_device(drm_fd);
-        if (!gbm_device) {
-            std::cerr << "Failed to create GBM device" << std::endl;
-            return false;
-        }
-        
-        gbm_surface = gbm_surface_create(gbm_device, width, height, GBM_BO_FORMAT_ARGB8888, GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-        if (!gbm_surface) {
-            std::cerr << "Failed to create GBM surface" << std::endl;
-            return false;
+        if (headless()) {
+            const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+            auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if (!client_extensions || !strstr(client_extensions, "EGL_MESA_platform_surfaceless") || !get_platform_display) {
+                std::cerr << "EGL has no EGL_MESA_platform_surfaceless for headless rendering" << std::endl;
+                return false;
+            }
+            egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        } else {
+            gbm_device = gbm_create_device(drm_fd);
+            if (!gbm_device) {
+                std::cerr << "Failed to create GBM device" << std::endl;
+                return false;
+            }
+            egl_display = eglGetDisplay(gbm_device);
         }
-
-        egl_display = eglGetDisplay(gbm_device);
         if (egl_display == EGL_NO_DISPLAY) {
             std::cerr << "Failed to get EGL display" << std::endl;
             return false;
@@ -72,7 +93,7 @@ public:
         */
 
         EGLint attribs[] = {
-            EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+            EGL_SURFACE_TYPE, headless() ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
             EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
             EGL_RED_SIZE, 8,
             EGL_GREEN_SIZE, 8,
@@ -83,19 +104,16 @@ public:
             EGL_NATIVE_VISUAL_ID, GBM_FORMAT_ARGB8888,
             EGL_NONE
         };
-        EGLConfig config = nullptr;
+        if (headless()) {
+            // no native visuals on the surfaceless platform, end the list before them
+            attribs[14] = EGL_NONE;
+        }
         if (!eglChooseConfig(egl_display, attribs, &config, 1, &num_configs) || num_configs < 1) {
             std::cerr << "Failed to choose EGL config" << std::endl;
             return false;
         }
         printf("find %d configs\n", num_configs);
 
-        egl_surface = eglCreateWindowSurface(egl_display, config, (EGLNativeWindowType)gbm_surface, nullptr);
-        if (egl_surface == EGL_NO_SURFACE) {
-            std::cerr << "Failed to create EGL surface, err:" << std::hex << eglGetError() << std::endl;
-            return false;
-        }
-
         // GBM as a service does not support 3.2 due to lack of extension KHR_create_context
         EGLint context_attribs[] = {
             EGL_CONTEXT_MAJOR_VERSION, 3,
@@ -107,48 +125,334 @@ public:
             std::cerr << "Failed to create EGL context, err:" << std::hex << eglGetError() << std::endl;
             return false;
         }
+        if (!load_image_procs()) {
+            return false;
+        }
+        load_fence_procs();
+        if (!alloc_ring()) {
+            return false;
+        }
         initialized = true;
         return true;
     }
 
+    // no DRM device, the ring cannot be scanned out
+    bool headless() const { return drm_fd < 0; }
+
+    // EGL_ANDROID_native_fence_sync and EGL_KHR_wait_sync: scanout waits for the GPU in the kernel, not here
+    bool has_fences() const { return create_sync != nullptr; }
+
+    /**
+     * sync_file signaled when the GPU finished everything issued so far, e.g. the frame just drawn.
+     * @return fd owned by the caller, -1 without fence support
+     */
+    int create_out_fence() {
+        if (!has_fences()) {
+            return -1;
+        }
+        EGLSyncKHR sync = create_sync(egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID, nullptr);
+        if (sync == EGL_NO_SYNC_KHR) {
+            return -1;
+        }
+        // the fence fd exists once the sync is flushed to the GPU
+        glFlush();
+        int fd = dup_native_fence_fd(egl_display, sync);
+        destroy_sync(egl_display, sync);
+        return fd == EGL_NO_NATIVE_FENCE_FD_ANDROID ? -1 : fd;
+    }
+
+    /**
+     * the GPU waits for fence_fd before running anything issued after this, the CPU goes on.
+     * takes fence_fd. without fence support it is waited for here.
+     * must be called from the thread that called bind_context_to_thread
+     */
+    void wait_fence(int fence_fd) {
+        if (fence_fd < 0) {
+            return;
+        }
+        if (has_fences()) {
+            EGLint attribs[] = {EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fence_fd, EGL_NONE};
+            EGLSyncKHR sync = create_sync(egl_display, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+            if (sync != EGL_NO_SYNC_KHR) {
+                // the sync owns fence_fd now
+                wait_sync(egl_display, sync, 0);
+                destroy_sync(egl_display, sync);
+                return;
+            }
+        }
+        pollfd pfd = {fence_fd, POLLIN, 0};
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        }
+        ::close(fence_fd);
+    }
+
+    // also builds the FBOs, they belong to the context
     bool bind_context_to_thread() {
-        if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
+        if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)) {
             std::cerr << "Failed to make EGL context current" << std::endl;
             return false;
         }
-        return true;
+        return bind_ring();
     }
 
     /**
-     * must be called from the same thread that called bind_context_to_thread
+     * draws go into the least recently used free bo from here on.
+     * must be called from the thread that called bind_context_to_thread
+     * @return false if every bo is locked
      */
-    bool swap_buffer() {
-		if (!eglSwapBuffers(egl_display, egl_surface)) {
-			std::cerr << "Failed to swap buffers, err: " << std::hex << eglGetError() << std::endl;
-			return false;
-		}
-		return true;
+    bool begin_frame() {
+        for (int i = 0; i < (int)ring.size(); i++) {
+            int index = (next_slot + i) % ring.size();
+            if (!ring[index].locked) {
+                current = index;
+                gl.BindFramebuffer(GL_FRAMEBUFFER, ring[index].fbo);
+                glViewport(0, 0, width, height);
+                return true;
+            }
+        }
+        current = -1;
+        return false;
     }
 
+    /**
+     * the bo begin_frame drew into, locked until read_unlock. a fence from create_out_fence tells when it is done.
+     * headless there is no bo, nullptr
+     */
     struct gbm_bo* read_lock() {
-        return gbm_surface_lock_front_buffer(gbm_surface);
+        if (current < 0) {
+            return nullptr;
+        }
+        // implicit sync only sees work that reached the kernel
+        glFlush();
+        Slot& slot = ring[current];
+        next_slot = (current + 1) % ring.size();
+        current = -1;
+        slot.locked = true;
+        return slot.bo;
     }
 
     void read_unlock(gbm_bo* bo) {
-        gbm_surface_release_buffer(gbm_surface, bo);
+        for (Slot& slot : ring) {
+            if (slot.bo == bo) {
+                slot.locked = false;
+            }
+        }
+    }
+
+    /**
+     * GPU composition: capture buffer index drawn into the frame begin_frame started, below whatever comes after.
+     * set up on first use, buffers are imported once per index.
+     * must be called from the thread that called bind_context_to_thread
+     * @return false if nothing was drawn
+     */
+    bool compose_video(int index, int dma_fd, int width, int height, int pixfmt, const LayerGeometry& geometry) {
+        if (!video.ready() && (video_failed || !video.init(egl_display))) {
+            video_failed = true;
+            return false;
+        }
+        return video.draw(index, dma_fd, width, height, pixfmt, geometry);
+    }
+
+    // the capture buffers are about to be freed, from the thread that called bind_context_to_thread
+    void release_video() {
+        video.release_images();
+    }
+
+    // bos begin_frame can still draw into
+    bool has_free_buffers() const {
+        for (const Slot& slot : ring) {
+            if (!slot.locked) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // every bo of the ring, for importing them all up front. none when headless
+    std::vector<gbm_bo*> buffers() const {
+        std::vector<gbm_bo*> out;
+        for (const Slot& slot : ring) {
+            if (slot.bo) {
+                out.push_back(slot.bo);
+            }
+        }
+        return out;
+    }
+
+    /**
+     * a new ring at the new size, the context survives.
+     * must be called from the thread that called bind_context_to_thread, with no bo locked
+     */
+    bool resize(int width, int height) {
+        gl.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        for (Slot& slot : ring) {
+            gl.DeleteFramebuffers(1, &slot.fbo);
+            gl.DeleteRenderbuffers(1, &slot.rbo);
+            slot.fbo = 0;
+            slot.rbo = 0;
+        }
+        free_ring();
+        this->width = width;
+        this->height = height;
+        return alloc_ring() && bind_ring();
     }
 
     bool initialized;
-    
-    struct gbm_surface* gbm_surface = nullptr;
 
 private:
+    struct Slot {
+        struct gbm_bo* bo = nullptr;
+        EGLImageKHR image = EGL_NO_IMAGE_KHR;
+        GLuint rbo = 0;
+        GLuint fbo = 0;
+        // handed out by read_lock, not drawn into until read_unlock
+        bool locked = false;
+    };
+
+    int drm_fd;
     int width;
     int height;
-    int drm_fd;
+    int ring_size;
 
     struct gbm_device* gbm_device = nullptr;
     EGLDisplay egl_display = EGL_NO_DISPLAY;
-    EGLSurface egl_surface = EGL_NO_SURFACE;
     EGLContext egl_context = EGL_NO_CONTEXT;
+    EGLConfig config = nullptr;
+
+    std::vector<Slot> ring;
+    // begin_frame starts looking here, so bos are reused in the order they were drawn
+    int next_slot = 0;
+    // begin_frame's bo, -1 outside a frame
+    int current = -1;
+
+    VideoCompositor video;
+    // init failed once, compose_video does not retry every frame
+    bool video_failed = false;
+
+    PFNEGLCREATESYNCKHRPROC create_sync = nullptr;
+    PFNEGLDESTROYSYNCKHRPROC destroy_sync = nullptr;
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd = nullptr;
+    PFNEGLWAITSYNCKHRPROC wait_sync = nullptr;
+
+    PFNEGLCREATEIMAGEKHRPROC create_image = nullptr;
+    PFNEGLDESTROYIMAGEKHRPROC destroy_image = nullptr;
+
+    bool load_image_procs() {
+        const char* extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")
+            || (!headless() && !strstr(extensions, "EGL_EXT_image_dma_buf_import"))) {
+            std::cerr << "EGL needs EGL_EXT_image_dma_buf_import and EGL_KHR_surfaceless_context for the canvas ring" << std::endl;
+            return false;
+        }
+        if (!gl_load()) {
+            std::cerr << "Failed to load GL functions" << std::endl;
+            return false;
+        }
+        if (headless()) {
+            // renderbuffers have their own storage, no images
+            return true;
+        }
+        create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+        if (!create_image || !destroy_image) {
+            std::cerr << "Failed to load EGLImage functions" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // bos and their images, no context needed
+    bool alloc_ring() {
+        ring.assign(ring_size, Slot());
+        next_slot = 0;
+        current = -1;
+        if (headless()) {
+            printf("Canvas ring: %d x %dx%d renderbuffers, headless\n", ring_size, width, height);
+            return true;
+        }
+        for (Slot& slot : ring) {
+            slot.bo = gbm_bo_create(gbm_device, width, height, GBM_FORMAT_ARGB8888, GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+            if (!slot.bo) {
+                std::cerr << "Failed to create " << width << "x" << height << " canvas bo" << std::endl;
+                return false;
+            }
+            int fd = gbm_bo_get_fd(slot.bo);
+            if (fd < 0) {
+                std::cerr << "Failed to export canvas bo" << std::endl;
+                return false;
+            }
+            EGLint attribs[] = {
+                EGL_WIDTH, width,
+                EGL_HEIGHT, height,
+                EGL_LINUX_DRM_FOURCC_EXT, GBM_FORMAT_ARGB8888,
+                EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+                EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)gbm_bo_get_offset(slot.bo, 0),
+                EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)gbm_bo_get_stride(slot.bo),
+                EGL_NONE
+            };
+            slot.image = create_image(egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+            // the image holds its own reference to the buffer
+            ::close(fd);
+            if (slot.image == EGL_NO_IMAGE_KHR) {
+                std::cerr << "Failed to create canvas EGLImage, err:" << std::hex << eglGetError() << std::endl;
+                return false;
+            }
+        }
+        printf("Canvas ring: %d x %dx%d bos\n", ring_size, width, height);
+        return true;
+    }
+
+    // an FBO per image, with the context current
+    bool bind_ring() {
+        for (Slot& slot : ring) {
+            if (slot.fbo) {
+                continue;
+            }
+            gl.GenRenderbuffers(1, &slot.rbo);
+            gl.BindRenderbuffer(GL_RENDERBUFFER, slot.rbo);
+            if (headless()) {
+                gl.RenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+            } else {
+                gl.EGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER, slot.image);
+            }
+            gl.GenFramebuffers(1, &slot.fbo);
+            gl.BindFramebuffer(GL_FRAMEBUFFER, slot.fbo);
+            gl.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, slot.rbo);
+            GLenum status = gl.CheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (status != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "Canvas framebuffer incomplete, status:" << std::hex << status << std::endl;
+                return false;
+            }
+        }
+        gl.BindRenderbuffer(GL_RENDERBUFFER, 0);
+        return true;
+    }
+
+    void free_ring() {
+        for (Slot& slot : ring) {
+            if (slot.image != EGL_NO_IMAGE_KHR) {
+                destroy_image(egl_display, slot.image);
+            }
+            if (slot.bo) {
+                gbm_bo_destroy(slot.bo);
+            }
+        }
+        ring.clear();
+        current = -1;
+    }
+
+    void load_fence_procs() {
+        const char* extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "EGL_ANDROID_native_fence_sync") || !strstr(extensions, "EGL_KHR_wait_sync")) {
+            printf("EGL has no native fence sync, scanout relies on implicit sync\n");
+            return;
+        }
+        destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+        dup_native_fence_fd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)eglGetProcAddress("eglDupNativeFenceFDANDROID");
+        wait_sync = (PFNEGLWAITSYNCKHRPROC)eglGetProcAddress("eglWaitSyncKHR");
+        if (destroy_sync && dup_native_fence_fd && wait_sync) {
+            // set last, has_fences() checks it
+            create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        }
+    }
 };
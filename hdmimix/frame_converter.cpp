@@ -0,0 +1,163 @@
+#include "frame_converter.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "image_utils.h"
+#include "frame_timing.hpp"
+
+
+// one output chroma row from two input rows, uv_bytes counted in the output
+static void downsample_uv_row(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int uv_bytes) {
+    int o = 0;
+#if defined(__ARM_NEON)
+    // 32 input bytes per row are 8 horizontal pixel pairs: U0 V0 U1 V1, deinterleaved by vld4
+    for (; o + 16 <= uv_bytes; o += 16) {
+        uint8x8x4_t a = vld4_u8(row0 + o * 2);
+        uint8x8x4_t b = vld4_u8(row1 + o * 2);
+        uint16x8_t u = vaddq_u16(vaddl_u8(a.val[0], a.val[2]), vaddl_u8(b.val[0], b.val[2]));
+        uint16x8_t v = vaddq_u16(vaddl_u8(a.val[1], a.val[3]), vaddl_u8(b.val[1], b.val[3]));
+        uint8x8x2_t uv;
+        uv.val[0] = vrshrn_n_u16(u, 2);
+        uv.val[1] = vrshrn_n_u16(v, 2);
+        vst2_u8(out + o, uv);
+    }
+#endif
+    for (; o < uv_bytes; o += 2) {
+        const uint8_t* a = row0 + o * 2;
+        const uint8_t* b = row1 + o * 2;
+        out[o] = (a[0] + a[2] + b[0] + b[2] + 2) >> 2;
+        out[o + 1] = (a[1] + a[3] + b[1] + b[3] + 2) >> 2;
+    }
+}
+
+void nv24_to_nv12(const uint8_t* src, uint8_t* dst, int width, int height) {
+    size_t luma = (size_t)width * height;
+    memcpy(dst, src, luma);
+
+    const uint8_t* src_uv = src + luma;
+    uint8_t* dst_uv = dst + luma;
+    // NV24 chroma rows are 2 * width bytes, NV12 rows are width bytes for every second line
+    for (int y = 0; y < height / 2; y++) {
+        const uint8_t* row0 = src_uv + (size_t)(y * 2) * width * 2;
+        downsample_uv_row(row0, row0 + width * 2, dst_uv + (size_t)y * width, width);
+    }
+}
+
+bool FrameConverter::configure(int width, int height) {
+    if (width == this->width && height == this->height && !outputs.empty()) {
+        return true;
+    }
+    release();
+    size_t size = (size_t)width * height * 3 / 2;
+    for (int i = 0; i < pool_size; i++) {
+        Output out;
+        out.dma_fd = DmaHeapAllocator::shared().alloc(size);
+        if (out.dma_fd < 0) {
+            printf("Failed to allocate NV12 conversion buffer %d\n", i);
+            release();
+            return false;
+        }
+        void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, out.dma_fd, 0);
+        if (ptr == MAP_FAILED) {
+            printf("Failed to mmap NV12 conversion buffer %d: %s\n", i, strerror(errno));
+            ::close(out.dma_fd);
+            release();
+            return false;
+        }
+        out.ptr = static_cast<uint8_t*>(ptr);
+        out.size = size;
+        outputs.push_back(out);
+    }
+    this->width = width;
+    this->height = height;
+    next = 0;
+    printf("NV24 -> NV12 conversion: %dx%d, %d %s buffers\n", width, height, pool_size,
+           DmaHeapAllocator::backend_name(DmaHeapAllocator::shared().backend()));
+    return true;
+}
+
+void FrameConverter::release() {
+    for (auto& out : outputs) {
+        if (out.ptr) {
+            ::munmap(out.ptr, out.size);
+        }
+        if (out.dma_fd >= 0) {
+            ::close(out.dma_fd);
+        }
+    }
+    outputs.clear();
+    width = 0;
+    height = 0;
+}
+
+int FrameConverter::convert_nv24(FrameSource::user_buf_info_t& src, int width, int height) {
+    if (!configure(width, height)) {
+        return -1;
+    }
+    uint64_t start = monotonic_ns();
+    int index = next;
+    next = (next + 1) % outputs.size();
+    Output& out = outputs[index];
+
+    bool done = false;
+    // RGA needs a real dma-buf on both ends, plain memfds only work for the CPU path
+    if (use_rga && src.dma_fd >= 0 && DmaHeapAllocator::shared().backend() != DmaHeapAllocator::Backend::MEMFD) {
+        image_buffer_t src_image{};
+        src_image.width = width;
+        src_image.height = height;
+        src_image.format = IMAGE_FORMAT_YUV444SP_NV24;
+        src_image.fd = src.dma_fd;
+        image_buffer_t dst_image{};
+        dst_image.width = width;
+        dst_image.height = height;
+        dst_image.format = IMAGE_FORMAT_YUV420SP_NV12;
+        dst_image.virt_addr = out.ptr;
+        dst_image.size = out.size;
+        dst_image.fd = out.dma_fd;
+        done = convert_image(&src_image, &dst_image, nullptr, nullptr, 0) == 0;
+        if (!done) {
+            printf("RGA rejected NV24, converting on the CPU from now on\n");
+            use_rga = false;
+        }
+    }
+    if (!done) {
+        auto view = src.map_read();
+        if (!view) {
+            return -1;
+        }
+        dmabuf_sync(out.dma_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+        nv24_to_nv12(view.data(), out.ptr, width, height);
+        dmabuf_sync(out.dma_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+    }
+
+    uint64_t took = monotonic_ns() - start;
+    frames++;
+    convert_ns_total += took;
+    convert_ns_max = std::max(convert_ns_max, took);
+    return index;
+}
+
+void FrameConverter::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (frames == 0 || now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    last_report_ns = now;
+    printf("[CONVERT] NV24 -> NV12 via %s, %llu frames, avg %.2fms max %.2fms\n",
+           use_rga ? "rga" : "cpu", (unsigned long long)frames,
+           convert_ns_total / 1e6 / frames, convert_ns_max / 1e6);
+    frames = 0;
+    convert_ns_total = 0;
+    convert_ns_max = 0;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "dma_heap.hpp"
+#include "frame_source.hpp"
+
+/**
+ * 4:4:4 to 4:2:0 chroma downsample: Y is copied, every 2x2 block of the UV plane is averaged.
+ * width and height must be even, both planes are tightly packed (stride == width).
+ */
+void nv24_to_nv12(const uint8_t* src, uint8_t* dst, int width, int height);
+
+/**
+ * Converts NV24 capture buffers into a small pool of dma-buf NV12 buffers for consumers that only take 4:2:0,
+ * like RGA preprocessing in front of the NPU. The display keeps scanning out the NV24 buffer itself.
+ *
+ * RGA converts fd to fd when it accepts NV24, otherwise nv24_to_nv12 runs on the CPU.
+ * Not thread-safe, use from one thread.
+ */
+class FrameConverter {
+public:
+    struct Output {
+        uint8_t* ptr = nullptr;
+        size_t size = 0;
+        int dma_fd = -1;
+    };
+
+    FrameConverter(int pool_size = 2) : pool_size(pool_size) {}
+    ~FrameConverter() { release(); }
+
+    /**
+     * (re)allocates the pool when the size changed
+     */
+    bool configure(int width, int height);
+    void release();
+
+    /**
+     * src is a whole NV24 frame, Y followed by interleaved UV. only the CPU path maps it
+     * @return index into outputs holding the NV12 frame, or -1
+     */
+    int convert_nv24(FrameSource::user_buf_info_t& src, int width, int height);
+
+    // prints conversion time and path, at most every interval_ms
+    void report(int interval_ms = 5000);
+
+    std::vector<Output> outputs;
+    int pool_size;
+    // cleared after the first RGA failure, the CPU path is used from then on
+    bool use_rga = true;
+
+private:
+    int width = 0;
+    int height = 0;
+    int next = 0;
+
+    uint64_t frames = 0;
+    uint64_t convert_ns_total = 0;
+    uint64_t convert_ns_max = 0;
+    uint64_t last_report_ns = 0;
+};
@@ -0,0 +1,274 @@
+#include "frame_lease.hpp"
+#include "frame_timing.hpp"
+
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+
+const char* frame_consumer_name(FrameConsumer consumer) {
+    switch (consumer) {
+    case FrameConsumer::CAPTURE:
+        return "capture";
+    case FrameConsumer::SCANOUT:
+        return "scanout";
+    case FrameConsumer::NPU:
+        return "npu";
+    case FrameConsumer::SNAPSHOT:
+        return "snapshot";
+    case FrameConsumer::RECORD:
+        return "record";
+    case FrameConsumer::COMPOSE:
+        return "compose";
+    default:
+        return "?";
+    }
+}
+
+FrameLease& FrameLease::operator=(FrameLease&& other) noexcept {
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        buf_index = other.buf_index;
+        holder = other.holder;
+        acquired_ns = other.acquired_ns;
+        generation = other.generation;
+        other.pool = nullptr;
+        other.buf_index = -1;
+    }
+    return *this;
+}
+
+void FrameLease::reset() {
+    if (pool) {
+        pool->release(*this);
+        pool = nullptr;
+        buf_index = -1;
+    }
+}
+
+FrameLease FrameLease::share(FrameConsumer consumer) const {
+    if (!pool) {
+        return FrameLease();
+    }
+    return pool->acquire(buf_index, consumer);
+}
+
+void FrameLeasePool::reset(int buf_count, release_fn_t on_release) {
+    std::lock_guard<std::mutex> lock(mutex);
+    states.assign(buf_count, BufferState{});
+    active = buf_count;
+    draining = false;
+    generation++;
+    this->on_release = on_release;
+}
+
+bool FrameLeasePool::drain(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex);
+    draining = true;
+    return idle_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+        return std::all_of(states.begin(), states.end(), [](const BufferState& s) { return s.refs == 0; });
+    });
+}
+
+bool FrameLeasePool::is_draining() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return draining;
+}
+
+void FrameLeasePool::grow(int count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool all_active = active == (int)states.size();
+    states.resize(states.size() + count, BufferState{});
+    if (all_active) {
+        active = states.size();
+    } else {
+        // appended behind parked buffers, park them too
+        for (size_t i = states.size() - count; i < states.size(); i++) {
+            states[i].queued = false;
+            states[i].parked = true;
+        }
+    }
+}
+
+void FrameLeasePool::set_active(int count) {
+    std::vector<int> requeue;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = std::max(1, std::min(count, (int)states.size()));
+        for (int i = 0; i < active; i++) {
+            auto& state = states[i];
+            if (state.parked) {
+                state.parked = false;
+                state.queued = true;
+                requeue.push_back(i);
+            }
+        }
+        // parking of the rest happens when their leases drop, queued ones are parked by the producer on next use
+    }
+    if (on_release) {
+        for (int index : requeue) {
+            on_release(index);
+        }
+    }
+}
+
+int FrameLeasePool::active_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return active;
+}
+
+int FrameLeasePool::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return states.size();
+}
+
+void FrameLeasePool::mark_dequeued(int index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& state = states[index];
+    state.queued = false;
+    state.dequeued_ns = monotonic_ns();
+
+    bool any_queued = std::any_of(states.begin(), states.end(), [](const BufferState& s) { return s.queued; });
+    if (!any_queued) {
+        // the producer has nothing left to fill, blame whoever holds buffers right now
+        stat_totals.starvation_events++;
+        for (int c = 0; c < (int)FrameConsumer::COUNT; c++) {
+            bool holding = std::any_of(states.begin(), states.end(), [c](const BufferState& s) { return s.holders[c] > 0; });
+            if (holding) {
+                stats[c].starved++;
+            }
+        }
+    }
+}
+
+FrameLease FrameLeasePool::acquire(int index, FrameConsumer consumer) {
+    FrameLease lease;
+    if (index < 0) {
+        return lease;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (draining || index >= (int)states.size() || states[index].queued) {
+        // already back with the producer, its content is gone
+        return lease;
+    }
+    auto& state = states[index];
+    state.refs++;
+    state.holders[(int)consumer]++;
+    stats[(int)consumer].leases++;
+
+    lease.pool = this;
+    lease.buf_index = index;
+    lease.holder = consumer;
+    lease.acquired_ns = monotonic_ns();
+    lease.generation = generation;
+    return lease;
+}
+
+void FrameLeasePool::release(FrameLease& lease) {
+    bool requeue = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (lease.generation != generation) {
+            return;
+        }
+        auto& state = states[lease.buf_index];
+        uint64_t now = monotonic_ns();
+        uint64_t held = now - lease.acquired_ns;
+        auto& st = stats[(int)lease.holder];
+        st.hold_ns_total += held;
+        st.hold_ns_max = std::max(st.hold_ns_max, held);
+
+        state.holders[(int)lease.holder]--;
+        if (--state.refs == 0) {
+            uint64_t out = now - state.dequeued_ns;
+            stat_totals.out_count++;
+            stat_totals.out_ns_total += out;
+            stat_totals.out_ns_max = std::max(stat_totals.out_ns_max, out);
+            window_out_ns_max = std::max(window_out_ns_max, out);
+            if (draining) {
+                idle_cv.notify_all();
+            } else if (lease.buf_index >= active) {
+                state.parked = true;
+            } else {
+                state.queued = true;
+                requeue = true;
+            }
+        }
+    }
+    if (requeue && on_release) {
+        on_release(lease.buf_index);
+    }
+}
+
+bool FrameLeasePool::is_queued(int index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return states[index].queued;
+}
+
+int FrameLeasePool::queued_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::count_if(states.begin(), states.end(), [](const BufferState& s) { return s.queued; });
+}
+
+FrameLeasePool::Totals FrameLeasePool::totals() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stat_totals;
+}
+
+uint64_t FrameLeasePool::take_window_out_ns_max() {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t value = window_out_ns_max;
+    window_out_ns_max = 0;
+    return value;
+}
+
+FrameLeasePool::ConsumerStats FrameLeasePool::consumer_stats(FrameConsumer consumer) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats[(int)consumer];
+}
+
+void FrameLeasePool::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    last_report_ns = now;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto& t = stat_totals;
+    printf("[LEASE] starved %llu times, out of driver avg %.2fms max %.2fms\n",
+           (unsigned long long)t.starvation_events,
+           t.out_count ? t.out_ns_total / 1e6 / t.out_count : 0.0, t.out_ns_max / 1e6);
+    for (int c = 0; c < (int)FrameConsumer::COUNT; c++) {
+        const auto& st = stats[c];
+        if (st.leases == 0) {
+            continue;
+        }
+        printf("[LEASE]   %-8s leases=%llu hold avg %.2fms max %.2fms starved=%llu\n",
+               frame_consumer_name((FrameConsumer)c), (unsigned long long)st.leases,
+               st.hold_ns_total / 1e6 / st.leases, st.hold_ns_max / 1e6, (unsigned long long)st.starved);
+    }
+    std::string owners;
+    for (size_t i = 0; i < states.size(); i++) {
+        owners += " " + std::to_string(i) + ":";
+        if (states[i].queued) {
+            owners += "driver";
+            continue;
+        }
+        if (states[i].parked) {
+            owners += "parked";
+            continue;
+        }
+        bool first = true;
+        for (int c = 0; c < (int)FrameConsumer::COUNT; c++) {
+            if (states[i].holders[c] > 0) {
+                owners += first ? "" : "+";
+                owners += frame_consumer_name((FrameConsumer)c);
+                first = false;
+            }
+        }
+    }
+    printf("[LEASE]   buffers%s\n", owners.c_str());
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+enum class FrameConsumer {
+    CAPTURE,    // the source itself, while on_data runs
+    SCANOUT,    // on screen until the next frame is latched at vblank
+    NPU,        // waiting for or in inference preprocess
+    SNAPSHOT,   // written to disk
+    RECORD,     // queued for or copied by the recorder
+    COMPOSE,    // drawn into the canvas on the GPU, until that canvas is off screen
+    COUNT,
+};
+
+const char* frame_consumer_name(FrameConsumer consumer);
+
+class FrameLeasePool;
+
+/**
+ * One consumer's hold on a capture buffer. Move-only, the hold ends on destruction or reset().
+ * The buffer goes back to the producer when the last lease on it drops.
+ */
+class FrameLease {
+public:
+    FrameLease() = default;
+    ~FrameLease() { reset(); }
+
+    FrameLease(const FrameLease&) = delete;
+    FrameLease& operator=(const FrameLease&) = delete;
+    FrameLease(FrameLease&& other) noexcept { *this = std::move(other); }
+    FrameLease& operator=(FrameLease&& other) noexcept;
+
+    void reset();
+
+    // another lease on the same buffer, accounted to a different consumer
+    FrameLease share(FrameConsumer consumer) const;
+
+    bool valid() const { return pool != nullptr; }
+    explicit operator bool() const { return valid(); }
+    int index() const { return buf_index; }
+    FrameConsumer consumer() const { return holder; }
+
+private:
+    friend class FrameLeasePool;
+
+    FrameLeasePool* pool = nullptr;
+    int buf_index = -1;
+    FrameConsumer holder = FrameConsumer::CAPTURE;
+    uint64_t acquired_ns = 0;
+    // leases that outlive a pool reset must not touch the new buffers
+    uint32_t generation = 0;
+};
+
+/**
+ * Refcounts buffers between the producer (driver queue) and consumers,
+ * and keeps enough counters to tell which consumer keeps the driver short of buffers.
+ */
+class FrameLeasePool {
+public:
+    using release_fn_t = std::function<void(int index)>;
+
+    /**
+     * all buffers start owned by the producer.
+     * on_release runs on the thread that drops the last lease, outside the pool lock.
+     */
+    void reset(int buf_count, release_fn_t on_release);
+    // buffers appended by the producer, already queued
+    void grow(int count);
+
+    /**
+     * buffers at index >= count are parked: once their last lease drops they are not handed back.
+     * raising the count requeues parked buffers.
+     */
+    void set_active(int count);
+    int active_count() const;
+    int size() const;
+
+    // producer handed the buffer out, e.g. after DQBUF
+    void mark_dequeued(int index);
+    FrameLease acquire(int index, FrameConsumer consumer);
+
+    /**
+     * for reallocation: refuse new leases, stop handing buffers back, and wait until every lease dropped.
+     * long-lived holders should poll is_draining() and let go. reset() ends draining.
+     * @return false on timeout, some consumer still holds a buffer
+     */
+    bool drain(int timeout_ms);
+    bool is_draining() const;
+
+    // false while any lease is alive or the buffer has not been returned yet
+    bool is_queued(int index) const;
+    int queued_count() const;
+
+    struct ConsumerStats {
+        uint64_t leases = 0;
+        uint64_t hold_ns_total = 0;
+        uint64_t hold_ns_max = 0;
+        // times this consumer held a buffer while the producer had none left
+        uint64_t starved = 0;
+    };
+    ConsumerStats consumer_stats(FrameConsumer consumer) const;
+
+    struct Totals {
+        // dequeue to requeue, per buffer round trip
+        uint64_t out_count = 0;
+        uint64_t out_ns_total = 0;
+        uint64_t out_ns_max = 0;
+        uint64_t starvation_events = 0;
+    };
+    Totals totals() const;
+    // max dequeue to requeue time since the last call
+    uint64_t take_window_out_ns_max();
+
+    /**
+     * prints per-consumer hold times and current buffer owners, at most every interval_ms
+     */
+    void report(int interval_ms = 5000);
+
+private:
+    friend class FrameLease;
+    void release(FrameLease& lease);
+
+    struct BufferState {
+        int refs = 0;
+        int holders[(int)FrameConsumer::COUNT] = {};
+        bool queued = true;
+        bool parked = false;
+        uint64_t dequeued_ns = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable idle_cv;
+    std::vector<BufferState> states;
+    int active = 0;
+    bool draining = false;
+    uint32_t generation = 0;
+    ConsumerStats stats[(int)FrameConsumer::COUNT];
+    Totals stat_totals;
+    uint64_t window_out_ns_max = 0;
+    release_fn_t on_release;
+    uint64_t last_report_ns = 0;
+};
@@ -0,0 +1,88 @@
+#include "frame_source.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+
+#include "dma_heap.hpp"
+
+
+// mapping happens once per buffer, consumers on different threads may race for it
+static std::mutex map_mutex;
+
+unsigned char* FrameSource::user_buf_info_t::map() {
+    std::lock_guard<std::mutex> lock(map_mutex);
+    if (ptr || dma_fd < 0) {
+        return ptr;
+    }
+    void* userptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dma_fd, 0);
+    if (userptr == MAP_FAILED) {
+        printf("Failed to mmap dma-buf %d: %s\n", dma_fd, strerror(errno));
+        return nullptr;
+    }
+    ptr = static_cast<unsigned char*>(userptr);
+    return ptr;
+}
+
+void FrameSource::user_buf_info_t::unmap() {
+    std::lock_guard<std::mutex> lock(map_mutex);
+    if (ptr) {
+        ::munmap(ptr, size);
+        ptr = nullptr;
+    }
+}
+
+FrameSource::CpuView FrameSource::user_buf_info_t::map_read() {
+    CpuView view;
+    view.ptr = map();
+    if (view.ptr) {
+        view.len = size;
+        view.dma_fd = dma_fd;
+        dmabuf_sync(dma_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    }
+    return view;
+}
+
+FrameSource::CpuView FrameSource::user_buf_info_t::map_write() {
+    CpuView view;
+    view.ptr = map();
+    if (view.ptr) {
+        view.len = size;
+        view.dma_fd = dma_fd;
+        view.write = true;
+        dmabuf_sync(dma_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+    }
+    return view;
+}
+
+FrameSource::CpuView FrameSource::user_buffers_t::map_read(size_t plane) {
+    return plane < mem.size() ? mem[plane].map_read() : CpuView();
+}
+
+FrameSource::CpuView FrameSource::user_buffers_t::map_write(size_t plane) {
+    return plane < mem.size() ? mem[plane].map_write() : CpuView();
+}
+
+FrameSource::CpuView& FrameSource::CpuView::operator=(CpuView&& other) noexcept {
+    if (this != &other) {
+        reset();
+        ptr = other.ptr;
+        len = other.len;
+        dma_fd = other.dma_fd;
+        write = other.write;
+        other.ptr = nullptr;
+        other.dma_fd = -1;
+    }
+    return *this;
+}
+
+void FrameSource::CpuView::reset() {
+    if (ptr) {
+        dmabuf_sync(dma_fd, DMA_BUF_SYNC_END | (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+        ptr = nullptr;
+        dma_fd = -1;
+    }
+}
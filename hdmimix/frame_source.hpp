@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <linux/videodev2.h>
+
+#include "frame_lease.hpp"
+
+/**
+ * Anything that produces frames into a fixed set of DMABUF backed buffers.
+ * hdmirx (V4l2Device) is the real one, ReplaySource feeds files for machines without capture hardware.
+ *
+ * Buffers follow the rk hdmirx layout: one memory plane holding both logical planes (Y then UV),
+ * so consumers can import mem[0].dma_fd with offsets derived from width/height/pixfmt.
+ */
+class FrameSource {
+public:
+    virtual ~FrameSource() = default;
+
+    class CpuView;
+
+    struct user_buf_info_t {
+        user_buf_info_t() : ptr(nullptr), size(0), dma_fd(-1) {}
+
+        /**
+         * scoped CPU access: maps dma_fd on first use (the mapping stays until unmap) and
+         * brackets the access with DMA_BUF_IOCTL_SYNC. keep a lease on the buffer while the view lives.
+         */
+        CpuView map_read();
+        CpuView map_write();
+        void unmap();
+
+        // nullptr until the first map_read/map_write
+        unsigned char* ptr;
+        size_t size;
+        int dma_fd;
+
+    private:
+        unsigned char* map();
+    };
+    struct user_buffers_t {
+        user_buffers_t(int index, size_t num_planes)
+            : index(index), mem(num_planes) {}
+
+        int index;
+        std::vector<user_buf_info_t> mem;
+        // frame currently held in the buffer, meaningful while a lease is held
+        uint32_t sequence = 0;
+        // driver capture time, CLOCK_MONOTONIC
+        uint64_t timestamp_ns = 0;
+
+        size_t num_planes() const { return mem.size(); }
+
+        CpuView map_read(size_t plane = 0);
+        CpuView map_write(size_t plane = 0);
+    };
+
+    class CpuView {
+    public:
+        CpuView() = default;
+        ~CpuView() { reset(); }
+
+        CpuView(const CpuView&) = delete;
+        CpuView& operator=(const CpuView&) = delete;
+        CpuView(CpuView&& other) noexcept { *this = std::move(other); }
+        CpuView& operator=(CpuView&& other) noexcept;
+
+        // ends CPU access
+        void reset();
+
+        unsigned char* data() const { return ptr; }
+        size_t size() const { return len; }
+        explicit operator bool() const { return ptr != nullptr; }
+
+    private:
+        friend struct user_buf_info_t;
+
+        unsigned char* ptr = nullptr;
+        size_t len = 0;
+        int dma_fd = -1;
+        bool write = false;
+    };
+
+    using on_data_t = std::function<void(user_buffers_t&, v4l2_buffer&)>;
+
+    virtual bool open() = 0;
+    virtual bool close() = 0;
+
+    /**
+     * blocks and calls on_data for every frame until run_loop turns false or the source dies.
+     * the buffer goes back to the producer after on_data, unless a consumer took a lease on it from `leases`.
+     */
+    virtual bool stream_on(bool& run_loop, on_data_t on_data) = 0;
+    virtual bool stream_off() = 0;
+
+    /**
+     * wakes stream_on so it returns soon. async-signal-safe.
+     */
+    virtual void request_stop() = 0;
+
+    virtual bool is_open() const = 0;
+
+    /**
+     * appends buffers at runtime, new ones are ready for the producer.
+     * @return number of buffers actually added
+     */
+    virtual int add_buffers(int count) { return 0; }
+
+    static uint64_t timestamp_ns(const v4l2_buffer& vbuf) {
+        return (uint64_t)vbuf.timestamp.tv_sec * 1000000000ull + (uint64_t)vbuf.timestamp.tv_usec * 1000ull;
+    }
+
+    size_t buffer_bytes() const {
+        size_t total = 0;
+        for (auto& buf : buffers) {
+            for (auto& mem : buf.mem) {
+                total += mem.size;
+            }
+        }
+        return total;
+    }
+
+    /**
+     * the source reallocates after a resolution or format change, both run on the capture thread.
+     * released: drop leases and anything imported from the old buffers, the source then waits for leases to drain.
+     * ready: buffers, width, height and pixfmt describe the new source.
+     */
+    std::function<void()> on_buffers_released;
+    std::function<void()> on_buffers_ready;
+
+    std::vector<user_buffers_t> buffers;
+    int buf_count = 0;
+    FrameLeasePool leases;
+
+protected:
+    // stamps the buffer with the frame the producer just handed out, before on_data
+    void mark_captured(const v4l2_buffer& vbuf) {
+        auto& buf = buffers[vbuf.index];
+        buf.sequence = vbuf.sequence;
+        buf.timestamp_ns = timestamp_ns(vbuf);
+    }
+
+public:
+    // fourcc, V4L2 and DRM share the same codes for NV12/NV24
+    int pixfmt = 0;
+    int width = 0;
+    int height = 0;
+    // nominal frame rate from the source timings, 0 if unknown
+    double refresh_hz = 0;
+};
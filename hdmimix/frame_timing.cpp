@@ -0,0 +1,136 @@
+#include "frame_timing.hpp"
+
+#include <time.h>
+#include <algorithm>
+
+#include "frame_source.hpp"
+
+
+void LatencyHistogram::add(uint64_t ns) {
+    uint64_t bucket = ns / bucket_ns;
+    if (bucket < bins.size()) {
+        bins[bucket]++;
+    } else {
+        overflow++;
+    }
+    count++;
+    sum_ns += ns;
+    max_ns = std::max(max_ns, ns);
+}
+
+void LatencyHistogram::clear() {
+    std::fill(bins.begin(), bins.end(), 0);
+    overflow = 0;
+    count = 0;
+    sum_ns = 0;
+    max_ns = 0;
+}
+
+double LatencyHistogram::percentile(double p) const {
+    if (count == 0) {
+        return 0.0;
+    }
+    uint64_t target = (uint64_t)(p * count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bins.size(); i++) {
+        seen += bins[i];
+        if (seen > target) {
+            return std::min((i + 1) * bucket_ns, max_ns) / 1e6;
+        }
+    }
+    return max_ns / 1e6;
+}
+
+void LatencyHistogram::write_csv(FILE* fp, const char* name) const {
+    for (size_t i = 0; i < bins.size(); i++) {
+        if (bins[i]) {
+            fprintf(fp, "%s,%.2f,%llu\n", name, (i + 1) * bucket_ns / 1e6, (unsigned long long)bins[i]);
+        }
+    }
+    if (overflow) {
+        fprintf(fp, "%s,inf,%llu\n", name, (unsigned long long)overflow);
+    }
+}
+
+bool FrameTiming::on_capture(const v4l2_buffer& vbuf) {
+    uint64_t capture_ns = FrameSource::timestamp_ns(vbuf);
+    bool in_order = last_sequence < 0 || vbuf.sequence > (uint32_t)last_sequence;
+    if (last_sequence >= 0 && in_order) {
+        uint64_t gap = vbuf.sequence - last_sequence - 1;
+        source_drops += gap;
+        window.drops += gap;
+        if (capture_ns > last_capture_ns) {
+            // per source frame, so a drop does not show up as one long interval
+            uint64_t interval = (capture_ns - last_capture_ns) / (gap + 1);
+            frame_interval.add(interval);
+            window.interval.add(interval);
+        }
+    }
+    last_sequence = vbuf.sequence;
+    last_capture_ns = capture_ns;
+    frames++;
+    window.frames++;
+    return in_order;
+}
+
+void FrameTiming::on_commit(uint64_t capture_ns, uint64_t commit_ns) {
+    if (capture_ns == 0 || commit_ns < capture_ns) {
+        return;
+    }
+    capture_to_commit.add(commit_ns - capture_ns);
+    window.commit.add(commit_ns - capture_ns);
+}
+
+void FrameTiming::on_vblank(uint64_t capture_ns, uint64_t vblank_ns) {
+    if (capture_ns == 0 || vblank_ns < capture_ns) {
+        return;
+    }
+    capture_to_vblank.add(vblank_ns - capture_ns);
+    window.vblank.add(vblank_ns - capture_ns);
+}
+
+void FrameTiming::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    last_report_ns = now;
+    if (window.frames == 0) {
+        return;
+    }
+    uint64_t expected = window.frames + window.drops;
+    printf("[TIMING] %llu frames, %llu source drops (%.3f%%), interval avg %.3fms p99 %.2fms max %.3fms\n",
+           (unsigned long long)window.frames, (unsigned long long)window.drops, 100.0 * window.drops / expected,
+           window.interval.mean_ms(), window.interval.percentile(0.99), window.interval.max_ns / 1e6);
+    const LatencyHistogram* hists[] = {&window.commit, &window.vblank};
+    const char* names[] = {"capture->commit", "capture->vblank"};
+    for (int i = 0; i < 2; i++) {
+        const auto& h = *hists[i];
+        if (h.count == 0) {
+            continue;
+        }
+        printf("[TIMING]   %-16s p50 %.2fms p90 %.2fms p99 %.2fms max %.2fms\n",
+               names[i], h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.max_ns / 1e6);
+    }
+    window.frames = 0;
+    window.drops = 0;
+    window.interval.clear();
+    window.commit.clear();
+    window.vblank.clear();
+}
+
+bool FrameTiming::write_csv(const std::string& path) const {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+    fprintf(fp, "histogram,upper_ms,count\n");
+    frame_interval.write_csv(fp, "interval");
+    capture_to_commit.write_csv(fp, "capture_to_commit");
+    capture_to_vblank.write_csv(fp, "capture_to_vblank");
+    fclose(fp);
+    printf("Saved frame timing histograms to %s (%llu frames, %llu source drops)\n",
+           path.c_str(), (unsigned long long)frames, (unsigned long long)source_drops);
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <linux/videodev2.h>
+
+// CLOCK_MONOTONIC in ns, the clock V4L2 and DRM timestamps are in
+inline uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Fixed-width latency histogram, values past the last bucket land in overflow.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram(double bucket_ms = 0.25, int bucket_count = 400)
+        : bucket_ns((uint64_t)(bucket_ms * 1e6)), bins(bucket_count, 0) {}
+
+    void add(uint64_t ns);
+    void clear();
+
+    // upper edge of the bucket holding the p-th fraction of samples (capped at max), in ms
+    double percentile(double p) const;
+    double mean_ms() const { return count ? sum_ns / 1e6 / count : 0.0; }
+
+    // one "<upper edge ms>,<count>" row per non-empty bucket
+    void write_csv(FILE* fp, const char* name) const;
+
+    uint64_t bucket_ns;
+    std::vector<uint64_t> bins;
+    uint64_t overflow = 0;
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+/**
+ * Frame pacing and latency from kernel timestamps instead of callback arrival.
+ *
+ * capture: v4l2_buffer timestamp (CLOCK_MONOTONIC, taken by the driver when the frame completed)
+ * commit:  when the atomic commit for the frame returned
+ * vblank:  page flip event time of the vblank that latched it
+ * Sequence gaps between consecutive captures count as source drops.
+ */
+class FrameTiming {
+public:
+    // @return false if this frame is older than the previous one (stream restarted)
+    bool on_capture(const v4l2_buffer& vbuf);
+    void on_commit(uint64_t capture_ns, uint64_t commit_ns);
+    void on_vblank(uint64_t capture_ns, uint64_t vblank_ns);
+
+    // prints the window and clears it, at most every interval_ms
+    void report(int interval_ms = 5000);
+    // whole-run histograms
+    bool write_csv(const std::string& path) const;
+
+    uint64_t frames = 0;
+    uint64_t source_drops = 0;
+
+    LatencyHistogram frame_interval;
+    LatencyHistogram capture_to_commit;
+    LatencyHistogram capture_to_vblank;
+
+private:
+    struct Window {
+        uint64_t frames = 0;
+        uint64_t drops = 0;
+        LatencyHistogram interval;
+        LatencyHistogram commit;
+        LatencyHistogram vblank;
+    };
+    Window window;
+
+    int64_t last_sequence = -1;
+    uint64_t last_capture_ns = 0;
+    uint64_t last_report_ns = 0;
+};
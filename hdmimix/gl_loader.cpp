@@ -0,0 +1,69 @@
+#include "gl_loader.hpp"
+
+#include <stdio.h>
+#include <EGL/egl.h>
+
+
+GLFunctions gl;
+
+bool gl_load() {
+    static bool loaded = false;
+    if (loaded) {
+        return true;
+    }
+    bool ok = true;
+#define GL_LOADER_RESOLVE(type, name) \
+    gl.name = (type)eglGetProcAddress("gl" #name); \
+    if (!gl.name) { \
+        fprintf(stderr, "GL has no gl" #name "\n"); \
+        ok = false; \
+    }
+    GL_LOADER_PROCS(GL_LOADER_RESOLVE)
+#undef GL_LOADER_RESOLVE
+    loaded = ok;
+    return ok;
+}
+
+static GLuint compile_shader(GLenum type, const char* source) {
+    GLuint shader = gl.CreateShader(type);
+    gl.ShaderSource(shader, 1, &source, nullptr);
+    gl.CompileShader(shader);
+    GLint status = GL_FALSE;
+    gl.GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[1024] = {};
+        gl.GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        fprintf(stderr, "Failed to compile %s shader: %s\n", type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+        gl.DeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint gl_link_program(const char* vertex_source, const char* fragment_source) {
+    GLuint vertex = compile_shader(GL_VERTEX_SHADER, vertex_source);
+    GLuint fragment = vertex ? compile_shader(GL_FRAGMENT_SHADER, fragment_source) : 0;
+    if (!fragment) {
+        if (vertex) {
+            gl.DeleteShader(vertex);
+        }
+        return 0;
+    }
+    GLuint program = gl.CreateProgram();
+    gl.AttachShader(program, vertex);
+    gl.AttachShader(program, fragment);
+    gl.LinkProgram(program);
+    // the program keeps them until it is deleted
+    gl.DeleteShader(vertex);
+    gl.DeleteShader(fragment);
+    GLint status = GL_FALSE;
+    gl.GetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[1024] = {};
+        gl.GetProgramInfoLog(program, sizeof(log), nullptr, log);
+        fprintf(stderr, "Failed to link shader program: %s\n", log);
+        gl.DeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
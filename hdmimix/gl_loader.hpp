@@ -0,0 +1,80 @@
+#pragma once
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+// GL_OES_EGL_image has no prototypes in the desktop GL headers
+typedef void (APIENTRYP PFNEGLIMAGETARGETPROC)(GLenum target, GLeglImageOES image);
+
+// everything past GL 1.1 the renderers use, the context is GLES 3.1
+#define GL_LOADER_PROCS(X) \
+    X(PFNEGLIMAGETARGETPROC, EGLImageTargetTexture2DOES) \
+    X(PFNEGLIMAGETARGETPROC, EGLImageTargetRenderbufferStorageOES) \
+    X(PFNGLACTIVETEXTUREPROC, ActiveTexture) \
+    X(PFNGLGENFRAMEBUFFERSPROC, GenFramebuffers) \
+    X(PFNGLDELETEFRAMEBUFFERSPROC, DeleteFramebuffers) \
+    X(PFNGLBINDFRAMEBUFFERPROC, BindFramebuffer) \
+    X(PFNGLFRAMEBUFFERRENDERBUFFERPROC, FramebufferRenderbuffer) \
+    X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, CheckFramebufferStatus) \
+    X(PFNGLGENRENDERBUFFERSPROC, GenRenderbuffers) \
+    X(PFNGLDELETERENDERBUFFERSPROC, DeleteRenderbuffers) \
+    X(PFNGLBINDRENDERBUFFERPROC, BindRenderbuffer) \
+    X(PFNGLRENDERBUFFERSTORAGEPROC, RenderbufferStorage) \
+    X(PFNGLCREATESHADERPROC, CreateShader) \
+    X(PFNGLSHADERSOURCEPROC, ShaderSource) \
+    X(PFNGLCOMPILESHADERPROC, CompileShader) \
+    X(PFNGLGETSHADERIVPROC, GetShaderiv) \
+    X(PFNGLGETSHADERINFOLOGPROC, GetShaderInfoLog) \
+    X(PFNGLDELETESHADERPROC, DeleteShader) \
+    X(PFNGLCREATEPROGRAMPROC, CreateProgram) \
+    X(PFNGLATTACHSHADERPROC, AttachShader) \
+    X(PFNGLLINKPROGRAMPROC, LinkProgram) \
+    X(PFNGLGETPROGRAMIVPROC, GetProgramiv) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, GetProgramInfoLog) \
+    X(PFNGLDELETEPROGRAMPROC, DeleteProgram) \
+    X(PFNGLUSEPROGRAMPROC, UseProgram) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, GetUniformLocation) \
+    X(PFNGLUNIFORM1IPROC, Uniform1i) \
+    X(PFNGLUNIFORM2FPROC, Uniform2f) \
+    X(PFNGLGENVERTEXARRAYSPROC, GenVertexArrays) \
+    X(PFNGLDELETEVERTEXARRAYSPROC, DeleteVertexArrays) \
+    X(PFNGLBINDVERTEXARRAYPROC, BindVertexArray) \
+    X(PFNGLGENBUFFERSPROC, GenBuffers) \
+    X(PFNGLDELETEBUFFERSPROC, DeleteBuffers) \
+    X(PFNGLBINDBUFFERPROC, BindBuffer) \
+    X(PFNGLBUFFERDATAPROC, BufferData) \
+    X(PFNGLVERTEXATTRIBPOINTERPROC, VertexAttribPointer) \
+    X(PFNGLENABLEVERTEXATTRIBARRAYPROC, EnableVertexAttribArray) \
+    X(PFNGLVERTEXATTRIBDIVISORPROC, VertexAttribDivisor) \
+    X(PFNGLDRAWARRAYSINSTANCEDPROC, DrawArraysInstanced) \
+    X(PFNGLBLENDFUNCSEPARATEPROC, BlendFuncSeparate) \
+    X(PFNGLGENQUERIESPROC, GenQueries) \
+    X(PFNGLDELETEQUERIESPROC, DeleteQueries) \
+    X(PFNGLBEGINQUERYPROC, BeginQuery) \
+    X(PFNGLENDQUERYPROC, EndQuery) \
+    X(PFNGLGETQUERYOBJECTUIVPROC, GetQueryObjectuiv)
+
+/**
+ * GL entry points past 1.1, libGL only exports 1.x portably. Resolved once with eglGetProcAddress,
+ * which hands out context-independent dispatch stubs, so one table serves every context.
+ * Call as gl.CreateShader(...).
+ */
+struct GLFunctions {
+#define GL_LOADER_MEMBER(type, name) type name = nullptr;
+    GL_LOADER_PROCS(GL_LOADER_MEMBER)
+#undef GL_LOADER_MEMBER
+};
+
+extern GLFunctions gl;
+
+/**
+ * resolves every entry point, again only after a failure. prints the missing ones
+ * @return false if any is missing
+ */
+bool gl_load();
+
+/**
+ * compiles and links a vertex and a fragment shader, errors go to stderr
+ * @return program, 0 on failure
+ */
+GLuint gl_link_program(const char* vertex_source, const char* fragment_source);
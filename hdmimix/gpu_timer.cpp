@@ -0,0 +1,99 @@
+#include "gpu_timer.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+
+bool GpuTimer::init(int depth) {
+    if (ready()) {
+        return true;
+    }
+    if (!gl_load()) {
+        return false;
+    }
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (extensions && strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+        get_query_ui64 = (GetQueryObjectui64vProc)eglGetProcAddress("glGetQueryObjectui64vEXT");
+        has_disjoint = true;
+    } else if (extensions && strstr(extensions, "GL_ARB_timer_query")) {
+        get_query_ui64 = (GetQueryObjectui64vProc)eglGetProcAddress("glGetQueryObjectui64v");
+    }
+    if (!get_query_ui64) {
+        printf("GL has no timer queries, no GPU times\n");
+        return false;
+    }
+    queries.resize(depth);
+    gl.GenQueries(depth, queries.data());
+    head = 0;
+    pending = 0;
+    active = false;
+    if (has_disjoint) {
+        // reading it clears it, start clean
+        GLint flag = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &flag);
+    }
+    return true;
+}
+
+void GpuTimer::close() {
+    if (ready()) {
+        gl.DeleteQueries(queries.size(), queries.data());
+        queries.clear();
+    }
+    pending = 0;
+    active = false;
+}
+
+bool GpuTimer::begin() {
+    if (!ready() || active || pending == (int)queries.size()) {
+        return false;
+    }
+    gl.BeginQuery(GL_TIME_ELAPSED_EXT, queries[head]);
+    active = true;
+    return true;
+}
+
+void GpuTimer::end() {
+    if (!active) {
+        return;
+    }
+    gl.EndQuery(GL_TIME_ELAPSED_EXT);
+    active = false;
+    head = (head + 1) % queries.size();
+    pending++;
+}
+
+bool GpuTimer::poll(uint64_t* elapsed_ns, bool wait) {
+    while (pending > 0) {
+        GLuint query = queries[(head - pending + queries.size()) % queries.size()];
+        if (!wait) {
+            GLuint available = GL_FALSE;
+            gl.GetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                return false;
+            }
+        }
+        GLuint64 ns = 0;
+        get_query_ui64(query, GL_QUERY_RESULT, &ns);
+        pending--;
+        GLint flag = 0;
+        if (has_disjoint) {
+            glGetIntegerv(GL_GPU_DISJOINT_EXT, &flag);
+        }
+        if (flag) {
+            disjoint++;
+            continue;
+        }
+        *elapsed_ns = ns;
+        return true;
+    }
+    return false;
+}
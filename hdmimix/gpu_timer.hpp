@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "gl_loader.hpp"
+
+/**
+ * GPU time of a span of GL commands, from GL_TIME_ELAPSED queries (GL_EXT_disjoint_timer_query on GLES,
+ * GL_ARB_timer_query on desktop GL).
+ *
+ * Queries go round a small ring and are read back once the GPU got to them, so timing never stalls
+ * the pipeline. Everything runs on the thread whose context is current.
+ */
+class GpuTimer {
+public:
+    // with the context current. false if the context has no timer queries, begin/end do nothing then
+    bool init(int depth = 8);
+    // queries only, with the context current
+    void close();
+
+    bool ready() const { return !queries.empty(); }
+
+    // no nesting, one span at a time. false if every query is still in flight, the span goes untimed
+    bool begin();
+    void end();
+
+    /**
+     * the oldest finished span
+     * @param wait block until the GPU got there, for draining at the end
+     * @return false if none is finished yet, or none is pending
+     */
+    bool poll(uint64_t* elapsed_ns, bool wait = false);
+
+    // spans the GPU reported as unreliable (disjoint: clock change, reset), dropped
+    uint64_t disjoint = 0;
+
+private:
+    typedef void (APIENTRYP GetQueryObjectui64vProc)(GLuint id, GLenum pname, GLuint64* params);
+    GetQueryObjectui64vProc get_query_ui64 = nullptr;
+    // EXT_disjoint_timer_query has a disjoint flag, ARB_timer_query does not
+    bool has_disjoint = false;
+
+    std::vector<GLuint> queries;
+    // ring position of the next begin and the count in flight
+    int head = 0;
+    int pending = 0;
+    bool active = false;
+};
@@ -1,5 +1,14 @@
 #include "v4l2.hpp"
+#include "replay_source.hpp"
+#include "buffer_tuner.hpp"
+#include "frame_converter.hpp"
+#include "frame_timing.hpp"
+#include "thread_policy.hpp"
 #include "drm.hpp"
+#include "outputs.hpp"
+#include "presenter.hpp"
+#include "recorder.hpp"
+#include "software_display.hpp"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -8,8 +17,11 @@
 #include <memory.h>
 #include <sys/mman.h>
 #include <signal.h>
+#include <memory>
+#include <string.h>
 
 #include "egl_renderer.hpp"
+#include "detection_overlay.hpp"
 #include "helper.hpp"
 #include <EGL/egl.h>
 #include <gbm.h>
@@ -21,21 +33,37 @@
 
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 class WaitSignal {
 public:
     WaitSignal() : signaled_(false) {}
     
-    void wait() {
+    // returns the CLOCK_MONOTONIC time signal() was called
+    uint64_t wait() {
         std::unique_lock<std::mutex> lock(mutex_);
         cv_.wait(lock, [this] { return signaled_; });
         signaled_ = false;
+        return signaled_ns_;
+    }
+
+    // like wait(), 0 if nothing signaled within timeout_ms
+    uint64_t wait_for(int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return signaled_; })) {
+            return 0;
+        }
+        signaled_ = false;
+        return signaled_ns_;
     }
     
     void signal() {
+        uint64_t now_ns = monotonic_ns();
         {
             std::lock_guard<std::mutex> lock(mutex_);
             signaled_ = true;
+            signaled_ns_ = now_ns;
         }
         cv_.notify_one();
     }
@@ -52,61 +80,365 @@ private:
     std::mutex mutex_;
     std::condition_variable cv_;
     bool signaled_;
+    uint64_t signaled_ns_ = 0;
 };
 
 void dump_config(EGLDisplay egl_display, EGLConfig config);
 void test_draw();
 void test_draw_dumb(DRMDevice& drm_device);
 
-void debug_on_v4l2_data(V4l2Device::user_buffers_t& buf, v4l2_buffer& vbuf) {
+void debug_on_v4l2_data(FrameSource::user_buffers_t& buf, v4l2_buffer& vbuf) {
     std::cout << "Buffer index: " << buf.index << std::endl;
     for (size_t i = 0; i < buf.num_planes(); ++i) {
         auto& mem = buf.mem[i];
+        auto view = mem.map_read();
         std::cout << "  Plane " << i << ": size=" << mem.size 
                     << ", DMA FD=" << mem.dma_fd 
-                    << ", Pointer=" << static_cast<void*>(mem.ptr) << std::endl;
-        if (mem.ptr) {
+                    << ", Pointer=" << static_cast<void*>(view.data()) << std::endl;
+        if (view) {
             printf("    ");
-            print_hex(mem.ptr, 16);
+            print_hex(view.data(), 16);
         }
     }
 };
 
 bool run_loop = true;
+volatile sig_atomic_t snapshot_requested = 0;
+FrameSource* g_frame_source = nullptr;
 void signal_handler(int signum) {
     if (signum == SIGINT) {
         run_loop = false;
+        if (g_frame_source) {
+            g_frame_source->request_stop();
+        }
         std::cout << "Caught signal " << signum << ", exiting..." << std::endl;
+    } else if (signum == SIGUSR1) {
+        snapshot_requested = 1;
     }
 }
 
-extern void imgui_main_pre(int width, int height);
+// one snapshot at a time, joined before the source closes
+std::thread snapshot_thread;
+std::atomic<bool> snapshot_writing{false};
+
+/**
+ * dumps the raw frame on a helper thread, the lease keeps the buffer away from the driver until written.
+ * size and format are copied now, a resize may change them before the write
+ */
+void save_snapshot(FrameSource& frame_source, const ThreadPolicies& thread_policies, FrameLease lease, uint32_t sequence) {
+    if (!lease) {
+        return;
+    }
+    if (snapshot_writing) {
+        printf("Snapshot %u skipped, the last one is still being written\n", sequence);
+        return;
+    }
+    if (snapshot_thread.joinable()) {
+        // done writing, only the thread exit is left
+        snapshot_thread.join();
+    }
+    // leased buffers are not freed or reallocated, the entry stays valid until the lease goes
+    FrameSource::user_buffers_t* buffer = &frame_source.buffers[lease.index()];
+    int width = frame_source.width;
+    int height = frame_source.height;
+    int pixfmt = frame_source.pixfmt;
+    snapshot_writing = true;
+    snapshot_thread = std::thread([policies = thread_policies, buffer, width, height, pixfmt, lease = std::move(lease), sequence]() mutable {
+        policies.apply("snapshot");
+        auto view = buffer->map_read();
+        if (view) {
+            char path[64];
+            snprintf(path, sizeof(path), "snapshot-%u.%s", sequence, pixfmt == V4L2_PIX_FMT_NV24 ? "nv24" : "nv12");
+            FILE* fp = fopen(path, "wb");
+            if (fp) {
+                fwrite(view.data(), view.size(), 1, fp);
+                fclose(fp);
+                printf("Saved %dx%d snapshot to %s\n", width, height, path);
+            } else {
+                std::cerr << "Failed to open " << path << std::endl;
+            }
+        }
+        // the buffer goes back before the next snapshot may start
+        view.reset();
+        lease.reset();
+        snapshot_writing = false;
+    });
+}
+
+extern void imgui_main_pre(int width, int height, int fb_width, int fb_height);
+extern void imgui_main_resize(int width, int height, int fb_width, int fb_height);
 extern void imgui_main_post();
 extern void imgui_main_begin_frame();
-extern void imgui_main_end_frame();
+extern bool imgui_main_end_frame(bool force, const std::function<void()>& underlay = nullptr, const std::function<void()>& overlay = nullptr);
 
 extern bool yolo_main_pre(const char *model_path, const char* label_list_file);
-extern bool yolo_main_on_frame(int v2ld_dma_fd, int width, int height, image_format_t imgfmt);
+extern bool yolo_main_on_frame(int v2ld_dma_fd, int width, int height, image_format_t imgfmt, std::vector<Detection>& boxes,
+                               std::string* detections = nullptr);
 extern void yolo_main_post();
 
+// WxH or WxH+X+Y
+static bool parse_rect(const char* arg, LayerRect& rect) {
+    rect = LayerRect();
+    int n = sscanf(arg, "%dx%d%d%d", &rect.w, &rect.h, &rect.x, &rect.y);
+    return (n == 2 || n == 4) && !rect.empty();
+}
+
+// the requested canvas size, never larger than the screen. the canvas plane scales it up to width x height.
+// a canvas the video is composed into stays at input size, scaling it down would lose video resolution
+static LayerRect canvas_rect(const LayerRect& requested, bool composing, int width, int height) {
+    if (requested.empty() || composing) {
+        return {0, 0, width, height};
+    }
+    return {0, 0, std::min(requested.w, width), std::min(requested.h, height)};
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options]\n"
+           "  --video <dev>           capture device (default /dev/video0)\n"
+           "  --replay <file>         replay NV12/NV24 frames from a .y4m or raw file instead of capturing\n"
+           "  --replay-rate <hz>      replay frame rate (default 60.01)\n"
+           "  --replay-size <WxH>     frame size of a raw replay file\n"
+           "  --replay-format <fmt>   nv12 or nv24, pixel format of a raw replay file\n"
+           "  --buffers <n>           capture buffer count (default 4)\n"
+           "  --buffers-auto <min:max> tune the capture buffer count at runtime within bounds\n"
+           "  --timing-csv <file>     write frame interval and latency histograms on exit\n"
+           "  --dmabuf-heap <name>    capture into /dev/dma_heap/<name> buffers (V4L2_MEMORY_DMABUF) instead of driver mmap\n"
+           "  --thread-policy <spec>  name=fifo|rr|other[:prio][@cpus] or name=none, for capture, present, render, snapshot, record\n"
+           "                          (default capture=fifo:50@4-5 present=fifo:51@4-5 render=other:-10@6-7 snapshot=other@0-3\n"
+           "                          record=other@0-3)\n"
+           "  --mlockall              lock all memory, no page faults on the frame path\n"
+           "  --video-crop <WxH+X+Y>  show only this part of the input\n"
+           "  --video-rect <WxH+X+Y>  where the video lands on screen, e.g. a picture-in-picture window\n"
+           "  --video-rotate <deg>    0, 90, 180 or 270 counter-clockwise\n"
+           "  --video-reflect <x|y|xy> mirror the video\n"
+           "                          (done by the plane when it can, otherwise composed into the canvas on the GPU)\n"
+           "  --output <connector>    drive this connector of /dev/dri/card0, e.g. HDMI-A-1 or a connector id, repeat for more\n"
+           "                          (default the first connected one)\n"
+           "  --vrr                   variable refresh on connectors that support it, instead of scheduling drops/repeats\n"
+           "  --canvas-size <WxH>     render the UI at this size, the display plane scales it to the screen (default input size)\n"
+           "  --render-ahead <n>      canvases queued between the renderer and the screen, at least 2 (default 2)\n"
+           "  --canvas-buffers <n>    canvas bos allocated and imported at startup, at least 2 (default 3)\n"
+           "  --gpu-compose           draw the video into the canvas on the GPU, also where a plane could show it\n"
+           "                          (always on for outputs with no plane that takes the input format)\n"
+           "  --fake-display <hz>     composite in memory at <hz> instead of /dev/dri/card0, canvas bos from /dev/dri/renderD128\n"
+           "  --fake-display-hash     hash every composited frame, printed in [FAKEKMS]\n"
+           "  --fake-display-dump <file> append composited frames to <file> as raw BGRA\n"
+           "  --record <dir>          record capture frames as raw NV12 with their detections into a ring of segment files\n"
+           "  --record-segments <n>   segment files in the ring (default 8)\n"
+           "  --record-segment-mb <mb> size of each segment file (default 1024)\n"
+           "  --record-queue <n>      frames waiting for the disk before new ones are dropped (default 2)\n"
+           "  --overlay-font <ttf>    font for detection labels (default ./font/Roboto-Medium.ttf),\n"
+           "                          boxes go through ImGui when it cannot be loaded\n",
+           prog);
+}
+
 int main(int argc, char** argv) {
+    std::string video_device = "/dev/video0";
+    std::string replay_file;
+    double replay_rate = 60.01;
+    int replay_width = 0;
+    int replay_height = 0;
+    int replay_pixfmt = 0;
+    int buffer_count = 4;
+    int buffers_min = 0;
+    int buffers_max = 0;
+    std::string timing_csv;
+    std::string dmabuf_heap;
+    ThreadPolicies thread_policies;
+    bool lock_memory = false;
+    double fake_display_hz = 0;
+    bool fake_display_hash = false;
+    std::string fake_display_dump;
+    std::vector<std::string> output_connectors;
+    bool use_vrr = false;
+    LayerGeometry video_geometry;
+    LayerRect canvas_size;
+    int render_ahead = 2;
+    int canvas_buffers = 3;
+    bool force_gpu_compose = false;
+    std::string record_dir;
+    int record_segments = 8;
+    size_t record_segment_mb = 1024;
+    int record_queue = 2;
+    std::string overlay_font = "./font/Roboto-Medium.ttf";
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--video") == 0 && has_value) {
+            video_device = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+            replay_file = argv[++i];
+        } else if (strcmp(argv[i], "--replay-rate") == 0 && has_value) {
+            replay_rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--replay-size") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &replay_width, &replay_height) != 2) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--replay-format") == 0 && has_value) {
+            const char* fmt = argv[++i];
+            if (strcasecmp(fmt, "nv12") == 0) {
+                replay_pixfmt = V4L2_PIX_FMT_NV12;
+            } else if (strcasecmp(fmt, "nv24") == 0) {
+                replay_pixfmt = V4L2_PIX_FMT_NV24;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--buffers") == 0 && has_value) {
+            buffer_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--buffers-auto") == 0 && has_value) {
+            if (sscanf(argv[++i], "%d:%d", &buffers_min, &buffers_max) != 2 || buffers_min < 2 || buffers_max < buffers_min) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            buffer_count = std::max(buffers_min, std::min(buffer_count, buffers_max));
+        } else if (strcmp(argv[i], "--timing-csv") == 0 && has_value) {
+            timing_csv = argv[++i];
+        } else if (strcmp(argv[i], "--dmabuf-heap") == 0 && has_value) {
+            dmabuf_heap = argv[++i];
+        } else if (strcmp(argv[i], "--thread-policy") == 0 && has_value) {
+            if (!thread_policies.parse(argv[++i])) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--mlockall") == 0) {
+            lock_memory = true;
+        } else if (strcmp(argv[i], "--video-crop") == 0 && has_value) {
+            if (!parse_rect(argv[++i], video_geometry.src)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--video-rect") == 0 && has_value) {
+            if (!parse_rect(argv[++i], video_geometry.dst)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--video-rotate") == 0 && has_value) {
+            int degrees = atoi(argv[++i]);
+            if (degrees % 90 != 0 || degrees < 0 || degrees > 270) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            video_geometry.rotation = (video_geometry.rotation & ~DRM_MODE_ROTATE_MASK) | (DRM_MODE_ROTATE_0 << (degrees / 90));
+        } else if (strcmp(argv[i], "--video-reflect") == 0 && has_value) {
+            const char* axes = argv[++i];
+            if (strchr(axes, 'x')) {
+                video_geometry.rotation |= DRM_MODE_REFLECT_X;
+            }
+            if (strchr(axes, 'y')) {
+                video_geometry.rotation |= DRM_MODE_REFLECT_Y;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            output_connectors.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--vrr") == 0) {
+            use_vrr = true;
+        } else if (strcmp(argv[i], "--canvas-size") == 0 && has_value) {
+            if (!parse_rect(argv[++i], canvas_size) || canvas_size.x || canvas_size.y) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--render-ahead") == 0 && has_value) {
+            render_ahead = atoi(argv[++i]);
+            if (render_ahead < 2) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--canvas-buffers") == 0 && has_value) {
+            canvas_buffers = atoi(argv[++i]);
+            if (canvas_buffers < 2) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gpu-compose") == 0) {
+            force_gpu_compose = true;
+        } else if (strcmp(argv[i], "--fake-display") == 0 && has_value) {
+            fake_display_hz = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--fake-display-hash") == 0) {
+            fake_display_hash = true;
+        } else if (strcmp(argv[i], "--fake-display-dump") == 0 && has_value) {
+            fake_display_dump = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+            record_dir = argv[++i];
+        } else if (strcmp(argv[i], "--record-segments") == 0 && has_value) {
+            record_segments = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record-segment-mb") == 0 && has_value) {
+            record_segment_mb = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--record-queue") == 0 && has_value) {
+            record_queue = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--overlay-font") == 0 && has_value) {
+            overlay_font = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (lock_memory) {
+        ThreadPolicies::lock_memory();
+    }
+
     yolo_main_pre("./model/yolo11.rknn", "./model/coco_80_labels_list.txt");
 
-    struct sigaction sigact;
+    struct sigaction sigact{};
     sigact.sa_handler = signal_handler;
     
     sigaction(SIGINT, &sigact, nullptr);
+    // kill -USR1 saves the next captured frame
+    sigaction(SIGUSR1, &sigact, nullptr);
     // single buffer can cause screen tearing, because drm may be reading dirty buffer
     // so we use multiple buffers
-    V4l2Device v4l2_device("/dev/video0", 4);
-    if (!v4l2_device.is_open()) {
-        std::cerr << "Failed to open video device" << std::endl;
+    // capture, replay and NV24 conversion buffers all come from this heap
+    if (!dmabuf_heap.empty()) {
+        DmaHeapAllocator::shared().heap = dmabuf_heap;
+    }
+    std::unique_ptr<FrameSource> source;
+    // only a capture device can lose its input signal
+    V4l2Device* capture_device = nullptr;
+    if (!replay_file.empty()) {
+        source = std::make_unique<ReplaySource>(replay_file, buffer_count, replay_rate, replay_width, replay_height, replay_pixfmt);
+    } else {
+        auto v4l2_device = std::make_unique<V4l2Device>(video_device, buffer_count, dmabuf_heap.empty() ? V4L2_MEMORY_MMAP : V4L2_MEMORY_DMABUF);
+        capture_device = v4l2_device.get();
+        source = std::move(v4l2_device);
+    }
+    FrameSource& frame_source = *source;
+    if (!frame_source.is_open()) {
+        std::cerr << "Failed to open video source" << std::endl;
         return 1;
     }
-
-    DRMDevice drm_device("/dev/dri/card0", v4l2_device.width, v4l2_device.height, v4l2_device.pixfmt);
-    for (int i=0; i<v4l2_device.buf_count; i++) {
-        drm_device.import_dmabuf(v4l2_device.buffers[i].index, v4l2_device.buffers[i].mem[0].dma_fd);
+    g_frame_source = &frame_source;
+
+    // video and canvas land together, one commit per vblank of each output
+    Outputs outputs;
+    if (fake_display_hz > 0) {
+        auto software_display = std::make_unique<SoftwareDisplay>(frame_source.width, frame_source.height, frame_source.pixfmt, fake_display_hz);
+        software_display->hash_frames = fake_display_hash;
+        software_display->dump_path = fake_display_dump;
+        outputs.add(std::move(software_display));
+    } else {
+        if (output_connectors.empty()) {
+            output_connectors.push_back("");
+        }
+        for (const auto& connector : output_connectors) {
+            auto drm_device = std::make_unique<DRMDevice>("/dev/dri/card0", frame_source.width, frame_source.height, frame_source.pixfmt, connector);
+            drm_device->use_vrr = use_vrr;
+            outputs.add(std::move(drm_device));
+        }
+    }
+    for (auto& output : outputs.outputs) {
+        if (output.display->gbm_fd() < 0) {
+            std::cerr << "Failed to open display" << std::endl;
+            return 1;
+        }
+    }
+    outputs.import_buffers(frame_source, 0, frame_source.buf_count);
+    if (!outputs.set_video_geometry(video_geometry)) {
+        printf("Video geometry not supported by every plane, the renderer crops and scales the video\n");
+    }
+    // some output has no plane for the input format (or it went to another layer): the canvas carries the video
+    std::atomic<bool> gpu_compose{force_gpu_compose || !outputs.video_on_planes()};
+    if (gpu_compose) {
+        printf("Compositing video into the canvas on the GPU\n");
     }
 
     // if (drm_device.create_canvas_buf_dumb() < 0) {
@@ -114,82 +446,454 @@ int main(int argc, char** argv) {
     //     return 1;
     // }
 
-    EGLBufRenderer renderer(drm_device.drm_fd, v4l2_device.width, v4l2_device.height);
+    // every output is on the same card, canvas bos from the first one import everywhere
+    LayerRect canvas = canvas_rect(canvas_size, gpu_compose, frame_source.width, frame_source.height);
+    if (gpu_compose && !canvas_size.empty()) {
+        printf("--canvas-size ignored while the video is composed into the canvas, rendering at %dx%d\n", canvas.w, canvas.h);
+    }
+    EGLBufRenderer renderer(outputs.primary().display->gbm_fd(), canvas.w, canvas.h, canvas_buffers);
     if(!renderer.initialize()) {
         return 1;
     }
+    // framebuffers for the whole ring now, the first frames flip without adding any
+    if (!outputs.import_canvas_bufs(renderer.buffers())) {
+        std::cerr << "Failed to import canvas buffers" << std::endl;
+        return 1;
+    }
 
+    // signaled after every flip, paces the render thread to the display
     WaitSignal ws_release;
-    uint32_t canvas_fb_id = 0;
 
+    // newest frame for inference, replaced on every capture
+    std::mutex npu_frame_mutex;
+    FrameLease npu_frame;
+    // newest frame for GPU composition, the render thread draws it under the UI
+    std::mutex compose_mutex;
+    FrameLease compose_frame;
+
+    // canvas bos stay locked until every presenter took them off screen, or will have once release_fence signals
+    struct RetiredBo {
+        gbm_bo* bo;
+        int release_fence;
+    };
+    std::mutex retired_bos_mutex;
+    std::vector<RetiredBo> retired_bos;
+    // gpu_wait: on the render thread, the next draw into a bo waits for its fence on the GPU.
+    // returns how many bos went back to the ring
+    auto release_retired_bos = [&renderer, &retired_bos_mutex, &retired_bos](bool gpu_wait) {
+        std::lock_guard<std::mutex> lock(retired_bos_mutex);
+        int released = (int)retired_bos.size();
+        for (const RetiredBo& retired : retired_bos) {
+            if (gpu_wait) {
+                renderer.wait_fence(retired.release_fence);
+            } else if (retired.release_fence >= 0) {
+                close(retired.release_fence);
+            }
+            renderer.read_unlock(retired.bo);
+        }
+        retired_bos.clear();
+        return released;
+    };
+
+    // the first output paces rendering and is the one measured
+    FrameTiming timing;
+    std::mutex timing_mutex;
+    Presenter& presenter = *outputs.primary().presenter;
+    presenter.on_presented = [&timing, &timing_mutex, &ws_release](const Presenter::Presented& presented) {
+        if (presented.capture_ns) {
+            std::lock_guard<std::mutex> lock(timing_mutex);
+            timing.on_commit(presented.capture_ns, presented.commit_ns);
+            if (presented.flip_ns) {
+                timing.on_vblank(presented.capture_ns, presented.flip_ns);
+            }
+        }
+        ws_release.signal();
+    };
+    for (auto& output : outputs.outputs) {
+        output.presenter->on_thread_start = [&thread_policies]() { thread_policies.apply("present"); };
+    }
+    if (!outputs.start()) {
+        return 1;
+    }
+
+    // frames are copied off the capture buffers on the recorder's own thread
+    std::unique_ptr<Recorder> recorder;
+    if (!record_dir.empty()) {
+        recorder = std::make_unique<Recorder>(record_dir, record_segments, record_segment_mb << 20, record_queue);
+        recorder->on_thread_start = [&thread_policies]() { thread_policies.apply("record"); };
+        if (!recorder->start()) {
+            return 1;
+        }
+    }
 
-    if (v4l2_device.pixfmt == V4L2_PIX_FMT_NV24) {
-        printf("NV24 is not supported, manually transcode to NV12 first\n");
+    // 4K NV12 is ~12MB of CMA per buffer, only pay for what consumers need
+    std::unique_ptr<BufferTuner> buffer_tuner;
+    if (buffers_max > 0) {
+        buffer_tuner = std::make_unique<BufferTuner>(frame_source, buffers_min, buffers_max);
+        buffer_tuner->on_buffers_added = [&frame_source, &outputs](int first, int count) {
+            outputs.import_buffers(frame_source, first, count);
+        };
     }
 
-    int last_dma_index = -1;
-    std::thread render_th([&drm_device, &renderer, &v4l2_device, &ws_release, &canvas_fb_id, &last_dma_index]() {
+    // input resolution or format changed, capture reallocates without leaving the process.
+    // DRM and EGL are resized on the render thread while capture waits for it.
+    std::atomic<bool> source_resetting{false};
+    std::atomic<bool> resize_pending{false};
+    WaitSignal ws_resized;
+    // the input went quiet, the last frame is off screen until one arrives again
+    std::atomic<bool> video_lost{false};
+    if (capture_device) {
+        capture_device->on_signal_lost = [&outputs, &ws_release, &npu_frame_mutex, &npu_frame, &compose_mutex, &compose_frame, &video_lost]() {
+            {
+                std::lock_guard<std::mutex> lock(npu_frame_mutex);
+                npu_frame.reset();
+            }
+            {
+                std::lock_guard<std::mutex> lock(compose_mutex);
+                compose_frame.reset();
+            }
+            // removing the framebuffers takes the video plane off every output, the UI stays up
+            outputs.release_buffers();
+            video_lost = true;
+            ws_release.signal();
+            printf("Video blanked until the input comes back\n");
+        };
+    }
+    frame_source.on_buffers_released = [&outputs, &ws_release, &npu_frame_mutex, &npu_frame, &compose_mutex, &compose_frame, &source_resetting, &recorder]() {
+        {
+            std::lock_guard<std::mutex> lock(npu_frame_mutex);
+            npu_frame.reset();
+        }
+        {
+            std::lock_guard<std::mutex> lock(compose_mutex);
+            compose_frame.reset();
+        }
+        if (recorder) {
+            recorder->drop_queued();
+        }
+        // the framebuffers pin the old buffers, drop them so CMA is free for the new size
+        outputs.release_buffers();
+        source_resetting = true;
+        ws_release.signal();
+    };
+    frame_source.on_buffers_ready = [&frame_source, &outputs, &ws_release, &ws_resized, &source_resetting, &resize_pending, &video_lost, &gpu_compose, force_gpu_compose]() {
+        resize_pending = true;
+        ws_release.signal();
+        // the render thread signals on its way out too, the timeout only covers a stop racing the handoff
+        while (!ws_resized.wait_for(100)) {
+            if (!run_loop) {
+                // nobody is left to draw or show the new buffers
+                source_resetting = false;
+                return;
+            }
+        }
+        source_resetting = false;
+        // new buffers are imported here, the first frame has nothing left to restore
+        video_lost = false;
+        outputs.import_buffers(frame_source, 0, frame_source.buf_count);
+        // the new format may fit a plane, or no longer fit one
+        gpu_compose = force_gpu_compose || !outputs.video_on_planes();
+        printf("Source is now %dx%d %.4s\n", frame_source.width, frame_source.height, (const char*)&frame_source.pixfmt);
+    };
+
+    std::thread render_th([&outputs, &renderer, &frame_source, &ws_release, &retired_bos_mutex, &retired_bos, &release_retired_bos, &npu_frame_mutex, &npu_frame, &source_resetting, &resize_pending, &video_lost, &ws_resized, &thread_policies, &recorder, &canvas_size, &canvas, &compose_mutex, &compose_frame, &gpu_compose, &video_geometry, &overlay_font, render_ahead]() {
+        // yolo inference runs here too, the render policy covers it
+        thread_policies.apply("render");
+        WakeupMonitor wakeup("render");
         if (!renderer.bind_context_to_thread()) {
             std::cerr << "Failed to bind EGL context to thread" << std::endl;
             run_loop = false;
+            frame_source.request_stop();
+            // capture may be waiting for a resize that will never come
+            ws_resized.signal();
             return;
         }
-        imgui_main_pre(v4l2_device.width, v4l2_device.height);
-
+        // ImGui lays out in input pixels (detection boxes), the framebuffer scale maps them onto the canvas
+        imgui_main_pre(frame_source.width, frame_source.height, canvas.w, canvas.h);
+        // detection boxes of the newest inference, in input pixels too. through ImGui if the overlay has no font
+        DetectionOverlay overlay;
+        overlay.init(overlay_font.c_str());
+        overlay.resize(frame_source.width, frame_source.height);
+        std::vector<Detection> boxes;
+        std::function<void()> draw_overlay = [&overlay]() {
+            overlay.draw();
+        };
+
+        // kept until a newer frame arrives, so detections do not flicker when rendering outpaces capture
+        FrameLease inference_frame;
+        // NV24 (1080p) is converted once per frame for the NPU, scanout stays on the capture buffer
+        FrameConverter converter;
+        int inference_dma_fd = -1;
+        // reused, no allocation per frame once it has grown
+        std::string detections;
+        // an unchanged UI keeps the canvas on screen, no draw, swap or commit
+        bool force_draw = true;
+        // gpu_compose the canvas ring was sized for
+        bool canvas_composing = gpu_compose;
+        uint64_t ui_drawn = 0, ui_skipped = 0;
+        // GPU composition: the frame under the UI, shared with the canvases drawn from it until they retire
+        std::shared_ptr<FrameLease> composed;
+        bool new_video = false;
+        // submitted canvas bos not handed back yet
+        int queued_bos = 0;
+        uint64_t ui_report_ns = monotonic_ns();
         while (run_loop) {
             static FreqMonitor freq_monitor("IMGUI");
             freq_monitor.increment();
 
+            if (source_resetting) {
+                // capture waits for every lease before freeing its buffers
+                inference_frame.reset();
+                inference_dma_fd = -1;
+                composed.reset();
+                renderer.release_video();
+            }
+            if (video_lost && (composed || inference_dma_fd >= 0)) {
+                // no stale frame or detections under the UI while the input is gone
+                inference_frame.reset();
+                inference_dma_fd = -1;
+                composed.reset();
+                force_draw = true;
+            }
+            if (resize_pending.exchange(false)) {
+                // every canvas bo must be unlocked before the ring goes away
+                outputs.set_format(frame_source.width, frame_source.height, frame_source.pixfmt);
+                queued_bos -= release_retired_bos(true);
+                canvas_composing = gpu_compose;
+                canvas = canvas_rect(canvas_size, canvas_composing, frame_source.width, frame_source.height);
+                if (!renderer.resize(canvas.w, canvas.h) || !outputs.import_canvas_bufs(renderer.buffers())) {
+                    std::cerr << "Failed to reallocate canvas buffers" << std::endl;
+                }
+                imgui_main_resize(frame_source.width, frame_source.height, canvas.w, canvas.h);
+                overlay.resize(frame_source.width, frame_source.height);
+                // set_format dropped the canvas and the ring is new
+                force_draw = true;
+                ws_resized.signal();
+            }
+            if (canvas_composing != gpu_compose && !canvas_size.empty() && !source_resetting) {
+                // the new input moved the video on or off the planes, --canvas-size only holds for a UI-only canvas
+                outputs.release_canvas_bufs();
+                queued_bos -= release_retired_bos(true);
+                canvas_composing = gpu_compose;
+                canvas = canvas_rect(canvas_size, canvas_composing, frame_source.width, frame_source.height);
+                if (!renderer.resize(canvas.w, canvas.h) || !outputs.import_canvas_bufs(renderer.buffers())) {
+                    std::cerr << "Failed to reallocate canvas buffers" << std::endl;
+                }
+                imgui_main_resize(frame_source.width, frame_source.height, canvas.w, canvas.h);
+                printf("Canvas is now %dx%d\n", canvas.w, canvas.h);
+                force_draw = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(npu_frame_mutex);
+                if (npu_frame) {
+                    inference_frame = std::move(npu_frame);
+                    inference_dma_fd = -1;
+                }
+            }
+            if (inference_frame && inference_dma_fd < 0) {
+                auto& mem = frame_source.buffers[inference_frame.index()].mem[0];
+                if (frame_source.pixfmt == V4L2_PIX_FMT_NV24) {
+                    int out = converter.convert_nv24(mem, frame_source.width, frame_source.height);
+                    inference_dma_fd = out >= 0 ? converter.outputs[out].dma_fd : -1;
+                    converter.report();
+                    // the NV12 copy is all inference needs, hand the capture buffer back early
+                    inference_frame.reset();
+                } else if (frame_source.pixfmt == V4L2_PIX_FMT_NV12) {
+                    inference_dma_fd = mem.dma_fd;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(compose_mutex);
+                if (compose_frame) {
+                    composed = std::make_shared<FrameLease>(std::move(compose_frame));
+                    new_video = true;
+                }
+            }
+            if (composed && !gpu_compose) {
+                // back on a plane, the canvas is transparent again
+                composed.reset();
+                force_draw = true;
+            }
+
+            if (!renderer.begin_frame()) {
+                // every bo is still queued, wait for one to come back
+                wakeup.record(ws_release.wait_for(100));
+                queued_bos -= release_retired_bos(true);
+                continue;
+            }
             imgui_main_begin_frame();
-            if (last_dma_index >= 0 && v4l2_device.pixfmt == V4L2_PIX_FMT_NV12) {
-                yolo_main_on_frame(v4l2_device.buffers[last_dma_index].mem[0].dma_fd, v4l2_device.width, v4l2_device.height, IMAGE_FORMAT_YUV420SP_NV12);
+            boxes.clear();
+            if (inference_dma_fd >= 0) {
+                detections.clear();
+                yolo_main_on_frame(inference_dma_fd, frame_source.width, frame_source.height, IMAGE_FORMAT_YUV420SP_NV12,
+                                   boxes, recorder ? &detections : nullptr);
+                if (recorder) {
+                    recorder->set_overlay(detections.c_str());
+                }
+            }
+            if (overlay.ready()) {
+                overlay.set(boxes.data(), boxes.size());
+            } else {
+                draw_detections(boxes.data(), boxes.size());
+            }
+            std::function<void()> underlay;
+            if (composed) {
+                underlay = [&renderer, &frame_source, &composed, &video_geometry]() {
+                    auto& mem = frame_source.buffers[composed->index()].mem[0];
+                    if (!renderer.compose_video(composed->index(), mem.dma_fd, frame_source.width, frame_source.height,
+                                                frame_source.pixfmt, video_geometry)) {
+                        glClearColor(0, 0, 0, 1);
+                        glClear(GL_COLOR_BUFFER_BIT);
+                    }
+                };
             }
-            imgui_main_end_frame();
-            renderer.swap_buffer();
+            bool drawn = imgui_main_end_frame(force_draw || new_video || overlay.changed(), underlay, draw_overlay);
+            uint64_t now_ns = monotonic_ns();
+            if (now_ns - ui_report_ns >= 5000000000ull) {
+                printf("[IMGUI] %llu drawn, %llu unchanged and skipped, %llu late canvas imports\n", (unsigned long long)ui_drawn,
+                       (unsigned long long)ui_skipped, (unsigned long long)outputs.late_canvas_imports);
+                ui_drawn = ui_skipped = 0;
+                ui_report_ns = now_ns;
+            }
+            if (!drawn) {
+                ui_skipped++;
+                // without video nothing flips, poll so the UI still notices changes
+                wakeup.record(ws_release.wait_for(100));
+                queued_bos -= release_retired_bos(true);
+                continue;
+            }
+            ui_drawn++;
+            force_draw = false;
+            new_video = false;
+            // the plane waits for the GPU in the kernel, this thread goes on to the next frame
+            int render_fence = renderer.create_out_fence();
             gbm_bo* cur_bo = renderer.read_lock();
 
-            // create framebuffer from the bo
-            canvas_fb_id = drm_device.import_canvas_buf_bo(cur_bo);
+            // imported with the ring, a new framebuffer here is counted as a late import
+            // a composited frame stays leased until the canvas sampled from it is off screen
+            bool submitted = cur_bo && outputs.submit_canvas(cur_bo, render_fence, [&retired_bos_mutex, &retired_bos, &ws_release, cur_bo, composed](int release_fence) {
+                {
+                    std::lock_guard<std::mutex> lock(retired_bos_mutex);
+                    retired_bos.push_back({cur_bo, release_fence});
+                }
+                ws_release.signal();
+            });
+            if (submitted) {
+                queued_bos++;
+            } else if (cur_bo) {
+                renderer.read_unlock(cur_bo);
+            } else if (render_fence >= 0) {
+                close(render_fence);
+            }
 
-            ws_release.wait();
-            renderer.read_unlock(cur_bo); // unlock the bo for the next frame
+            // unlock bos that are off screen, or will be by the time the GPU gets to them.
+            // only a full pipeline waits, for a commit or flip to hand one back
+            queued_bos -= release_retired_bos(true);
+            while (run_loop && (queued_bos >= render_ahead || !renderer.has_free_buffers())) {
+                wakeup.record(ws_release.wait());
+                queued_bos -= release_retired_bos(true);
+            }
         }
+        overlay.close();
+        // no more resizes, release a capture thread waiting in on_buffers_ready
+        ws_resized.signal();
     });
 
     sleep(1); // dirty: wait for renderer to get ready
 
-    v4l2_device.stream_on(run_loop, [&drm_device, &renderer, &ws_release, &canvas_fb_id, &last_dma_index]
-        (V4l2Device::user_buffers_t& buf, v4l2_buffer& vbuf) {
+    // the main thread is the capture thread from here on, anything it spawns sets its own policy
+    thread_policies.apply("capture");
+    WakeupMonitor capture_wakeup("capture");
+    frame_source.stream_on(run_loop, [&frame_source, &outputs, &npu_frame_mutex, &npu_frame, &buffer_tuner, &timing, &timing_mutex, &thread_policies, &capture_wakeup, &recorder, &gpu_compose, &compose_mutex, &compose_frame, &ws_release, &video_lost]
+        (FrameSource::user_buffers_t& buf, v4l2_buffer& vbuf) {
+        // frame done in the driver -> capture thread running
+        capture_wakeup.record(buf.timestamp_ns);
+        if (video_lost.exchange(false)) {
+            // the signal came back in the same format, a SOURCE_CHANGE would have reimported already
+            outputs.import_buffers(frame_source, 0, frame_source.buf_count);
+            printf("Video restored\n");
+        }
         static FrameJitterMeasurer jitterMeasurer(60.0, 60);
-        jitterMeasurer.markFrame();
+        jitterMeasurer.markFrame(buf.timestamp_ns / 1e6);
         jitterMeasurer.print();
+        {
+            std::lock_guard<std::mutex> lock(timing_mutex);
+            timing.on_capture(vbuf);
+            timing.report();
+        }
+        frame_source.leases.report();
+        if (buffer_tuner) {
+            buffer_tuner->on_frame(vbuf);
+        }
 
-        last_dma_index = buf.index;
-        drm_device.display(buf.index, canvas_fb_id);
+        if (snapshot_requested) {
+            snapshot_requested = 0;
+            save_snapshot(frame_source, thread_policies, frame_source.leases.acquire(buf.index, FrameConsumer::SNAPSHOT), vbuf.sequence);
+        }
 
-        drmVBlank vbl = {};
-        vbl.request.type = (drmVBlankSeqType)DRM_VBLANK_RELATIVE;
-        vbl.request.sequence = 1; // wait for the next vblank
-        if(int ret = drmWaitVBlank(drm_device.drm_fd, &vbl); ret) {
-            std::cerr << "Failed to wait for vblank: " << strerror(-ret) << std::endl;
+        {
+            FrameLease lease = frame_source.leases.acquire(buf.index, FrameConsumer::NPU);
+            std::lock_guard<std::mutex> lock(npu_frame_mutex);
+            npu_frame = std::move(lease);
         }
-        ws_release.signal();
+
+        if (recorder) {
+            // a full queue drops the frame here, the disk never holds up capture
+            recorder->submit(frame_source.leases.acquire(buf.index, FrameConsumer::RECORD), buf, frame_source.width, frame_source.height,
+                             frame_source.pixfmt);
+        }
+
+        if (gpu_compose) {
+            // drawn under the UI on the render thread, the canvas takes it to every output
+            FrameLease lease = frame_source.leases.acquire(buf.index, FrameConsumer::COMPOSE);
+            {
+                std::lock_guard<std::mutex> lock(compose_mutex);
+                compose_frame = std::move(lease);
+            }
+            ws_release.signal();
+            return;
+        }
+        // on screen until the next frame is latched, capture never waits for vblank
+        outputs.submit_video(frame_source.leases.acquire(buf.index, FrameConsumer::SCANOUT), buf.timestamp_ns);
     });
 
+    // capture may also end on its own (device gone), make sure the renderer does not wait forever
+    run_loop = false;
+    ws_release.signal();
     render_th.join();
+    // drops the last video leases and canvas bos, no more timing updates after this
+    outputs.stop();
+    // the GL context went with the render thread
+    release_retired_bos(false);
+    if (recorder) {
+        // the last queued frames reach the disk, their leases go before the source closes
+        recorder->stop();
+    }
+    if (snapshot_thread.joinable()) {
+        snapshot_thread.join();
+    }
+
+    if (!timing_csv.empty()) {
+        timing.write_csv(timing_csv);
+    }
 
     imgui_main_post();
 
-    v4l2_device.stream_off();
+    frame_source.stream_off();
     usleep(100*1000); // 100ms to ensure all buffers are processed
 
     renderer.close();
     usleep(100*1000);
 
-    drm_device.close();
+    outputs.close();
     usleep(100*1000);
 
-    v4l2_device.close();
+    npu_frame.reset();
+    compose_frame.reset();
+    g_frame_source = nullptr;
+    frame_source.close();
     usleep(100*1000);
     
     yolo_main_post();
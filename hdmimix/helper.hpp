@@ -80,6 +80,17 @@ public:
         lastFrameTime = now;
     }
 
+    // same, with the driver capture timestamp instead of arrival time, free of scheduling noise
+    void markFrame(double timestampMs) {
+        if (lastTimestampMs > 0) {
+            frameTimes.push_back(timestampMs - lastTimestampMs);
+            if (frameTimes.size() > maxStoredFrames) {
+                frameTimes.erase(frameTimes.begin());
+            }
+        }
+        lastTimestampMs = timestampMs;
+    }
+
     void print() {
         auto now = std::chrono::high_resolution_clock::now();
         if (std::chrono::duration<double>(now - lastPrint).count() >= 1.0) {
@@ -148,6 +159,7 @@ private:
     const double targetFrameTime;  // Target frame time in milliseconds (16.666...ms for 60FPS)
     std::chrono::high_resolution_clock::time_point lastFrameTime;
     std::chrono::high_resolution_clock::time_point lastPrint;
+    double lastTimestampMs = 0;
     std::vector<double> frameTimes; // Stores frame times in milliseconds
     
     const size_t maxStoredFrames; // Store up to 10 seconds at 60FPS
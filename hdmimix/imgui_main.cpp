@@ -11,6 +11,8 @@
 #include "imgui_impl_opengl3.h"
 #include "imgui_impl_pass_through.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <functional>
 #define GL_SILENCE_DEPRECATION
 #if defined(IMGUI_IMPL_OPENGL_ES2)
 #include <GLES2/gl2.h>
@@ -24,13 +26,13 @@
 #pragma comment(lib, "legacy_stdio_definitions")
 #endif
 
-void imgui_main_pre(int width, int height)
+void imgui_main_pre(int width, int height, int fb_width, int fb_height)
 {
 
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
-    ImGui_ImplPassThrough_Init(width, height);
+    ImGui_ImplPassThrough_Init(width, height, fb_width, fb_height);
 
     ImGuiIO& io = ImGui::GetIO(); (void)io;
     // io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;     // Enable Keyboard Controls
@@ -62,6 +64,13 @@ void imgui_main_pre(int width, int height)
 
 }
 
+void imgui_main_resize(int width, int height, int fb_width, int fb_height)
+{
+    ImGuiIO& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2((float)width, (float)height);
+    io.DisplayFramebufferScale = ImVec2((float)fb_width / width, (float)fb_height / height);
+}
+
 void imgui_main_post()
 {
     // Cleanup
@@ -126,10 +135,91 @@ void imgui_main_begin_frame()
 }
 
 
-void imgui_main_end_frame() {
+// FNV-1a, only compared against the previous frame so collisions just cost one stale frame
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// everything RenderDrawData turns into pixels: geometry, clipping, textures, and the clear color
+static uint64_t hash_draw_data(const ImDrawData* draw_data)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash = hash_bytes(hash, &clear_color, sizeof(clear_color));
+    hash = hash_bytes(hash, &draw_data->DisplayPos, sizeof(draw_data->DisplayPos));
+    hash = hash_bytes(hash, &draw_data->DisplaySize, sizeof(draw_data->DisplaySize));
+    hash = hash_bytes(hash, &draw_data->FramebufferScale, sizeof(draw_data->FramebufferScale));
+    ImTextureID font_tex = ImGui::GetIO().Fonts->TexID;
+    hash = hash_bytes(hash, &font_tex, sizeof(font_tex));
+    for (int n = 0; n < draw_data->CmdListsCount; n++) {
+        const ImDrawList* cmd_list = draw_data->CmdLists[n];
+        hash = hash_bytes(hash, &cmd_list->VtxBuffer.Size, sizeof(cmd_list->VtxBuffer.Size));
+        hash = hash_bytes(hash, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+        hash = hash_bytes(hash, &cmd_list->IdxBuffer.Size, sizeof(cmd_list->IdxBuffer.Size));
+        hash = hash_bytes(hash, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+        for (const ImDrawCmd& cmd : cmd_list->CmdBuffer) {
+            ImTextureID tex = cmd.GetTexID();
+            hash = hash_bytes(hash, &cmd.ClipRect, sizeof(cmd.ClipRect));
+            hash = hash_bytes(hash, &tex, sizeof(tex));
+            hash = hash_bytes(hash, &cmd.VtxOffset, sizeof(cmd.VtxOffset));
+            hash = hash_bytes(hash, &cmd.IdxOffset, sizeof(cmd.IdxOffset));
+            hash = hash_bytes(hash, &cmd.ElemCount, sizeof(cmd.ElemCount));
+            hash = hash_bytes(hash, &cmd.UserCallback, sizeof(cmd.UserCallback));
+        }
+    }
+    return hash;
+}
+
+// the canvas is an FBO: GL puts its bottom row first in memory, scanout reads the first row as the top
+static void flip_draw_data_y(ImDrawData* draw_data)
+{
+    float mirror = 2 * draw_data->DisplayPos.y + draw_data->DisplaySize.y;
+    for (int n = 0; n < draw_data->CmdListsCount; n++) {
+        ImDrawList* cmd_list = draw_data->CmdLists[n];
+        for (ImDrawVert& vert : cmd_list->VtxBuffer) {
+            vert.pos.y = mirror - vert.pos.y;
+        }
+        for (ImDrawCmd& cmd : cmd_list->CmdBuffer) {
+            float top = cmd.ClipRect.y;
+            cmd.ClipRect.y = mirror - cmd.ClipRect.w;
+            cmd.ClipRect.w = mirror - top;
+        }
+    }
+}
+
+/**
+ * @param force draw even if nothing changed, e.g. the surface was recreated
+ * @param underlay draws what the UI goes on top of, instead of clearing to clear_color
+ * @param overlay draws on top of the UI, e.g. the detection boxes. changes to it need force
+ * @return false if the draw data matches the last frame drawn, nothing was rendered
+ */
+bool imgui_main_end_frame(bool force, const std::function<void()>& underlay, const std::function<void()>& overlay) {
+    static uint64_t last_hash = 0;
+    static bool drawn = false;
+
     // Rendering
     ImGui::Render();
-    glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
-    glClear(GL_COLOR_BUFFER_BIT);
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-}
\ No newline at end of file
+    ImDrawData* draw_data = ImGui::GetDrawData();
+    uint64_t hash = hash_draw_data(draw_data);
+    if (drawn && !force && hash == last_hash) {
+        return false;
+    }
+    last_hash = hash;
+    drawn = true;
+    if (underlay) {
+        underlay();
+    } else {
+        glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    flip_draw_data_y(draw_data);
+    ImGui_ImplOpenGL3_RenderDrawData(draw_data);
+    if (overlay) {
+        overlay();
+    }
+    return true;
+}
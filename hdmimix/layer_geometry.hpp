@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <xf86drmMode.h>
+
+// pixels, empty means the whole buffer or screen
+struct LayerRect {
+    int x = 0;
+    int y = 0;
+    int w = 0;
+    int h = 0;
+
+    bool empty() const { return w <= 0 || h <= 0; }
+    bool operator==(const LayerRect& other) const { return x == other.x && y == other.y && w == other.w && h == other.h; }
+    bool operator!=(const LayerRect& other) const { return !(*this == other); }
+};
+
+/**
+ * Where a layer's buffer lands on the CRTC: src is cropped out of the buffer, rotated/reflected,
+ * then scaled to dst. Maps 1:1 onto the SRC_*, CRTC_* and rotation plane properties.
+ */
+struct LayerGeometry {
+    LayerRect src;
+    LayerRect dst;
+    // DRM_MODE_ROTATE_* | DRM_MODE_REFLECT_*
+    uint32_t rotation = DRM_MODE_ROTATE_0;
+
+    bool operator==(const LayerGeometry& other) const { return src == other.src && dst == other.dst && rotation == other.rotation; }
+    bool operator!=(const LayerGeometry& other) const { return !(*this == other); }
+
+    bool swaps_axes() const { return rotation & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270); }
+
+    // empty rects filled in, src clamped to the buffer. dst may hang off screen, the plane clips it
+    LayerGeometry resolved(int buf_width, int buf_height, int screen_width, int screen_height) const {
+        LayerGeometry out = *this;
+        if (out.src.empty()) {
+            out.src = {0, 0, buf_width, buf_height};
+        }
+        out.src.x = std::max(0, std::min(out.src.x, buf_width - 1));
+        out.src.y = std::max(0, std::min(out.src.y, buf_height - 1));
+        out.src.w = std::min(out.src.w, buf_width - out.src.x);
+        out.src.h = std::min(out.src.h, buf_height - out.src.y);
+        if (out.dst.empty()) {
+            out.dst = {0, 0, screen_width, screen_height};
+        }
+        if (!(out.rotation & (DRM_MODE_ROTATE_0 | DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_180 | DRM_MODE_ROTATE_270))) {
+            out.rotation |= DRM_MODE_ROTATE_0;
+        }
+        return out;
+    }
+
+    bool is_identity(int width, int height) const {
+        LayerGeometry full = resolved(width, height, width, height);
+        return full.src == LayerRect{0, 0, width, height} && full.dst == full.src && full.rotation == DRM_MODE_ROTATE_0;
+    }
+};
+
+/**
+ * Nearest-neighbour source lookup for a resolved geometry, for whatever has to apply it in software.
+ * Per dst column and row the source coordinate is precomputed, with 90/270 columns select source rows.
+ */
+struct LayerSampler {
+    std::vector<int> cols;
+    std::vector<int> rows;
+    bool swap = false;
+
+    void build(const LayerGeometry& g) {
+        swap = g.swaps_axes();
+        bool r180 = g.rotation & DRM_MODE_ROTATE_180;
+        bool flip_x = (g.rotation & DRM_MODE_REFLECT_X) != 0;
+        bool flip_y = (g.rotation & DRM_MODE_REFLECT_Y) != 0;
+        // rotation is counter-clockwise: at 90 the source's top row becomes the left column, its right end on top
+        if (swap) {
+            flip_x ^= (g.rotation & DRM_MODE_ROTATE_90) != 0;
+            flip_y ^= (g.rotation & DRM_MODE_ROTATE_270) != 0;
+        } else {
+            flip_x ^= r180;
+            flip_y ^= r180;
+        }
+        fill(cols, g.dst.w, swap ? g.src.y : g.src.x, swap ? g.src.h : g.src.w, swap ? flip_y : flip_x);
+        fill(rows, g.dst.h, swap ? g.src.x : g.src.y, swap ? g.src.w : g.src.h, swap ? flip_x : flip_y);
+    }
+
+    // col, row relative to dst
+    int src_x(int col, int row) const { return swap ? rows[row] : cols[col]; }
+    int src_y(int col, int row) const { return swap ? cols[col] : rows[row]; }
+
+private:
+    static void fill(std::vector<int>& map, int n, int start, int len, bool flip) {
+        map.resize(std::max(n, 0));
+        for (int i = 0; i < n; i++) {
+            // pixel centers
+            int offset = (int)((int64_t)(2 * i + 1) * len / (2 * n));
+            map[i] = start + (flip ? len - 1 - offset : offset);
+        }
+    }
+};
@@ -0,0 +1,201 @@
+#include "outputs.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/sync_file.h>
+#include <atomic>
+
+
+// one sync_file signaled when both are, takes a and b
+static int merge_fences(int a, int b) {
+    if (a < 0 || b < 0) {
+        return a < 0 ? b : a;
+    }
+    sync_merge_data merge{};
+    strncpy(merge.name, "hdmimix canvas", sizeof(merge.name) - 1);
+    merge.fd2 = b;
+    int merged = ioctl(a, SYNC_IOC_MERGE, &merge) == 0 ? merge.fence : -1;
+    if (merged < 0) {
+        // not mergeable, wait for one of them here. bounded, a stuck fence must not stall the presenter
+        pollfd pfd = {a, POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0) {
+            fprintf(stderr, "Release fence not signaled after 50ms, keeping the later one only\n");
+        }
+        ::close(a);
+        return b;
+    }
+    ::close(a);
+    ::close(b);
+    return merged;
+}
+
+Presenter& Outputs::add(std::unique_ptr<DisplayBackend> display) {
+    Output output;
+    output.presenter = std::make_unique<Presenter>(*display);
+    output.display = std::move(display);
+    outputs.push_back(std::move(output));
+    return *outputs.back().presenter;
+}
+
+bool Outputs::start() {
+    for (auto& output : outputs) {
+        if (!output.presenter->start()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Outputs::stop() {
+    for (auto& output : outputs) {
+        output.presenter->stop();
+    }
+}
+
+void Outputs::close() {
+    for (auto& output : outputs) {
+        output.display->close();
+    }
+}
+
+void Outputs::import_buffers(FrameSource& source, int first, int count) {
+    for (auto& output : outputs) {
+        output.presenter->with_device([&](DisplayBackend& backend) {
+            if (first == 0) {
+                // a new input, its rate may pick another mode for the next commit
+                backend.set_refresh_hint(source.refresh_hz);
+            }
+            for (int i = first; i < first + count; i++) {
+                backend.import_dmabuf(source.buffers[i].index, source.buffers[i].mem[0].dma_fd);
+            }
+        });
+    }
+    if (first == 0) {
+        // a new input size or format may change what the planes accept
+        std::lock_guard<std::mutex> lock(geometry_mutex);
+        apply_video_geometry();
+    }
+}
+
+bool Outputs::set_video_geometry(const LayerGeometry& geometry) {
+    std::lock_guard<std::mutex> lock(geometry_mutex);
+    video_geometry = geometry;
+    return apply_video_geometry();
+}
+
+bool Outputs::video_on_planes() {
+    for (auto& output : outputs) {
+        if (!output.presenter->with_device([](DisplayBackend& backend) { return backend.video_on_plane(); })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Outputs::apply_video_geometry() {
+    bool accepted = true;
+    for (auto& output : outputs) {
+        // a rejecting backend reports the video off its plane, the caller switches to GPU composition
+        accepted &= output.presenter->with_device([this](DisplayBackend& backend) { return backend.set_video_geometry(video_geometry); });
+    }
+    return accepted;
+}
+
+void Outputs::release_buffers() {
+    for (auto& output : outputs) {
+        output.presenter->drop_video();
+        output.presenter->with_device([](DisplayBackend& backend) { backend.release_dmabufs(); });
+    }
+}
+
+void Outputs::set_format(int width, int height, int pixfmt) {
+    for (auto& output : outputs) {
+        output.presenter->drop_canvas();
+        output.presenter->with_device([&](DisplayBackend& backend) { return backend.set_format(width, height, pixfmt); });
+    }
+    canvas_bos.clear();
+}
+
+void Outputs::release_canvas_bufs() {
+    for (auto& output : outputs) {
+        output.presenter->drop_canvas();
+        output.presenter->with_device([](DisplayBackend& backend) { backend.release_canvas_bufs(); });
+    }
+    canvas_bos.clear();
+}
+
+bool Outputs::import_canvas_bufs(const std::vector<gbm_bo*>& bos) {
+    bool ok = true;
+    for (gbm_bo* bo : bos) {
+        for (auto& output : outputs) {
+            ok &= output.presenter->with_device([bo](DisplayBackend& backend) { return backend.import_canvas_buf_bo(bo); }) != 0;
+        }
+        canvas_bos.insert(bo);
+    }
+    return ok;
+}
+
+void Outputs::submit_video(FrameLease lease, uint64_t capture_ns) {
+    // every output holds its own lease, the buffer goes back to capture when the slowest one is done.
+    // the first output takes the original, so it goes last
+    for (size_t i = outputs.size(); i-- > 0;) {
+        FrameLease own = i == 0 ? std::move(lease) : lease.share(FrameConsumer::SCANOUT);
+        outputs[i].presenter->submit_video(std::move(own), capture_ns);
+    }
+}
+
+bool Outputs::submit_canvas(gbm_bo* bo, int fence_fd, std::function<void(int release_fence)> on_retired) {
+    if (!canvas_bos.count(bo)) {
+        // AddFB, and maybe a modeset, between two flips
+        late_canvas_imports++;
+        fprintf(stderr, "Canvas bo %p was not imported up front\n", (void*)bo);
+        canvas_bos.insert(bo);
+    }
+    std::vector<uint32_t> fb_ids(outputs.size());
+    int imported = 0;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        fb_ids[i] = outputs[i].presenter->with_device([bo](DisplayBackend& backend) { return backend.import_canvas_buf_bo(bo); });
+        imported += fb_ids[i] ? 1 : 0;
+    }
+    if (imported == 0) {
+        if (fence_fd >= 0) {
+            ::close(fence_fd);
+        }
+        return false;
+    }
+    // every output leaves the bo at its own vblank, the renderer gets one fence for all of them
+    struct Retirement {
+        std::mutex mutex;
+        int remaining;
+        int release_fence = -1;
+        std::function<void(int)> on_retired;
+    };
+    auto retirement = std::make_shared<Retirement>();
+    retirement->remaining = imported;
+    retirement->on_retired = std::move(on_retired);
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (fb_ids[i]) {
+            int own = fence_fd >= 0 ? dup(fence_fd) : -1;
+            outputs[i].presenter->submit_canvas(fb_ids[i], own, [retirement](int release_fence) {
+                int merged;
+                {
+                    std::lock_guard<std::mutex> lock(retirement->mutex);
+                    retirement->release_fence = merge_fences(retirement->release_fence, release_fence);
+                    if (--retirement->remaining > 0) {
+                        return;
+                    }
+                    merged = retirement->release_fence;
+                    retirement->release_fence = -1;
+                }
+                retirement->on_retired(merged);
+            });
+        }
+    }
+    if (fence_fd >= 0) {
+        ::close(fence_fd);
+    }
+    return true;
+}
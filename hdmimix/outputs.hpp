@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "display_backend.hpp"
+#include "frame_source.hpp"
+#include "presenter.hpp"
+
+/**
+ * Several displays showing the same capture buffers and canvas.
+ *
+ * Each output imports every buffer into its own framebuffers and has its own planes and Presenter,
+ * so flips are scheduled per CRTC. A video frame is leased once per output, a canvas bo stays
+ * locked until every output took it off screen.
+ *
+ * The video geometry goes to each output's plane. When some plane rejects it video_on_planes() is false,
+ * the renderer composes the video into the canvas and no frame goes to the planes.
+ */
+class Outputs {
+public:
+    struct Output {
+        std::unique_ptr<DisplayBackend> display;
+        std::unique_ptr<Presenter> presenter;
+    };
+
+    ~Outputs() { stop(); }
+
+    Presenter& add(std::unique_ptr<DisplayBackend> display);
+    bool start();
+    void stop();
+    void close();
+
+    // the first output, where the renderer allocates and frame timing is measured
+    Output& primary() { return outputs.front(); }
+    bool empty() const { return outputs.empty(); }
+
+    // buffers from 0 mean a new input, the video geometry is checked again
+    void import_buffers(FrameSource& source, int first, int count);
+    // drops the video on screen, then the framebuffers of the old buffers
+    void release_buffers();
+    // drops the canvases on screen, then every framebuffer
+    void set_format(int width, int height, int pixfmt);
+    // drops the canvases on screen and their framebuffers, for a new canvas ring at the same input format
+    void release_canvas_bufs();
+    /**
+     * framebuffers for the renderer's whole canvas ring on every output, before any of it is submitted
+     * @return false if some output could not import a bo
+     */
+    bool import_canvas_bufs(const std::vector<gbm_bo*>& bos);
+
+    /**
+     * crop, scale and rotate the video on every output
+     * @return false if some plane rejected it, video_on_planes() is false until the geometry is checked again
+     */
+    bool set_video_geometry(const LayerGeometry& geometry);
+    // false if some output has no plane for the video or rejected its geometry, the renderer has to draw it into the canvas
+    bool video_on_planes();
+
+    void submit_video(FrameLease lease, uint64_t capture_ns);
+    /**
+     * fence_fd: the renderer's fence for the bo, taken, -1 if none.
+     * on_retired runs once, after the last output retired the bo. release_fence (owned, -1 if none)
+     * signals when no output scans it out any more
+     * @return false if no output could import it, nothing will call on_retired
+     */
+    bool submit_canvas(gbm_bo* bo, int fence_fd, std::function<void(int release_fence)> on_retired);
+
+    std::vector<Output> outputs;
+    // submit_canvas saw a bo import_canvas_bufs did not, the framebuffer was added mid-stream
+    uint64_t late_canvas_imports = 0;
+
+private:
+    // with geometry_mutex held
+    bool apply_video_geometry();
+
+    // imported by import_canvas_bufs, until set_format drops them
+    std::set<gbm_bo*> canvas_bos;
+
+    // set_video_geometry against a new input on the capture thread
+    std::mutex geometry_mutex;
+    LayerGeometry video_geometry;
+};
@@ -0,0 +1,168 @@
+#include "plane_allocator.hpp"
+
+#include <algorithm>
+
+
+bool PlaneCaps::supports(uint32_t format) const {
+    return std::find(formats.begin(), formats.end(), format) != formats.end();
+}
+
+const char* PlaneCaps::type_name() const {
+    switch (type) {
+    case PlaneType::PLANE_TYPE_PRIMARY:
+        return "Primary";
+    case PlaneType::PLANE_TYPE_CURSOR:
+        return "Cursor";
+    default:
+        return "Overlay";
+    }
+}
+
+const char* layer_role_name(LayerRole role) {
+    static const char* names[] = {"video", "pip", "canvas", "overlay", "cursor"};
+    return names[(int)role];
+}
+
+bool PlaneAllocator::allocate(const std::vector<LayerRequest>& layers, const std::vector<PlaneCaps>& planes,
+                              const std::vector<uint32_t>& preferred, const test_t& test, std::vector<PlaneAssignment>& out) {
+    this->layers = &layers;
+    this->planes = &planes;
+    this->preferred = &preferred;
+    this->test = &test;
+    current.assign(layers.size(), PlaneAssignment());
+    tests = 0;
+    bool found = false;
+    while (!found) {
+        round_tests = 0;
+        found = search(0, 0, 0);
+        tests += round_tests;
+        if (found) {
+            break;
+        }
+        // the topmost layer that may go into the canvas and is still on a plane. the video goes last and only
+        // once no other layer wants a plane, it never makes room for a layer above it
+        int drop = -1;
+        int video = -1;
+        bool others_on_planes = false;
+        for (int i = (int)layers.size() - 1; i >= 0 && drop < 0; i--) {
+            const LayerRequest& request = layers[i];
+            if (!request.enabled || current[i].composited || request.role == LayerRole::CANVAS) {
+                continue;
+            }
+            if (request.role == LayerRole::VIDEO) {
+                video = request.composable ? i : video;
+            } else if (request.composable) {
+                drop = i;
+            } else {
+                others_on_planes = true;
+            }
+        }
+        if (drop < 0 && !others_on_planes) {
+            // the video alone fits no plane
+            drop = video;
+        }
+        if (drop < 0) {
+            break;
+        }
+        current[drop].composited = true;
+    }
+    if (found) {
+        out = current;
+    }
+    this->layers = nullptr;
+    this->planes = nullptr;
+    this->preferred = nullptr;
+    this->test = nullptr;
+    return found;
+}
+
+std::vector<int> PlaneAllocator::candidates(size_t layer) const {
+    const LayerRequest& request = (*layers)[layer];
+    uint32_t want = preferred->size() > layer ? (*preferred)[layer] : 0;
+    // cheapest first: the plane it had, then the plane type meant for the role
+    auto rank = [&](const PlaneCaps& caps) {
+        if (caps.plane_id == want) {
+            return 0;
+        }
+        switch (request.role) {
+        case LayerRole::CURSOR:
+            return caps.type == PlaneType::PLANE_TYPE_CURSOR ? 1 : caps.type == PlaneType::PLANE_TYPE_OVERLAY ? 2 : 3;
+        case LayerRole::CANVAS:
+            // the legacy modeset on canvas import puts it on the primary plane anyway
+            return caps.type == PlaneType::PLANE_TYPE_PRIMARY ? 1 : 2;
+        default:
+            return caps.type == PlaneType::PLANE_TYPE_OVERLAY ? 1 : 2;
+        }
+    };
+    std::vector<int> out;
+    for (int p = 0; p < (int)planes->size() && p < 64; p++) {
+        const PlaneCaps& caps = (*planes)[p];
+        if (caps.type == PlaneType::PLANE_TYPE_CURSOR && request.role != LayerRole::CURSOR) {
+            continue;
+        }
+        if (!caps.supports(request.format) || (request.geometry.rotation & ~caps.rotations) != 0) {
+            continue;
+        }
+        out.push_back(p);
+    }
+    std::stable_sort(out.begin(), out.end(), [&](int a, int b) { return rank((*planes)[a]) < rank((*planes)[b]); });
+    return out;
+}
+
+bool PlaneAllocator::search(size_t layer, uint64_t min_zpos, uint64_t used) {
+    if (layer == layers->size()) {
+        if (!stacking_ok() || round_tests >= max_tests) {
+            return false;
+        }
+        round_tests++;
+        return (*test)(current);
+    }
+    PlaneAssignment& assignment = current[layer];
+    assignment.plane = -1;
+    assignment.zpos = 0;
+    if (!(*layers)[layer].enabled || assignment.composited) {
+        return search(layer + 1, min_zpos, used);
+    }
+    for (int p : candidates(layer)) {
+        const PlaneCaps& caps = (*planes)[p];
+        uint64_t zpos = std::max(min_zpos, caps.zpos_min);
+        if ((used & (1ull << p)) || zpos > caps.zpos_max) {
+            continue;
+        }
+        assignment.plane = p;
+        assignment.zpos = zpos;
+        if (search(layer + 1, zpos + 1, used | (1ull << p))) {
+            return true;
+        }
+        if (round_tests >= max_tests) {
+            break;
+        }
+    }
+    assignment.plane = -1;
+    return false;
+}
+
+bool PlaneAllocator::stacking_ok() const {
+    int canvas = -1;
+    for (size_t i = 0; i < layers->size(); i++) {
+        if ((*layers)[i].role == LayerRole::CANVAS && current[i].plane >= 0) {
+            canvas = (int)i;
+        }
+    }
+    for (size_t i = 0; i < layers->size(); i++) {
+        if (!current[i].composited || !(*layers)[i].enabled) {
+            continue;
+        }
+        if (canvas < 0) {
+            return false;
+        }
+        int lo = std::min((int)i, canvas);
+        int hi = std::max((int)i, canvas);
+        for (int j = lo + 1; j < hi; j++) {
+            if (current[j].plane >= 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+#include "layer_geometry.hpp"
+
+enum class PlaneType {
+    PLANE_TYPE_PRIMARY,
+    PLANE_TYPE_OVERLAY,
+    PLANE_TYPE_CURSOR,
+};
+
+// what KMS tells about a plane without trying it. scaling limits only show in a TEST_ONLY commit
+struct PlaneCaps {
+    uint32_t plane_id = 0;
+    PlaneType type = PlaneType::PLANE_TYPE_OVERLAY;
+    std::vector<uint32_t> formats;
+    // DRM_MODE_ROTATE_* | DRM_MODE_REFLECT_*
+    uint32_t rotations = DRM_MODE_ROTATE_0;
+    // min == max when zpos is immutable. planes without zpos get an order by type, never committed
+    uint64_t zpos_min = 0;
+    uint64_t zpos_max = 0;
+
+    bool supports(uint32_t format) const;
+    const char* type_name() const;
+};
+
+// bottom to top as they are usually stacked
+enum class LayerRole {
+    VIDEO,
+    PIP,
+    CANVAS,
+    OVERLAY,
+    CURSOR,
+};
+const char* layer_role_name(LayerRole role);
+
+struct LayerRequest {
+    LayerRole role = LayerRole::OVERLAY;
+    uint32_t format = 0;
+    // resolved, on screen
+    LayerGeometry geometry;
+    // may be drawn into the canvas when no plane is left for it, never for the canvas itself.
+    // the video only when every other layer is composited already
+    bool composable = false;
+    bool enabled = true;
+};
+
+struct PlaneAssignment {
+    // into the planes given to allocate(), -1 without a plane
+    int plane = -1;
+    uint64_t zpos = 0;
+    // the renderer draws this layer into the canvas
+    bool composited = false;
+};
+
+/**
+ * Puts layers on planes: format, rotation, cursor-ness and zpos ranges rule out planes up front,
+ * every stacking that is left is tried with a TEST_ONLY commit until one passes.
+ *
+ * When none does, the topmost composable layer goes into the canvas and the search runs again,
+ * so a layer that does not fit costs the renderer that layer only, never the whole frame.
+ * The video is composited only when it fits no plane on its own: never while another layer still
+ * holds one, so a layer that cannot be composited fails the allocation instead.
+ */
+class PlaneAllocator {
+public:
+    // TEST_ONLY commit of an assignment for every layer, true if the driver takes it
+    using test_t = std::function<bool(const std::vector<PlaneAssignment>&)>;
+
+    /**
+     * layers bottom to top. preferred: plane id per layer tried first, so a new allocation moves little. may be empty
+     * @return false if nothing passed even with every composable layer composited
+     */
+    bool allocate(const std::vector<LayerRequest>& layers, const std::vector<PlaneCaps>& planes,
+                  const std::vector<uint32_t>& preferred, const test_t& test, std::vector<PlaneAssignment>& out);
+
+    // TEST_ONLY commits per round, a round gives up after that many
+    int max_tests = 32;
+    // TEST_ONLY commits of the last allocate()
+    int tests = 0;
+
+private:
+    bool search(size_t layer, uint64_t min_zpos, uint64_t used);
+    // a composited layer must not have a plane layer between it and the canvas
+    bool stacking_ok() const;
+    std::vector<int> candidates(size_t layer) const;
+
+    const std::vector<LayerRequest>* layers = nullptr;
+    const std::vector<PlaneCaps>* planes = nullptr;
+    const std::vector<uint32_t>* preferred = nullptr;
+    const test_t* test = nullptr;
+    std::vector<PlaneAssignment> current;
+    int round_tests = 0;
+};
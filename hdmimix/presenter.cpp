@@ -0,0 +1,302 @@
+#include "presenter.hpp"
+#include "frame_timing.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+
+// moves out and leaves t empty, so whatever t held is released by the caller outside the lock
+template <typename T>
+static T take(T& t) {
+    T out = std::move(t);
+    t = T();
+    return out;
+}
+
+bool Presenter::start() {
+    if (running) {
+        return true;
+    }
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        fprintf(stderr, "Failed to create presenter eventfd: %s\n", strerror(errno));
+        return false;
+    }
+    drift.set_nominal_refresh(display.output_refresh_hz());
+    running = true;
+    thread = std::thread([this]() { loop(); });
+    return true;
+}
+
+void Presenter::stop() {
+    if (running) {
+        running = false;
+        wake();
+        thread.join();
+    }
+    if (wake_fd >= 0) {
+        ::close(wake_fd);
+        wake_fd = -1;
+    }
+    drop_video();
+    drop_canvas();
+}
+
+void Presenter::wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to wake presenter: %s\n", strerror(errno));
+    }
+}
+
+void Presenter::submit_video(FrameLease lease, uint64_t capture_ns) {
+    Video replaced;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending_video.lease) {
+            superseded++;
+        }
+        replaced = take(pending_video);
+        pending_video.lease = std::move(lease);
+        pending_video.capture_ns = capture_ns;
+        DriftController::Decision decision = drift.on_capture(capture_ns);
+        pending_video.not_before_ns = decision.not_before_ns;
+        pending_video.target = decision.target;
+    }
+    wake();
+}
+
+void Presenter::submit_canvas(uint32_t fb_id, int fence_fd, std::function<void(int release_fence)> on_retire) {
+    Canvas replaced;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        replaced = take(pending_canvas);
+        pending_canvas.fb_id = fb_id;
+        pending_canvas.fence_fd = fence_fd;
+        pending_canvas.on_retire = std::move(on_retire);
+    }
+    // never scanned out, nothing to wait for
+    retire(replaced);
+    wake();
+}
+
+void Presenter::retire(Canvas& canvas, int release_fence) {
+    if (canvas.fence_fd >= 0) {
+        ::close(canvas.fence_fd);
+        canvas.fence_fd = -1;
+    }
+    if (canvas.on_retire) {
+        canvas.on_retire(release_fence);
+    } else if (release_fence >= 0) {
+        ::close(release_fence);
+    }
+}
+
+void Presenter::drop_video() {
+    Video dropped[3];
+    std::lock_guard<std::mutex> lock(mutex);
+    dropped[0] = take(pending_video);
+    dropped[1] = take(flight_video);
+    dropped[2] = take(screen_video);
+    // the lock is released before dropped, leases go back to capture outside it
+}
+
+void Presenter::drop_canvas() {
+    Canvas dropped[3];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped[0] = take(pending_canvas);
+        dropped[1] = take(flight_canvas);
+        dropped[2] = take(screen_canvas);
+    }
+    for (auto& canvas : dropped) {
+        retire(canvas);
+    }
+}
+
+void Presenter::loop() {
+    if (on_thread_start) {
+        on_thread_start();
+    }
+    pollfd fds[2] = {
+        {display.event_fd(), POLLIN, 0},
+        {wake_fd, POLLIN, 0},
+    };
+    bool retry = false;
+    while (running) {
+        // EBUSY from someone else's commit (legacy SetCrtc on canvas import) has no event to wait for
+        timespec timeout = {0, 1000000};
+        uint64_t now = monotonic_ns();
+        if (!retry && hold_until_ns > now) {
+            timeout.tv_sec = (hold_until_ns - now) / 1000000000ull;
+            timeout.tv_nsec = (hold_until_ns - now) % 1000000000ull;
+        }
+        int ret = ppoll(fds, 2, retry || hold_until_ns ? &timeout : nullptr, nullptr);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Presenter poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            while (read(wake_fd, &count, sizeof(count)) > 0) {
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            display.handle_events(flip_handler);
+        }
+        retry = !try_commit();
+        report();
+    }
+}
+
+bool Presenter::try_commit() {
+    Video retired_video;
+    Canvas retired_canvas;
+    int release_fence = -1;
+    Presented presented;
+    bool landed = false;
+    bool ok = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hold_until_ns = 0;
+        // a held frame stays pending, a canvas goes out alone meanwhile
+        Video held;
+        if (pending_video.lease && pending_video.not_before_ns > monotonic_ns()) {
+            held = take(pending_video);
+        }
+        auto restore_held = [&]() {
+            if (held.lease) {
+                hold_until_ns = held.not_before_ns;
+                pending_video = take(held);
+            }
+        };
+        if (in_flight || (!pending_video.lease && pending_canvas.fb_id == 0)) {
+            restore_held();
+            return true;
+        }
+        if (pending_video.lease) {
+            display.set_passthrough(pending_video.lease.index());
+        }
+        if (pending_canvas.fb_id) {
+            display.set_canvas(pending_canvas.fb_id, pending_canvas.fence_fd);
+        }
+        int ret = display.commit(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, this);
+        if (ret == 1) {
+            commits++;
+            in_flight = true;
+            commit_ns = monotonic_ns();
+            int out_fence = display.take_out_fence();
+            if (pending_canvas.fb_id && out_fence >= 0) {
+                // off screen once this commit's fence signals, the renderer can queue work into it now
+                fenced++;
+                retired_canvas = take(screen_canvas);
+                release_fence = out_fence;
+            } else if (out_fence >= 0) {
+                ::close(out_fence);
+            }
+            flight_video = take(pending_video);
+            flight_canvas = take(pending_canvas);
+        } else if (ret == 0) {
+            // already what is on screen, no flip will come for it
+            presented.commit_ns = monotonic_ns();
+            if (pending_video.lease) {
+                presented.capture_ns = pending_video.capture_ns;
+                retired_video = take(screen_video);
+                screen_video = take(pending_video);
+            }
+            if (pending_canvas.fb_id) {
+                presented.canvas = true;
+                retired_canvas = take(screen_canvas);
+                screen_canvas = take(pending_canvas);
+            }
+            landed = true;
+        } else if (ret == -EBUSY) {
+            busy++;
+            ok = false;
+        } else {
+            errors++;
+            fprintf(stderr, "Failed to commit atomic request: %s\n", strerror(-ret));
+            retired_video = take(pending_video);
+            retired_canvas = take(pending_canvas);
+        }
+        restore_held();
+    }
+    retire(retired_canvas, release_fence);
+    if (landed && on_presented) {
+        on_presented(presented);
+    }
+    return ok;
+}
+
+void Presenter::flip_handler(unsigned int sequence, uint64_t flip_ns, void* user_data) {
+    if (user_data) {
+        static_cast<Presenter*>(user_data)->on_flip(sequence, flip_ns);
+    }
+}
+
+void Presenter::on_flip(unsigned int sequence, uint64_t flip_ns) {
+    Video retired_video;
+    Canvas retired_canvas;
+    Presented presented;
+    presented.flip_ns = flip_ns;
+    presented.sequence = sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        flips++;
+        in_flight = false;
+        presented.commit_ns = commit_ns;
+        drift.set_enabled(!display.vrr_active());
+        drift.on_flip(sequence, flip_ns, (bool)flight_video.lease, flight_video.target);
+        // dropped (source reset) while the flip was pending: keep what is on screen
+        if (flight_video.lease) {
+            presented.capture_ns = flight_video.capture_ns;
+            retired_video = take(screen_video);
+            screen_video = take(flight_video);
+        }
+        if (flight_canvas.fb_id) {
+            presented.canvas = true;
+            retired_canvas = take(screen_canvas);
+            screen_canvas = take(flight_canvas);
+        }
+    }
+    retire(retired_canvas);
+    if (on_presented) {
+        on_presented(presented);
+    }
+    // outputs on one card share the event fd, another output's presenter may have read this event
+    wake();
+}
+
+void Presenter::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    double elapsed_s = last_report_ns ? (now - last_report_ns) / 1e9 : 0;
+    last_report_ns = now;
+    if (elapsed_s == 0) {
+        return;
+    }
+    uint64_t c, f, s, n, b, e;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        c = take(commits);
+        f = take(flips);
+        s = take(superseded);
+        n = take(fenced);
+        b = take(busy);
+        e = take(errors);
+        drift.report(interval_ms);
+    }
+    printf("[PRESENT] %.2f flips/s, %llu commits, %llu superseded frames, %llu canvases released by fence, %llu busy, %llu errors\n",
+           f / elapsed_s, (unsigned long long)c, (unsigned long long)s, (unsigned long long)n, (unsigned long long)b,
+           (unsigned long long)e);
+}
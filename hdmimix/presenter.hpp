@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "display_backend.hpp"
+#include "drift_controller.hpp"
+#include "frame_lease.hpp"
+
+/**
+ * The only thread that commits to the display.
+ *
+ * Video frames and UI canvases are submitted from any thread and merged into one atomic commit
+ * with DRM_MODE_PAGE_FLIP_EVENT. Only one commit is in flight at a time, whatever arrives meanwhile
+ * goes out right after its flip event, so both planes always land on the same vblank and nothing is
+ * rejected with EBUSY. A buffer is retired when the flip event shows its successor on screen, a canvas
+ * already at commit time when the display hands out a fence for that flip.
+ * DriftController may hold a video frame back for a later vblank, so drops and repeats from the
+ * capture/display clock difference happen once, where it schedules them.
+ */
+class Presenter {
+public:
+    struct Presented {
+        // capture timestamp of the video frame this flip brought on screen, 0 if only the canvas changed
+        uint64_t capture_ns = 0;
+        uint64_t commit_ns = 0;
+        // vblank that latched the commit, CLOCK_MONOTONIC
+        uint64_t flip_ns = 0;
+        unsigned int sequence = 0;
+        bool canvas = false;
+    };
+
+    Presenter(DisplayBackend& display) : display(display) {}
+    ~Presenter() { stop(); }
+
+    bool start();
+    // drops every held buffer, no flip events are handled afterwards
+    void stop();
+
+    /**
+     * the newest submission wins: a frame replaced before it was committed is dropped and counted as superseded
+     */
+    void submit_video(FrameLease lease, uint64_t capture_ns);
+    /**
+     * fence_fd: signaled when the renderer is done with the bo, taken. -1 if it is done already.
+     * on_retire runs on the presenter thread once the canvas is off screen, will be once release_fence
+     * signals (owned by on_retire, -1 if there is nothing to wait for), or was superseded
+     */
+    void submit_canvas(uint32_t fb_id, int fence_fd, std::function<void(int release_fence)> on_retire);
+
+    // before the framebuffers behind them are removed (source reset, resize)
+    void drop_video();
+    void drop_canvas();
+
+    /**
+     * display changes (import, release, set_format) must not interleave with a commit
+     */
+    template <typename F>
+    auto with_device(F&& fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return fn(display);
+    }
+
+    // first thing on the presenter thread, e.g. to apply a scheduling policy
+    std::function<void()> on_thread_start;
+    // on the presenter thread after every flip
+    std::function<void(const Presented&)> on_presented;
+
+    // prints commits, flips and drops, and the drift controller's state, at most every interval_ms
+    void report(int interval_ms = 5000);
+
+    // guard_ms / hysteresis_ms before start()
+    DriftController drift;
+
+    uint64_t commits = 0;
+    uint64_t flips = 0;
+    // video frames replaced by a newer one before reaching a commit
+    uint64_t superseded = 0;
+    // canvases handed back at commit with the commit's out fence instead of at its flip
+    uint64_t fenced = 0;
+    uint64_t busy = 0;
+    uint64_t errors = 0;
+
+private:
+    struct Video {
+        FrameLease lease;
+        uint64_t capture_ns = 0;
+        // from the drift controller
+        uint64_t not_before_ns = 0;
+        int64_t target = -1;
+    };
+    struct Canvas {
+        uint32_t fb_id = 0;
+        // the renderer's, closed on retire
+        int fence_fd = -1;
+        std::function<void(int release_fence)> on_retire;
+    };
+    // outside the lock
+    static void retire(Canvas& canvas, int release_fence = -1);
+
+    void loop();
+    void wake();
+    // commits what is pending unless a flip is outstanding, @return false to retry shortly
+    bool try_commit();
+    // when a held video frame is due, 0 if none is held
+    uint64_t hold_until_ns = 0;
+    static void flip_handler(unsigned int sequence, uint64_t flip_ns, void* user_data);
+    void on_flip(unsigned int sequence, uint64_t flip_ns);
+
+    DisplayBackend& display;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    int wake_fd = -1;
+
+    std::mutex mutex;
+    bool in_flight = false;
+    uint64_t commit_ns = 0;
+    Video pending_video, flight_video, screen_video;
+    Canvas pending_canvas, flight_canvas, screen_canvas;
+
+    uint64_t last_report_ns = 0;
+};
@@ -0,0 +1,297 @@
+#include "recorder.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include <algorithm>
+
+#include "frame_converter.hpp"
+#include "frame_timing.hpp"
+
+
+// O_DIRECT wants buffer, offset and length aligned to the logical block size, a page covers every disk
+static constexpr size_t DIRECT_ALIGN = 4096;
+
+static size_t align_up(size_t n) {
+    return (n + DIRECT_ALIGN - 1) & ~(DIRECT_ALIGN - 1);
+}
+
+bool Recorder::start() {
+    if (running) {
+        return true;
+    }
+    if (segments < 1 || queue_depth < 1) {
+        fprintf(stderr, "Recorder needs at least one segment and one queue slot\n");
+        return false;
+    }
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+        return false;
+    }
+    segment_bytes &= ~(DIRECT_ALIGN - 1);
+    for (int i = 0; i < segments; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/segment-%03d.nv12", i);
+        std::string file = dir + path;
+        int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (direct_io ? O_DIRECT : 0), 0644);
+        if (fd < 0 && direct_io && errno == EINVAL) {
+            // tmpfs and some FUSE filesystems have no O_DIRECT, the page cache it is
+            direct_io = false;
+            fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        }
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open %s: %s\n", file.c_str(), strerror(errno));
+            stop();
+            return false;
+        }
+        // blocks are reserved now, a full disk shows up here and not mid-recording
+        int ret = posix_fallocate(fd, 0, segment_bytes);
+        if (ret != 0 && ret != EOPNOTSUPP) {
+            fprintf(stderr, "Failed to preallocate %zu bytes for %s: %s\n", segment_bytes, file.c_str(), strerror(ret));
+            ::close(fd);
+            stop();
+            return false;
+        }
+        segment_fds.push_back(fd);
+    }
+    queue.clear();
+    queue.resize(queue_depth);
+    queue_head = 0;
+    queue_count = 0;
+    segment = -1;
+    if (!next_segment()) {
+        stop();
+        return false;
+    }
+    printf("Recording to %s: %d x %zuMB segments%s, queue %d\n", dir.c_str(), segments, segment_bytes >> 20,
+           direct_io ? ", O_DIRECT" : "", queue_depth);
+    running = true;
+    thread = std::thread([this]() { loop(); });
+    return true;
+}
+
+void Recorder::stop() {
+    if (running) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+    drop_queued();
+    if (index_fp) {
+        fclose(index_fp);
+        index_fp = nullptr;
+    }
+    for (int fd : segment_fds) {
+        ::close(fd);
+    }
+    segment_fds.clear();
+    free(bounce);
+    bounce = nullptr;
+    bounce_size = 0;
+}
+
+bool Recorder::submit(FrameLease lease, FrameSource::user_buffers_t& buf, int width, int height, int pixfmt) {
+    if (!lease) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running || queue_count == (int)queue.size()) {
+            // the lease drops outside the lock, the buffer goes straight back to capture
+            dropped++;
+        } else {
+            Entry& entry = queue[(queue_head + queue_count) % queue.size()];
+            entry.lease = std::move(lease);
+            entry.mem = &buf.mem[0];
+            entry.sequence = buf.sequence;
+            entry.timestamp_ns = buf.timestamp_ns;
+            entry.width = width;
+            entry.height = height;
+            entry.pixfmt = pixfmt;
+            memcpy(entry.overlay, overlay, OVERLAY_MAX);
+            queue_count++;
+            depth_max = std::max(depth_max, queue_count);
+        }
+    }
+    if (lease) {
+        return false;
+    }
+    cv.notify_one();
+    return true;
+}
+
+void Recorder::set_overlay(const char* state) {
+    std::lock_guard<std::mutex> lock(mutex);
+    strncpy(overlay, state ? state : "", OVERLAY_MAX - 1);
+    overlay[OVERLAY_MAX - 1] = '\0';
+}
+
+void Recorder::drop_queued() {
+    std::vector<FrameLease> dropped_leases;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (; queue_count > 0; queue_count--) {
+            dropped_leases.push_back(std::move(queue[queue_head].lease));
+            queue_head = (queue_head + 1) % queue.size();
+            dropped++;
+        }
+    }
+}
+
+void Recorder::loop() {
+    if (on_thread_start) {
+        on_thread_start();
+    }
+    while (true) {
+        Entry entry;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return queue_count > 0 || !running; });
+            if (queue_count == 0) {
+                break;
+            }
+            Entry& head = queue[queue_head];
+            entry.lease = std::move(head.lease);
+            entry.mem = head.mem;
+            entry.sequence = head.sequence;
+            entry.timestamp_ns = head.timestamp_ns;
+            entry.width = head.width;
+            entry.height = head.height;
+            entry.pixfmt = head.pixfmt;
+            memcpy(entry.overlay, head.overlay, OVERLAY_MAX);
+            queue_head = (queue_head + 1) % queue.size();
+            queue_count--;
+        }
+        write_frame(entry);
+        report();
+    }
+}
+
+void Recorder::write_frame(Entry& entry) {
+    uint64_t start = monotonic_ns();
+    size_t frame_bytes = (size_t)entry.width * entry.height * 3 / 2;
+    size_t record_bytes = align_up(frame_bytes);
+    if (record_bytes > segment_bytes) {
+        fprintf(stderr, "Recorder: %zu byte frame does not fit a %zu byte segment\n", record_bytes, segment_bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        errors++;
+        return;
+    }
+    if (bounce_size < record_bytes) {
+        free(bounce);
+        bounce = nullptr;
+        bounce_size = 0;
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, DIRECT_ALIGN, record_bytes) != 0) {
+            fprintf(stderr, "Recorder: failed to allocate %zu byte write buffer\n", record_bytes);
+            std::lock_guard<std::mutex> lock(mutex);
+            errors++;
+            return;
+        }
+        bounce = static_cast<uint8_t*>(ptr);
+        bounce_size = record_bytes;
+    }
+
+    // dma-buf mappings cannot be O_DIRECT sources (no struct pages to pin), so the frame is copied once
+    {
+        auto view = entry.mem->map_read();
+        if (!view) {
+            std::lock_guard<std::mutex> lock(mutex);
+            errors++;
+            return;
+        }
+        if (entry.pixfmt == V4L2_PIX_FMT_NV24) {
+            nv24_to_nv12(view.data(), bounce, entry.width, entry.height);
+        } else {
+            memcpy(bounce, view.data(), std::min(frame_bytes, view.size()));
+        }
+    }
+    // copied, capture can have the buffer back before the disk is done
+    entry.lease.reset();
+    memset(bounce + frame_bytes, 0, record_bytes - frame_bytes);
+
+    if (segment_offset + record_bytes > segment_bytes && !next_segment()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        errors++;
+        return;
+    }
+    size_t done = 0;
+    while (done < record_bytes) {
+        ssize_t n = pwrite(segment_fds[segment], bounce + done, record_bytes - done, segment_offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "Recorder: write to segment %d failed: %s\n", segment, n < 0 ? strerror(errno) : "no space");
+            std::lock_guard<std::mutex> lock(mutex);
+            errors++;
+            return;
+        }
+        done += n;
+    }
+    fprintf(index_fp, "%u,%llu,%zu,%zu,%d,%d,%s\n", entry.sequence, (unsigned long long)entry.timestamp_ns, segment_offset,
+            frame_bytes, entry.width, entry.height, entry.overlay);
+    fflush(index_fp);
+    segment_offset += record_bytes;
+
+    uint64_t took = monotonic_ns() - start;
+    std::lock_guard<std::mutex> lock(mutex);
+    written++;
+    written_bytes += record_bytes;
+    write_ns_total += took;
+    write_ns_max = std::max(write_ns_max, took);
+}
+
+bool Recorder::next_segment() {
+    if (index_fp) {
+        fclose(index_fp);
+        index_fp = nullptr;
+    }
+    segment = (segment + 1) % segments;
+    segment_offset = 0;
+    char path[64];
+    snprintf(path, sizeof(path), "/segment-%03d.idx", segment);
+    std::string file = dir + path;
+    index_fp = fopen(file.c_str(), "w");
+    if (!index_fp) {
+        fprintf(stderr, "Failed to open %s: %s\n", file.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(index_fp, "# sequence,timestamp_ns,offset,bytes,width,height,overlay\n");
+    return true;
+}
+
+void Recorder::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    double elapsed_s = last_report_ns ? (now - last_report_ns) / 1e9 : 0;
+    last_report_ns = now;
+    if (elapsed_s == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    printf("[RECORD] %.2f frames/s, %.1f MB/s, queue %d/%d (max %d), %llu dropped, %llu errors",
+           written / elapsed_s, written_bytes / elapsed_s / 1e6, queue_count, (int)queue.size(), depth_max,
+           (unsigned long long)dropped, (unsigned long long)errors);
+    if (written) {
+        printf(", write avg %.2fms max %.2fms", write_ns_total / 1e6 / written, write_ns_max / 1e6);
+    }
+    printf(", segment %d at %zuMB\n", segment, segment_offset >> 20);
+    written = 0;
+    written_bytes = 0;
+    dropped = 0;
+    errors = 0;
+    depth_max = queue_count;
+    write_ns_total = 0;
+    write_ns_max = 0;
+}
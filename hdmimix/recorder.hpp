@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_lease.hpp"
+#include "frame_source.hpp"
+
+/**
+ * Records what goes out on HDMI: leased capture frames as raw NV12, each with the overlay state
+ * (detections) current when it was captured, into a ring of segment files preallocated at start().
+ *
+ * submit() only queues the lease, a full queue drops the frame and counts it, so capture never waits
+ * for storage. One writer thread copies the frame into an aligned buffer (NV24 is downsampled on the way),
+ * hands the capture buffer back, and writes with O_DIRECT so video does not churn the page cache.
+ *
+ * segment-NNN.nv12 holds frames at 4096-byte aligned offsets, segment-NNN.idx one line per frame:
+ * sequence,timestamp_ns,offset,bytes,width,height,overlay. After the last segment the first one
+ * is overwritten and its index starts over.
+ */
+class Recorder {
+public:
+    static constexpr size_t OVERLAY_MAX = 512;
+
+    Recorder(std::string dir, int segments = 8, size_t segment_bytes = (size_t)1 << 30, int queue_depth = 2)
+        : dir(dir), segments(segments), segment_bytes(segment_bytes), queue_depth(queue_depth) {}
+    ~Recorder() { stop(); }
+
+    // creates and preallocates every segment, then starts the writer
+    bool start();
+    // writes what is queued, then closes the segments
+    void stop();
+
+    /**
+     * capture thread. buf must stay valid while the lease is held, it is read on the writer thread
+     * @return false if the frame was dropped
+     */
+    bool submit(FrameLease lease, FrameSource::user_buffers_t& buf, int width, int height, int pixfmt);
+    // any thread, attached to every frame submitted after it. longer states are cut at OVERLAY_MAX - 1
+    void set_overlay(const char* state);
+    // the source is about to free its buffers, queued leases go now
+    void drop_queued();
+
+    // prints written frames, MB/s, queue depth and drops, at most every interval_ms
+    void report(int interval_ms = 5000);
+
+    // first thing on the writer thread, e.g. to apply a scheduling policy
+    std::function<void()> on_thread_start;
+
+    std::string dir;
+    int segments;
+    size_t segment_bytes;
+    // capture buffers the recorder may hold at once
+    int queue_depth;
+
+private:
+    struct Entry {
+        FrameLease lease;
+        FrameSource::user_buf_info_t* mem = nullptr;
+        uint32_t sequence = 0;
+        uint64_t timestamp_ns = 0;
+        int width = 0;
+        int height = 0;
+        int pixfmt = 0;
+        char overlay[OVERLAY_MAX] = {};
+    };
+
+    void loop();
+    void write_frame(Entry& entry);
+    // starts over at offset 0 of the next segment, its old index is discarded
+    bool next_segment();
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+    // queue and overlay, against capture and render
+    std::mutex mutex;
+    std::condition_variable cv;
+    // ring of queue_depth entries, allocated in start()
+    std::vector<Entry> queue;
+    int queue_head = 0;
+    int queue_count = 0;
+    char overlay[OVERLAY_MAX] = {};
+
+    // writer thread only
+    std::vector<int> segment_fds;
+    FILE* index_fp = nullptr;
+    int segment = -1;
+    size_t segment_offset = 0;
+    bool direct_io = true;
+    uint8_t* bounce = nullptr;
+    size_t bounce_size = 0;
+
+    // with mutex held
+    uint64_t written = 0;
+    uint64_t written_bytes = 0;
+    uint64_t dropped = 0;
+    uint64_t errors = 0;
+    int depth_max = 0;
+    uint64_t write_ns_total = 0;
+    uint64_t write_ns_max = 0;
+    uint64_t last_report_ns = 0;
+};
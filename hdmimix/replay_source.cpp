@@ -0,0 +1,348 @@
+#include "replay_source.hpp"
+
+#include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+
+static uint64_t timespec_to_ns(const timespec& ts) {
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static timespec ns_to_timespec(uint64_t ns) {
+    timespec ts;
+    ts.tv_sec = ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+    return ts;
+}
+
+ReplaySource::ReplaySource(const std::string path, int buf_count, double rate_hz, int width, int height, int pixfmt)
+    : path(path), rate_hz(rate_hz) {
+    refresh_hz = rate_hz;
+    this->buf_count = buf_count;
+    this->width = width;
+    this->height = height;
+    this->pixfmt = pixfmt;
+    open();
+}
+
+size_t ReplaySource::frame_size() const {
+    size_t luma = (size_t)width * height;
+    return pixfmt == V4L2_PIX_FMT_NV24 ? luma * 3 : luma * 3 / 2;
+}
+
+bool ReplaySource::parse_y4m_header(FILE* fp) {
+    char* line = nullptr;
+    size_t cap = 0;
+    ssize_t len = getline(&line, &cap, fp);
+    if (len <= 0 || strncmp(line, "YUV4MPEG2 ", 10) != 0) {
+        free(line);
+        return false;
+    }
+
+    // Y4M defaults to 4:2:0 when C is absent
+    y4m_chroma_div = 2;
+    char* saveptr = nullptr;
+    for (char* tok = strtok_r(line + 10, " \n", &saveptr); tok; tok = strtok_r(nullptr, " \n", &saveptr)) {
+        switch (tok[0]) {
+        case 'W':
+            width = atoi(tok + 1);
+            break;
+        case 'H':
+            height = atoi(tok + 1);
+            break;
+        case 'C':
+            if (strncmp(tok + 1, "420", 3) == 0) {
+                y4m_chroma_div = 2;
+            } else if (strcmp(tok + 1, "444") == 0) {
+                y4m_chroma_div = 1;
+            } else {
+                std::cerr << "Unsupported Y4M colorspace: " << tok + 1 << std::endl;
+                free(line);
+                return false;
+            }
+            break;
+        default:
+            // frame rate, interlacing and aspect are ignored, pacing comes from rate_hz
+            break;
+        }
+    }
+    free(line);
+
+    pixfmt = y4m_chroma_div == 2 ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_NV24;
+    return true;
+}
+
+bool ReplaySource::read_frame(FILE* fp, unsigned char* dst) {
+    if (!is_y4m) {
+        return fread(dst, frame_size(), 1, fp) == 1;
+    }
+
+    // "FRAME" plus optional parameters
+    int c;
+    while ((c = fgetc(fp)) != EOF && c != '\n') {
+    }
+    if (c == EOF) {
+        return false;
+    }
+
+    size_t luma = (size_t)width * height;
+    if (fread(dst, luma, 1, fp) != 1) {
+        return false;
+    }
+
+    // planar U then V, interleave into the semi-planar UV plane
+    int cw = width / y4m_chroma_div;
+    int ch = height / y4m_chroma_div;
+    size_t chroma = (size_t)cw * ch;
+    y4m_line.resize(chroma * 2);
+    if (fread(y4m_line.data(), chroma * 2, 1, fp) != 1) {
+        return false;
+    }
+    const unsigned char* u = y4m_line.data();
+    const unsigned char* v = u + chroma;
+    unsigned char* uv = dst + luma;
+    for (size_t i = 0; i < chroma; i++) {
+        uv[i * 2] = u[i];
+        uv[i * 2 + 1] = v[i];
+    }
+    return true;
+}
+
+bool ReplaySource::open_not_closing_on_failure() {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        std::cerr << "Failed to open replay file " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    is_y4m = parse_y4m_header(fp);
+    if (!is_y4m) {
+        rewind(fp);
+        if (width <= 0 || height <= 0 || (pixfmt != V4L2_PIX_FMT_NV12 && pixfmt != V4L2_PIX_FMT_NV24)) {
+            std::cerr << "Raw replay needs size and format (nv12/nv24)" << std::endl;
+            fclose(fp);
+            return false;
+        }
+    }
+    if (width <= 0 || height <= 0 || width % 2 || height % 2) {
+        std::cerr << "Invalid replay frame size " << width << "x" << height << std::endl;
+        fclose(fp);
+        return false;
+    }
+    if (buf_count < 1 || rate_hz <= 0) {
+        std::cerr << "Invalid replay buffer count or rate" << std::endl;
+        fclose(fp);
+        return false;
+    }
+
+    size_t size = frame_size();
+    buffers.reserve(VIDEO_MAX_FRAME);
+    int loaded = 0;
+    for (int i = 0; i < buf_count; i++) {
+        user_buffers_t buf(i, 1);
+        auto& mem = buf.mem[0];
+        mem.dma_fd = DmaHeapAllocator::shared().alloc(size);
+        if (mem.dma_fd < 0) {
+            fclose(fp);
+            return false;
+        }
+        mem.size = size;
+        buffers.push_back(buf);
+
+        auto view = buffers.back().map_write();
+        if (!view) {
+            fclose(fp);
+            return false;
+        }
+        if (loaded == i && read_frame(fp, view.data())) {
+            loaded++;
+        } else if (loaded > 0) {
+            // short clip, repeat what we have
+            auto src = buffers[i % loaded].map_read();
+            memcpy(view.data(), src.data(), size);
+        }
+    }
+    fclose(fp);
+
+    if (loaded == 0) {
+        std::cerr << "No frames in replay file " << path << std::endl;
+        return false;
+    }
+
+    planes.resize(1);
+    leases.reset(buf_count, nullptr);
+
+    char s_pixfmt[5] = {0};
+    memcpy(s_pixfmt, &pixfmt, 4);
+    std::cout << "Replay video format: " << width << "x" << height << ", pixel format: " << s_pixfmt
+              << ", " << loaded << " frames in " << buf_count << " " << DmaHeapAllocator::backend_name(DmaHeapAllocator::shared().backend())
+              << " buffers @ " << rate_hz << "Hz" << std::endl;
+
+    opened = true;
+    return true;
+}
+
+bool ReplaySource::open() {
+    if (!open_not_closing_on_failure()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ReplaySource::close() {
+    if (!is_open() && buffers.empty()) {
+        return false;
+    }
+    for (auto& buf : buffers) {
+        for (auto& mem : buf.mem) {
+            mem.unmap();
+            if (mem.dma_fd >= 0) {
+                ::close(mem.dma_fd);
+                mem.dma_fd = -1;
+            }
+        }
+    }
+    buffers.clear();
+    opened = false;
+    return true;
+}
+
+int ReplaySource::add_buffers(int count) {
+    if (!is_open() || buf_count + count > VIDEO_MAX_FRAME) {
+        return 0;
+    }
+    size_t size = frame_size();
+    int added = 0;
+    for (int i = 0; i < count; i++) {
+        int index = buf_count + i;
+        user_buffers_t buf(index, 1);
+        auto& mem = buf.mem[0];
+        mem.size = size;
+        mem.dma_fd = DmaHeapAllocator::shared().alloc(size);
+        if (mem.dma_fd < 0) {
+            break;
+        }
+        buffers.push_back(buf);
+        // replays whatever frame sits in the buffer it was cloned from
+        auto view = buffers.back().map_write();
+        auto src = buffers[index % buf_count].map_read();
+        if (!view || !src) {
+            view.reset();
+            buffers.back().mem[0].unmap();
+            ::close(mem.dma_fd);
+            buffers.pop_back();
+            break;
+        }
+        memcpy(view.data(), src.data(), size);
+        added++;
+    }
+    leases.grow(added);
+    buf_count += added;
+    return added;
+}
+
+bool ReplaySource::stream_on(bool& run_loop, on_data_t on_data) {
+    if (is_streaming) {
+        return true;
+    }
+    is_streaming = true;
+
+    const double period_ns = 1e9 / rate_hz;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const uint64_t start_ns = timespec_to_ns(ts);
+    report_ns = start_ns;
+    report_tick = 0;
+    report_missed = missed_frames;
+    report_no_buffer = no_buffer_frames;
+
+    // deadlines are computed from the start, so rounding never accumulates into drift
+    uint64_t tick = 0;
+    int index = 0;
+    while (run_loop && is_streaming && is_open()) {
+        uint64_t deadline_ns = start_ns + (uint64_t)(tick * period_ns);
+        timespec deadline = ns_to_timespec(deadline_ns);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now_ns = timespec_to_ns(ts);
+        report(now_ns, tick);
+        uint64_t late = now_ns > deadline_ns ? (uint64_t)((now_ns - deadline_ns) / period_ns) : 0;
+        if (late > 0) {
+            missed_frames += late;
+            tick += late;
+            deadline_ns = start_ns + (uint64_t)(tick * period_ns);
+        }
+
+        // like the driver, only fill buffers nobody holds. no free buffer means the frame is dropped
+        int free_index = -1;
+        for (int i = 0; i < buf_count && free_index < 0; i++) {
+            int candidate = (index + i) % buf_count;
+            if (leases.is_queued(candidate)) {
+                free_index = candidate;
+            }
+        }
+        if (free_index < 0) {
+            missed_frames++;
+            no_buffer_frames++;
+            tick++;
+            continue;
+        }
+        index = free_index;
+
+        v4l2_buffer vbuf{};
+        vbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        vbuf.memory = V4L2_MEMORY_MMAP;
+        vbuf.index = index;
+        vbuf.field = V4L2_FIELD_NONE;
+        vbuf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_DONE;
+        vbuf.sequence = (uint32_t)tick;
+        vbuf.timestamp.tv_sec = deadline_ns / 1000000000ull;
+        vbuf.timestamp.tv_usec = (deadline_ns % 1000000000ull) / 1000;
+        planes[0] = {};
+        planes[0].bytesused = buffers[index].mem[0].size;
+        planes[0].length = buffers[index].mem[0].size;
+        vbuf.m.planes = planes.data();
+        vbuf.length = planes.size();
+
+        mark_captured(vbuf);
+        leases.mark_dequeued(index);
+        {
+            FrameLease capture_lease = leases.acquire(index, FrameConsumer::CAPTURE);
+            if (on_data) {
+                on_data(buffers[index], vbuf);
+            }
+        }
+
+        index = (index + 1) % buf_count;
+        tick++;
+    }
+    return true;
+}
+
+void ReplaySource::report(uint64_t now_ns, uint64_t tick) {
+    if (report_interval_ms <= 0 || now_ns - report_ns < (uint64_t)report_interval_ms * 1000000ull) {
+        return;
+    }
+    uint64_t ticks = tick - report_tick;
+    uint64_t missed = missed_frames - report_missed;
+    uint64_t no_buffer = no_buffer_frames - report_no_buffer;
+    printf("[REPLAY] %llu of %llu frames missed (%.3f%%): %llu paced late, %llu without a free buffer\n",
+           (unsigned long long)missed, (unsigned long long)ticks, ticks ? 100.0 * missed / ticks : 0.0,
+           (unsigned long long)(missed - no_buffer), (unsigned long long)no_buffer);
+    report_ns = now_ns;
+    report_tick = tick;
+    report_missed = missed_frames;
+    report_no_buffer = no_buffer_frames;
+}
+
+bool ReplaySource::stream_off() {
+    is_streaming = false;
+    return true;
+}
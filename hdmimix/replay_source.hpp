@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "dma_heap.hpp"
+
+/**
+ * Serves NV12/NV24 frames from a file, paced like hdmirx would deliver them.
+ *
+ * Accepts Y4M (C420*, C444, converted to semi-planar on load) or raw NV12/NV24 (size and format must be given).
+ * Up to buf_count frames are preloaded into DMABUF buffers at open and then replayed in a loop,
+ * so the hot path never touches the file or copies pixels.
+ */
+class ReplaySource : public FrameSource {
+public:
+    /**
+     * @param rate_hz  frame rate to emulate, e.g. 60.01 for rk hdmirx at 4K60
+     * @param width/height/pixfmt  required for raw files, ignored for Y4M
+     */
+    ReplaySource(const std::string path, int buf_count, double rate_hz, int width = 0, int height = 0, int pixfmt = 0);
+    ~ReplaySource() {
+        stream_off();
+        close();
+    }
+
+    bool open() override;
+    bool close() override;
+
+    bool stream_on(bool& run_loop, on_data_t on_data) override;
+    bool stream_off() override;
+    // takes effect at the next frame deadline
+    void request_stop() override { is_streaming = false; }
+
+    bool is_open() const override { return opened; }
+
+    int add_buffers(int count) override;
+
+    std::string path;
+    double rate_hz;
+
+    // frames that missed their deadline and were skipped, like a real source would drop them
+    uint64_t missed_frames = 0;
+    // of those, skipped because every buffer was still held
+    uint64_t no_buffer_frames = 0;
+    // [REPLAY] line every interval, 0 for none
+    int report_interval_ms = 5000;
+
+private:
+    bool open_not_closing_on_failure();
+    // pacing of the last interval, late pacing shows up as source drops in [TIMING] too
+    void report(uint64_t now_ns, uint64_t tick);
+
+    bool parse_y4m_header(FILE* fp);
+    bool read_frame(FILE* fp, unsigned char* dst);
+
+    size_t frame_size() const;
+
+    std::vector<v4l2_plane> planes;
+
+    bool is_y4m = false;
+    // y4m chroma subsampling of the file, 2 for 420, 1 for 444
+    int y4m_chroma_div = 2;
+    std::vector<unsigned char> y4m_line;
+
+    bool opened = false;
+    bool is_streaming = false;
+
+    // counters at the last report
+    uint64_t report_ns = 0;
+    uint64_t report_tick = 0;
+    uint64_t report_missed = 0;
+    uint64_t report_no_buffer = 0;
+};
@@ -0,0 +1,514 @@
+#include "software_display.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <linux/dma-buf.h>
+#include <libdrm/drm_fourcc.h>
+#include <algorithm>
+
+#include "dma_heap.hpp"
+#include "frame_timing.hpp"
+
+
+static void close_fence(int& fd) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+static bool fence_signaled(int fd) {
+    pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+static inline uint8_t clamp_u8(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// x * a / 255, rounded
+static inline uint32_t mul_div255(uint32_t x, uint32_t a) {
+    uint32_t t = x * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+SoftwareDisplay::SoftwareDisplay(int width, int height, int pixfmt, double refresh_hz, const std::string render_node)
+    : width(width), height(height), pixfmt(pixfmt), refresh_hz(refresh_hz), render_node(render_node) {
+    if (!open()) {
+        close();
+    }
+}
+
+bool SoftwareDisplay::open() {
+    render_fd = ::open(render_node.c_str(), O_RDWR | O_CLOEXEC);
+    if (render_fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", render_node.c_str(), strerror(errno));
+        return false;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd < 0) {
+        fprintf(stderr, "Failed to create vblank timer: %s\n", strerror(errno));
+        return false;
+    }
+    period_ns = (uint64_t)(1e9 / refresh_hz);
+    epoch_ns = monotonic_ns() + period_ns;
+    sequence = 0;
+    itimerspec its{};
+    its.it_value.tv_sec = epoch_ns / 1000000000ull;
+    its.it_value.tv_nsec = epoch_ns % 1000000000ull;
+    its.it_interval.tv_sec = period_ns / 1000000000ull;
+    its.it_interval.tv_nsec = period_ns % 1000000000ull;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr) < 0) {
+        fprintf(stderr, "Failed to arm vblank timer: %s\n", strerror(errno));
+        return false;
+    }
+
+    printf("Software display %dx%d@%.3fHz, canvas bos from %s\n", width, height, refresh_hz, render_node.c_str());
+    return true;
+}
+
+bool SoftwareDisplay::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_passthrough_fbs();
+    remove_canvas_fbs();
+    close_fence(staged_fence);
+    close_fence(pending_fence);
+    if (timer_fd >= 0) {
+        ::close(timer_fd);
+        timer_fd = -1;
+    }
+    if (render_fd >= 0) {
+        ::close(render_fd);
+        render_fd = -1;
+    }
+    if (dump_fp) {
+        fclose(dump_fp);
+        dump_fp = nullptr;
+    }
+    return true;
+}
+
+uint32_t SoftwareDisplay::add_fb(int dma_fd, uint32_t format, int width, int height, uint32_t pitch, uint32_t uv_offset, uint32_t uv_pitch) {
+    Framebuffer fb;
+    fb.dma_fd = dma_fd;
+    fb.format = format;
+    fb.width = width;
+    fb.height = height;
+    fb.pitch = pitch;
+    fb.uv_offset = uv_offset;
+    fb.uv_pitch = uv_pitch;
+    if (format == DRM_FORMAT_NV12) {
+        fb.size = uv_offset + (size_t)uv_pitch * (height / 2);
+    } else if (format == DRM_FORMAT_NV24) {
+        fb.size = uv_offset + (size_t)uv_pitch * height;
+    } else {
+        fb.size = (size_t)pitch * height;
+    }
+    uint32_t fb_id = next_fb_id++;
+    framebuffers[fb_id] = fb;
+    return fb_id;
+}
+
+void SoftwareDisplay::remove_fb(uint32_t fb_id) {
+    auto it = framebuffers.find(fb_id);
+    if (it == framebuffers.end()) {
+        return;
+    }
+    if (it->second.ptr) {
+        munmap(it->second.ptr, it->second.size);
+    }
+    ::close(it->second.dma_fd);
+    framebuffers.erase(it);
+
+    for (Plane* planes : {staged, pending, current}) {
+        for (int i = 0; i < PLANE_COUNT; i++) {
+            if (planes[i].fb_id == fb_id) {
+                planes[i] = Plane();
+            }
+        }
+    }
+}
+
+void SoftwareDisplay::remove_passthrough_fbs() {
+    for (uint32_t fb_id : passthrough_fb_ids) {
+        if (fb_id) {
+            remove_fb(fb_id);
+        }
+    }
+    passthrough_fb_ids.clear();
+}
+
+void SoftwareDisplay::remove_canvas_fbs() {
+    for (auto& it : canvas_fb_ids) {
+        remove_fb(it.second);
+    }
+    canvas_fb_ids.clear();
+}
+
+int SoftwareDisplay::import_dmabuf(int index, int dmabuf_fd) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index < 0) {
+        return -1;
+    }
+    if (pixfmt != DRM_FORMAT_NV12 && pixfmt != DRM_FORMAT_NV24) {
+        fprintf(stderr, "Software display: unsupported pixel format %.4s\n", (const char*)&pixfmt);
+        return -1;
+    }
+    int fd = dup(dmabuf_fd);
+    if (fd < 0) {
+        fprintf(stderr, "Software display: failed to dup dmabuf: %s\n", strerror(errno));
+        return -1;
+    }
+    if (index >= (int)passthrough_fb_ids.size()) {
+        passthrough_fb_ids.resize(index + 1, 0);
+    }
+    remove_fb(passthrough_fb_ids[index]);
+    // same layout DRMDevice describes to KMS
+    uint32_t uv_pitch = width * (pixfmt == DRM_FORMAT_NV12 ? 1 : 2);
+    passthrough_fb_ids[index] = add_fb(fd, pixfmt, width, height, width, width * height, uv_pitch);
+    return index;
+}
+
+void SoftwareDisplay::release_dmabufs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_passthrough_fbs();
+}
+
+uint32_t SoftwareDisplay::import_canvas_buf_bo(gbm_bo* bo) {
+    if (!bo) {
+        fprintf(stderr, "Invalid GBM buffer object\n");
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = canvas_fb_ids.find(bo);
+    if (it != canvas_fb_ids.end()) {
+        return it->second;
+    }
+    int fd = gbm_bo_get_fd(bo);
+    if (fd < 0) {
+        fprintf(stderr, "Software display: failed to export canvas bo\n");
+        return 0;
+    }
+    uint32_t fb_id = add_fb(fd, DRM_FORMAT_ARGB8888, gbm_bo_get_width(bo), gbm_bo_get_height(bo), gbm_bo_get_stride(bo), 0, 0);
+    canvas_fb_ids[bo] = fb_id;
+    return fb_id;
+}
+
+void SoftwareDisplay::release_canvas_bufs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_canvas_fbs();
+}
+
+bool SoftwareDisplay::set_format(int width, int height, int pixfmt) {
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_passthrough_fbs();
+    remove_canvas_fbs();
+    this->width = width;
+    this->height = height;
+    this->pixfmt = pixfmt;
+    frame.clear();
+    return true;
+}
+
+int SoftwareDisplay::check_geometry(const LayerGeometry& g) const {
+    if ((g.rotation & ~supported_rotations) != 0) {
+        return -EINVAL;
+    }
+    double scale_x = (double)g.dst.w / (g.swaps_axes() ? g.src.h : g.src.w);
+    double scale_y = (double)g.dst.h / (g.swaps_axes() ? g.src.w : g.src.h);
+    if (scale_x < min_scale || scale_x > max_scale || scale_y < min_scale || scale_y > max_scale) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+bool SoftwareDisplay::set_video_geometry(const LayerGeometry& geometry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    video_geometry = geometry;
+    LayerGeometry g = geometry.resolved(width, height, width, height);
+    int ret = check_geometry(g);
+    video_rejected = ret < 0;
+    if (ret < 0) {
+        fprintf(stderr, "Software display: video plane rejected src %dx%d+%d+%d -> dst %dx%d+%d+%d rotation 0x%x\n",
+                g.src.w, g.src.h, g.src.x, g.src.y, g.dst.w, g.dst.h, g.dst.x, g.dst.y, g.rotation);
+        return false;
+    }
+    return true;
+}
+
+void SoftwareDisplay::set_passthrough(int index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index < 0 || index >= (int)passthrough_fb_ids.size() || passthrough_fb_ids[index] == 0) {
+        fprintf(stderr, "No framebuffer for buffer %d\n", index);
+        return;
+    }
+    uint32_t fb_id = passthrough_fb_ids[index];
+    LayerGeometry g = video_geometry.resolved(width, height, width, height);
+    staged[PASSTHROUGH].fb_id = fb_id;
+    staged[PASSTHROUGH].zpos = 10;
+    staged[PASSTHROUGH].alpha = 0xffff;
+    staged[PASSTHROUGH].geometry = g;
+}
+
+void SoftwareDisplay::set_canvas(uint32_t canvas_fb_id, int in_fence_fd) {
+    if (canvas_fb_id == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    close_fence(staged_fence);
+    // the caller closes its fd after the commit, the vblank tick may need it later
+    staged_fence = in_fence_fd >= 0 ? dup(in_fence_fd) : -1;
+    auto it = framebuffers.find(canvas_fb_id);
+    if (it == framebuffers.end()) {
+        return;
+    }
+    // a reduced canvas is scaled up to the screen, as the canvas plane would
+    staged[CANVAS].fb_id = canvas_fb_id;
+    staged[CANVAS].geometry = LayerGeometry().resolved(it->second.width, it->second.height, width, height);
+    staged[CANVAS].zpos = 11;
+    staged[CANVAS].alpha = 0xffff;
+}
+
+int SoftwareDisplay::commit(uint32_t flags, void* user_data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < PLANE_COUNT; i++) {
+        if (staged[i].fb_id && !framebuffers.count(staged[i].fb_id)) {
+            return -ENOENT;
+        }
+    }
+    if (staged[PASSTHROUGH].fb_id && check_geometry(staged[PASSTHROUGH].geometry) < 0) {
+        return -EINVAL;
+    }
+    const Plane* last = has_pending ? pending : current;
+    if (std::equal(staged, staged + PLANE_COUNT, last)) {
+        return 0;
+    }
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+        return 1;
+    }
+    // a blocking commit would wait for the pending one, here it simply replaces it
+    if (has_pending && (flags & DRM_MODE_ATOMIC_NONBLOCK)) {
+        busy++;
+        return -EBUSY;
+    }
+    std::copy(staged, staged + PLANE_COUNT, pending);
+    close_fence(pending_fence);
+    pending_fence = staged_fence;
+    staged_fence = -1;
+    has_pending = true;
+    pending_event = flags & DRM_MODE_PAGE_FLIP_EVENT;
+    pending_user_data = user_data;
+    return 1;
+}
+
+void SoftwareDisplay::handle_events(flip_handler_t on_flip) {
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    bool flipped = false;
+    void* user_data = nullptr;
+    uint64_t flip_ns;
+    unsigned int flip_sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        vblanks += expirations;
+        sequence += expirations;
+        flip_sequence = sequence;
+        // timestamp of the tick, not of when we got to read it
+        flip_ns = epoch_ns + (uint64_t)(sequence - 1) * period_ns;
+        if (has_pending && pending_fence >= 0 && !fence_signaled(pending_fence)) {
+            // the kernel holds a flip until IN_FENCE_FD signals, so does this
+            fence_waits++;
+        } else if (has_pending) {
+            close_fence(pending_fence);
+            std::copy(pending, pending + PLANE_COUNT, current);
+            has_pending = false;
+            latched++;
+            flipped = pending_event;
+            user_data = pending_user_data;
+            if (composite_frames || hash_frames || !dump_path.empty()) {
+                composite();
+                output_frame();
+            }
+        }
+    }
+    if (flipped && on_flip) {
+        on_flip(flip_sequence, flip_ns, user_data);
+    }
+    report();
+}
+
+bool SoftwareDisplay::map_fb(Framebuffer& fb) {
+    if (fb.ptr) {
+        return true;
+    }
+    void* ptr = mmap(nullptr, fb.size, PROT_READ, MAP_SHARED, fb.dma_fd, 0);
+    if (ptr == MAP_FAILED) {
+        fprintf(stderr, "Software display: failed to mmap framebuffer: %s\n", strerror(errno));
+        return false;
+    }
+    fb.ptr = static_cast<uint8_t*>(ptr);
+    return true;
+}
+
+void SoftwareDisplay::composite() {
+    uint64_t start = monotonic_ns();
+    frame.assign((size_t)width * height, 0xff000000);
+
+    int order[PLANE_COUNT];
+    for (int i = 0; i < PLANE_COUNT; i++) {
+        order[i] = i;
+    }
+    std::sort(order, order + PLANE_COUNT, [this](int a, int b) { return current[a].zpos < current[b].zpos; });
+
+    for (int i : order) {
+        const Plane& plane = current[i];
+        auto it = framebuffers.find(plane.fb_id);
+        if (plane.fb_id == 0 || it == framebuffers.end() || plane.alpha == 0) {
+            continue;
+        }
+        Framebuffer& fb = it->second;
+        if (!map_fb(fb)) {
+            continue;
+        }
+        dmabuf_sync(fb.dma_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+        if (fb.format == DRM_FORMAT_NV12 || fb.format == DRM_FORMAT_NV24) {
+            blend_yuv(fb, plane.geometry, plane.alpha);
+        } else {
+            blend_argb(fb, plane.geometry, plane.alpha);
+        }
+        dmabuf_sync(fb.dma_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    }
+
+    uint64_t took = monotonic_ns() - start;
+    composited++;
+    composite_ns_total += took;
+    composite_ns_max = std::max(composite_ns_max, took);
+}
+
+// BT.709 limited range, what hdmirx delivers for HD and UHD
+void SoftwareDisplay::blend_yuv(const Framebuffer& fb, const LayerGeometry& g, uint16_t alpha) {
+    uint32_t a = alpha >> 8;
+    bool subsampled = fb.format == DRM_FORMAT_NV12;
+    sampler.build(g);
+    // dst clipped to the screen
+    int x0 = std::max(g.dst.x, 0);
+    int y0 = std::max(g.dst.y, 0);
+    int x1 = std::min(g.dst.x + g.dst.w, width);
+    int y1 = std::min(g.dst.y + g.dst.h, height);
+    for (int y = y0; y < y1; y++) {
+        uint32_t* out = frame.data() + (size_t)y * width;
+        int row = y - g.dst.y;
+        for (int x = x0; x < x1; x++) {
+            int col = x - g.dst.x;
+            int sx = std::min(sampler.src_x(col, row), fb.width - 1);
+            int sy = std::min(sampler.src_y(col, row), fb.height - 1);
+            const uint8_t* luma = fb.ptr + (size_t)sy * fb.pitch;
+            const uint8_t* chroma = fb.ptr + fb.uv_offset + (size_t)(subsampled ? sy / 2 : sy) * fb.uv_pitch;
+            const uint8_t* uv = chroma + (subsampled ? (sx & ~1) : sx * 2);
+            int c = 298 * (luma[sx] - 16);
+            int u = uv[0] - 128;
+            int v = uv[1] - 128;
+            uint32_t r = clamp_u8((c + 459 * v + 128) >> 8);
+            uint32_t g = clamp_u8((c - 55 * u - 136 * v + 128) >> 8);
+            uint32_t b = clamp_u8((c + 541 * u + 128) >> 8);
+            if (a != 255) {
+                uint32_t dst = out[x];
+                r = mul_div255(r, a) + mul_div255((dst >> 16) & 0xff, 255 - a);
+                g = mul_div255(g, a) + mul_div255((dst >> 8) & 0xff, 255 - a);
+                b = mul_div255(b, a) + mul_div255(dst & 0xff, 255 - a);
+            }
+            out[x] = 0xff000000 | r << 16 | g << 8 | b;
+        }
+    }
+}
+
+// premultiplied ARGB8888 over what is below, scaled by plane alpha
+void SoftwareDisplay::blend_argb(const Framebuffer& fb, const LayerGeometry& g, uint16_t alpha) {
+    uint32_t pa = alpha >> 8;
+    bool scaled = g.src.w != g.dst.w || g.src.h != g.dst.h;
+    if (scaled) {
+        sampler.build(g);
+    }
+    int w = std::min(g.dst.w, width);
+    int h = std::min(g.dst.h, height);
+    for (int y = 0; y < h; y++) {
+        int sy = std::min(scaled ? sampler.src_y(0, y) : y, fb.height - 1);
+        const uint32_t* src = reinterpret_cast<const uint32_t*>(fb.ptr + (size_t)sy * fb.pitch);
+        uint32_t* out = frame.data() + (size_t)y * width;
+        for (int x = 0; x < w; x++) {
+            uint32_t s = src[std::min(scaled ? sampler.src_x(x, y) : x, fb.width - 1)];
+            if (s == 0) {
+                // fully transparent, most of the UI
+                continue;
+            }
+            uint32_t sa = mul_div255(s >> 24, pa);
+            if (sa == 255) {
+                out[x] = s | 0xff000000;
+                continue;
+            }
+            uint32_t d = out[x];
+            uint32_t r = mul_div255((s >> 16) & 0xff, pa) + mul_div255((d >> 16) & 0xff, 255 - sa);
+            uint32_t g = mul_div255((s >> 8) & 0xff, pa) + mul_div255((d >> 8) & 0xff, 255 - sa);
+            uint32_t b = mul_div255(s & 0xff, pa) + mul_div255(d & 0xff, 255 - sa);
+            out[x] = 0xff000000 | std::min(r, 255u) << 16 | std::min(g, 255u) << 8 | std::min(b, 255u);
+        }
+    }
+}
+
+void SoftwareDisplay::output_frame() {
+    if (hash_frames) {
+        // FNV-1a
+        uint64_t hash = 0xcbf29ce484222325ull;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(frame.data());
+        for (size_t i = 0; i < frame.size() * 4; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        frame_hash = hash;
+    }
+    if (!dump_path.empty()) {
+        if (!dump_fp) {
+            dump_fp = fopen(dump_path.c_str(), "wb");
+            if (!dump_fp) {
+                fprintf(stderr, "Failed to open %s: %s\n", dump_path.c_str(), strerror(errno));
+                dump_path.clear();
+                return;
+            }
+        }
+        fwrite(frame.data(), 4, frame.size(), dump_fp);
+    }
+}
+
+void SoftwareDisplay::report(int interval_ms) {
+    uint64_t now = monotonic_ns();
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    last_report_ns = now;
+    std::lock_guard<std::mutex> lock(mutex);
+    printf("[FAKEKMS] %llu vblanks, %llu latched, %llu busy, %llu fence waits", (unsigned long long)vblanks, (unsigned long long)latched,
+           (unsigned long long)busy, (unsigned long long)fence_waits);
+    if (composited) {
+        printf(", composite avg %.2fms max %.2fms", composite_ns_total / 1e6 / composited, composite_ns_max / 1e6);
+    }
+    if (hash_frames) {
+        printf(", last hash %016llx", (unsigned long long)frame_hash);
+    }
+    printf("\n");
+    vblanks = 0;
+    latched = 0;
+    busy = 0;
+    fence_waits = 0;
+    composited = 0;
+    composite_ns_total = 0;
+    composite_ns_max = 0;
+}
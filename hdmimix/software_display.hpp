@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include "display_backend.hpp"
+
+/**
+ * KMS emulated in memory, to run and profile the presentation path without display hardware.
+ *
+ * Same two planes as the DRM setup: passthrough (NV12/NV24, zpos 10) under canvas (ARGB8888, zpos 11,
+ * premultiplied pixel alpha times plane alpha, a reduced canvas scaled to the screen). The passthrough plane crops, scales (nearest) and rotates
+ * within limits like a hardware scaler, commits outside them fail with -EINVAL. A timerfd ticks at the refresh rate and latches the last
+ * commit like a nonblocking atomic commit; committing again before that returns -EBUSY.
+ * Latched frames can be composited into `frame`, hashed and appended to a raw BGRA file.
+ *
+ * Thread-safe, the capture buffers are mapped read-only when composited.
+ */
+class SoftwareDisplay : public DisplayBackend {
+public:
+    /**
+     * render_node: where the renderer allocates canvas bos, no KMS needed
+     */
+    SoftwareDisplay(int width, int height, int pixfmt, double refresh_hz = 60.0, const std::string render_node = "/dev/dri/renderD128");
+    ~SoftwareDisplay() override { close(); }
+
+    bool open();
+    bool close() override;
+
+    int import_dmabuf(int index, int dmabuf_fd) override;
+    void release_dmabufs() override;
+    uint32_t import_canvas_buf_bo(gbm_bo* bo) override;
+    void release_canvas_bufs() override;
+    bool set_format(int width, int height, int pixfmt) override;
+    // the vblank timer keeps the rate it was created with
+    void set_refresh_hint(double hz) override {}
+    double output_refresh_hz() const override { return refresh_hz; }
+    bool vrr_active() const override { return false; }
+
+    bool set_video_geometry(const LayerGeometry& geometry) override;
+    // every format it imports is composited in software
+    bool video_on_plane() const override { return !video_rejected; }
+    void set_passthrough(int index) override;
+    void set_canvas(uint32_t canvas_fb_id, int in_fence_fd) override;
+    int commit(uint32_t flags, void* user_data = nullptr) override;
+    // a sync_file needs the kernel, canvases here retire on the flip event
+    int take_out_fence() override { return -1; }
+
+    // the vblank timerfd
+    int event_fd() const override { return timer_fd; }
+    void handle_events(flip_handler_t on_flip) override;
+    int gbm_fd() const override { return render_fd; }
+
+    // prints vblanks, latched commits and compositing cost, at most every interval_ms
+    void report(int interval_ms = 5000);
+
+    int width;
+    int height;
+    int pixfmt;
+    double refresh_hz;
+    std::string render_node;
+
+    // passthrough plane scaler limits, dst/src per axis
+    double min_scale = 0.25;
+    double max_scale = 8.0;
+    uint32_t supported_rotations = DRM_MODE_ROTATE_0 | DRM_MODE_ROTATE_180 | DRM_MODE_REFLECT_X | DRM_MODE_REFLECT_Y;
+
+    // composite every latched frame, implied by hash_frames and dump_path
+    bool composite_frames = false;
+    // FNV-1a over each composited frame, the last one is in frame_hash
+    bool hash_frames = false;
+    // composited frames are appended here, ffplay -f rawvideo -pixel_format bgra -video_size WxH
+    std::string dump_path;
+
+    // last composited frame, ARGB8888 (BGRA in memory)
+    std::vector<uint32_t> frame;
+    uint64_t frame_hash = 0;
+
+    uint64_t vblanks = 0;
+    uint64_t latched = 0;
+    uint64_t busy = 0;
+    // vblanks a pending commit missed because the canvas fence had not signaled
+    uint64_t fence_waits = 0;
+
+private:
+    struct Framebuffer {
+        int dma_fd = -1;
+        uint8_t* ptr = nullptr;
+        size_t size = 0;
+        uint32_t format = 0;
+        int width = 0;
+        int height = 0;
+        uint32_t pitch = 0;
+        // second plane of NV12/NV24
+        uint32_t uv_offset = 0;
+        uint32_t uv_pitch = 0;
+    };
+    struct Plane {
+        uint32_t fb_id = 0;
+        uint32_t zpos = 0;
+        uint16_t alpha = 0xffff;
+        // resolved, the canvas fb scaled to full screen
+        LayerGeometry geometry;
+        bool operator==(const Plane& other) const {
+            return fb_id == other.fb_id && zpos == other.zpos && alpha == other.alpha && geometry == other.geometry;
+        }
+    };
+    enum { PASSTHROUGH, CANVAS, PLANE_COUNT };
+
+    // all below with mutex held
+    uint32_t add_fb(int dma_fd, uint32_t format, int width, int height, uint32_t pitch, uint32_t uv_offset, uint32_t uv_pitch);
+    // like drmModeRmFB: a plane showing it is turned off
+    void remove_fb(uint32_t fb_id);
+    void remove_passthrough_fbs();
+    void remove_canvas_fbs();
+    bool map_fb(Framebuffer& fb);
+    // what the kernel checks in atomic_check: -EINVAL for rotations and scale factors the plane cannot do
+    int check_geometry(const LayerGeometry& g) const;
+    void composite();
+    void blend_yuv(const Framebuffer& fb, const LayerGeometry& g, uint16_t alpha);
+    void blend_argb(const Framebuffer& fb, const LayerGeometry& g, uint16_t alpha);
+    void output_frame();
+
+    std::mutex mutex;
+    int timer_fd = -1;
+    int render_fd = -1;
+    uint64_t period_ns = 0;
+    uint64_t epoch_ns = 0;
+    unsigned int sequence = 0;
+
+    std::map<uint32_t, Framebuffer> framebuffers;
+    uint32_t next_fb_id = 1;
+    // by buffer index, 0 where nothing is imported
+    std::vector<uint32_t> passthrough_fb_ids;
+    LayerGeometry video_geometry;
+    // check_geometry failed for video_geometry, the renderer composes the video
+    bool video_rejected = false;
+    LayerSampler sampler;
+    std::map<gbm_bo*, uint32_t> canvas_fb_ids;
+
+    // set_* -> staged, commit() -> pending, vblank -> current
+    Plane staged[PLANE_COUNT];
+    Plane pending[PLANE_COUNT];
+    Plane current[PLANE_COUNT];
+    bool has_pending = false;
+    bool pending_event = false;
+    void* pending_user_data = nullptr;
+    // dup of the canvas in-fence, the pending commit latches only once it signaled
+    int staged_fence = -1;
+    int pending_fence = -1;
+
+    FILE* dump_fp = nullptr;
+    uint64_t composite_ns_total = 0;
+    uint64_t composite_ns_max = 0;
+    uint64_t composited = 0;
+    uint64_t last_report_ns = 0;
+};
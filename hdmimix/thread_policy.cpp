@@ -0,0 +1,196 @@
+#include "thread_policy.hpp"
+#include "frame_timing.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+
+static const char* sched_policy_name(int policy) {
+    switch (policy) {
+    case SCHED_FIFO:
+        return "fifo";
+    case SCHED_RR:
+        return "rr";
+    default:
+        return "other";
+    }
+}
+
+std::string ThreadPolicy::describe() const {
+    if (!enabled) {
+        return "default";
+    }
+    std::string s = std::string(sched_policy_name(sched_policy)) + ":" + std::to_string(priority);
+    if (!cpus.empty()) {
+        s += " cpus";
+        for (int cpu : cpus) {
+            s += " " + std::to_string(cpu);
+        }
+    }
+    return s;
+}
+
+ThreadPolicies::ThreadPolicies() {
+    // capture dequeues and hands frames on: real-time on big cores
+    parse("capture=fifo:50@4-5");
+    // commits once per vblank and retires buffers on the flip event, must not miss a refresh
+    parse("present=fifo:51@4-5");
+    // imgui + yolo, heavy but allowed to slip a frame
+    parse("render=other:-10@6-7");
+    // spawned from capture, must not inherit its real-time class
+    parse("snapshot=other@0-3");
+    // copies frames and waits on the disk, off the big cores
+    parse("record=other@0-3");
+}
+
+// "4-5,7" -> {4, 5, 7}
+static bool parse_cpus(const char* s, std::vector<int>& cpus) {
+    cpus.clear();
+    while (*s) {
+        char* end = nullptr;
+        long first = strtol(s, &end, 10);
+        if (end == s) {
+            return false;
+        }
+        long last = first;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first) {
+                return false;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ThreadPolicies::parse(const char* spec) {
+    const char* eq = strchr(spec, '=');
+    if (!eq || eq == spec) {
+        fprintf(stderr, "Invalid thread policy %s\n", spec);
+        return false;
+    }
+    std::string name(spec, eq - spec);
+    std::string rest(eq + 1);
+
+    ThreadPolicy policy;
+    if (rest == "none") {
+        policies[name] = policy;
+        return true;
+    }
+    std::string cpus;
+    size_t at = rest.find('@');
+    if (at != std::string::npos) {
+        cpus = rest.substr(at + 1);
+        rest = rest.substr(0, at);
+    }
+    std::string priority;
+    size_t colon = rest.find(':');
+    if (colon != std::string::npos) {
+        priority = rest.substr(colon + 1);
+        rest = rest.substr(0, colon);
+    }
+
+    if (rest == "fifo") {
+        policy.sched_policy = SCHED_FIFO;
+    } else if (rest == "rr") {
+        policy.sched_policy = SCHED_RR;
+    } else if (rest == "other") {
+        policy.sched_policy = SCHED_OTHER;
+    } else {
+        fprintf(stderr, "Unknown scheduling class %s in %s\n", rest.c_str(), spec);
+        return false;
+    }
+    policy.priority = priority.empty() ? (policy.sched_policy == SCHED_OTHER ? 0 : 1) : atoi(priority.c_str());
+    if (!cpus.empty() && !parse_cpus(cpus.c_str(), policy.cpus)) {
+        fprintf(stderr, "Invalid cpu list %s in %s\n", cpus.c_str(), spec);
+        return false;
+    }
+    policy.enabled = true;
+    policies[name] = policy;
+    return true;
+}
+
+bool ThreadPolicies::apply(const std::string& name) const {
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+    auto it = policies.find(name);
+    if (it == policies.end() || !it->second.enabled) {
+        return true;
+    }
+    const ThreadPolicy& policy = it->second;
+    bool ok = true;
+
+    if (!policy.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : policy.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            fprintf(stderr, "[THREAD] %s: failed to set cpu affinity: %s\n", name.c_str(), strerror(errno));
+            ok = false;
+        }
+    }
+
+    sched_param param{};
+    if (policy.sched_policy != SCHED_OTHER) {
+        param.sched_priority = policy.priority;
+    }
+    if (int err = pthread_setschedparam(pthread_self(), policy.sched_policy, &param); err) {
+        fprintf(stderr, "[THREAD] %s: failed to set %s scheduling: %s\n", name.c_str(), policy.describe().c_str(), strerror(err));
+        ok = false;
+    }
+    if (policy.sched_policy == SCHED_OTHER && policy.priority != 0) {
+        // nice is per thread on Linux
+        if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), policy.priority) < 0) {
+            fprintf(stderr, "[THREAD] %s: failed to set nice %d: %s\n", name.c_str(), policy.priority, strerror(errno));
+            ok = false;
+        }
+    }
+    if (ok) {
+        printf("[THREAD] %s: %s\n", name.c_str(), policy.describe().c_str());
+    }
+    return ok;
+}
+
+bool ThreadPolicies::lock_memory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        fprintf(stderr, "[THREAD] mlockall failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void WakeupMonitor::record(uint64_t event_ns) {
+    uint64_t now = monotonic_ns();
+    if (event_ns == 0 || event_ns > now) {
+        return;
+    }
+    latency.add(now - event_ns);
+    if (now - last_report_ns < (uint64_t)interval_ms * 1000000ull) {
+        return;
+    }
+    last_report_ns = now;
+    printf("[THREAD] %s wakeup p50 %.3fms p99 %.3fms max %.3fms (cpu %d)\n", name.c_str(),
+           latency.percentile(0.5), latency.percentile(0.99), latency.max_ns / 1e6, sched_getcpu());
+    latency.clear();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "frame_timing.hpp"
+
+/**
+ * Scheduling class, priority and CPU set for one named pipeline thread.
+ * RK3588 has A55 cores at 0-3 and A76 cores at 4-7.
+ */
+struct ThreadPolicy {
+    bool enabled = false;
+    // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int sched_policy = 0;
+    // rt priority for FIFO/RR, nice value for OTHER
+    int priority = 0;
+    // empty means no pinning
+    std::vector<int> cpus;
+
+    std::string describe() const;
+};
+
+/**
+ * Policies by thread name (capture, render, ...), applied by each thread to itself when it starts.
+ * Failing to apply (no CAP_SYS_NICE) is logged, the thread keeps running with what it had.
+ */
+class ThreadPolicies {
+public:
+    ThreadPolicies();
+
+    /**
+     * "name=policy[:priority][@cpus]", e.g. "capture=fifo:50@4-5", "render=other:-10@6-7", "render=none"
+     */
+    bool parse(const char* spec);
+
+    // to the calling thread, also sets its name
+    bool apply(const std::string& name) const;
+
+    // mlockall(MCL_CURRENT | MCL_FUTURE), no page faults on the frame path
+    static bool lock_memory();
+
+    std::map<std::string, ThreadPolicy> policies;
+};
+
+/**
+ * How late a thread runs after the event that should have woken it, to verify a policy took effect.
+ * Owned and used by a single thread.
+ */
+class WakeupMonitor {
+public:
+    WakeupMonitor(std::string name, int interval_ms = 5000) : name(name), interval_ms(interval_ms) {}
+
+    // event_ns: CLOCK_MONOTONIC time of the wakeup source (frame done, signal sent)
+    void record(uint64_t event_ns);
+
+    std::string name;
+    int interval_ms;
+    LatencyHistogram latency{0.01, 1000};
+
+private:
+    uint64_t last_report_ns = 0;
+};
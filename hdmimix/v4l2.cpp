@@ -1,4 +1,6 @@
 #include "v4l2.hpp"
+#include "dma_heap.hpp"
+#include "frame_timing.hpp"
 
 #include <iostream>
 #include <fcntl.h>
@@ -6,6 +8,10 @@
 #include <memory.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <libv4l2.h>
 #include <linux/videodev2.h>
 #include <thread>
@@ -15,22 +21,90 @@
 #include <string>
 
 
-bool V4l2Device::open_not_closing_on_failure() {
-    v4l2_fd = ::open(device.c_str(), O_RDWR);
-    if (v4l2_fd < 0) {
-        std::cerr << "Failed to open video device" << std::endl;
+bool V4l2Device::setup_buffer(int index) {
+    v4l2_buffer vbuf{};
+    std::vector<v4l2_plane> planes(n_planes);
+    vbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    vbuf.memory = memory;
+    vbuf.index = index;
+    // for mplane
+    vbuf.length = n_planes;
+    vbuf.m.planes = planes.data();
+    if (ioctl(v4l2_fd, VIDIOC_QUERYBUF, &vbuf) < 0) {
+        std::cerr << "Failed to query buffer" << std::endl;
         return false;
     }
-    v4l2_capability cap{};
-    if (ioctl(v4l2_fd, VIDIOC_QUERYCAP, &cap) < 0) {
-        std::cerr << "Failed to query video capabilities" << std::endl;
+
+    bool buf_err = false;
+    user_buffers_t buf(index, n_planes);
+    for (int j = 0; j < n_planes && !buf_err; ++j) {
+        auto &mem = buf.mem[j];
+        auto &plane = vbuf.m.planes[j];
+
+        if (memory == V4L2_MEMORY_DMABUF) {
+            // the driver only imports, memory comes from the heap every other stage shares.
+            // a udmabuf or memfd stand-in is not contiguous, hdmirx would fail on it much later
+            mem.size = plane_sizes[j];
+            mem.dma_fd = DmaHeapAllocator::shared().alloc_heap(mem.size);
+            if (mem.dma_fd < 0) {
+                printf("Failed to allocate buffer %d, plane %d from dma-heap %s\n", index, j, DmaHeapAllocator::shared().heap.c_str());
+                buf_err = true;
+                break;
+            }
+            plane.m.fd = mem.dma_fd;
+            plane.length = mem.size;
+            continue;
+        }
+
+        // length
+        mem.size = plane.length;
+
+        // no mmap here, display and inference only use the fd. CPU consumers map it with map_read/map_write
+
+        // export DMABUF fd for each plane
+        struct v4l2_exportbuffer expbuf{};
+        expbuf.type = vbuf.type;
+        expbuf.index = index;
+        expbuf.plane = j;
+        if (ioctl(v4l2_fd, VIDIOC_EXPBUF, &expbuf) == -1) {
+            printf("Failed to export buffer %d, plane %d: %s\n", index, j, strerror(errno));
+            mem.dma_fd = -1;
+            buf_err = true;
+        } else {
+            mem.dma_fd = expbuf.fd;
+        }
+    }
+    buffers.push_back(buf);
+    qbuf_planes.push_back(std::vector<v4l2_plane>(n_planes));
+
+    // qbuf
+    if (buf_err) {
         return false;
     }
-    is_mplane = (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) != 0;
-    if (!is_mplane) {
-        std::cerr << "This tool only supports multi-plane (mplane) devices" << std::endl;
+    if (ioctl(v4l2_fd, VIDIOC_QBUF, &vbuf) < 0) {
+        std::cerr << "Failed to queue buffer" << std::endl;
+        buf_err = true;
+    }
+    return !buf_err;
+}
+
+bool V4l2Device::query_format() {
+    // hdmirx needs the detected timings applied before G_FMT reflects a new source.
+    // devices without DV timings just fail these
+    v4l2_dv_timings timings{};
+    refresh_hz = 0;
+    if (ioctl(v4l2_fd, VIDIOC_QUERY_DV_TIMINGS, &timings) == 0) {
+        ioctl(v4l2_fd, VIDIOC_S_DV_TIMINGS, &timings);
+        // exact rate incl. fractional ones like 60.01 or 59.94, the display picks its mode by it
+        uint64_t frame_pixels = (uint64_t)V4L2_DV_BT_FRAME_WIDTH(&timings.bt) * V4L2_DV_BT_FRAME_HEIGHT(&timings.bt);
+        if (frame_pixels) {
+            refresh_hz = (double)timings.bt.pixelclock / frame_pixels;
+        }
+    } else if (errno == ENOLINK || errno == ENOLCK) {
+        std::cerr << "No input signal" << std::endl;
         return false;
     }
+
     v4l2_format fmt{};
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     if (ioctl(v4l2_fd, VIDIOC_G_FMT, &fmt) < 0) {
@@ -39,7 +113,7 @@ bool V4l2Device::open_not_closing_on_failure() {
     }
     
     char s_pixfmt[5] = {0};
-    memcmp(s_pixfmt, &fmt.fmt.pix_mp.pixelformat, 4);
+    memcpy(s_pixfmt, &fmt.fmt.pix_mp.pixelformat, 4);
     s_pixfmt[4] = '\0';
     std::cout << "Input video format: " << fmt.fmt.pix_mp.width << "x" 
               << fmt.fmt.pix_mp.height << ", pixel format: " << s_pixfmt << std::endl;
@@ -47,10 +121,20 @@ bool V4l2Device::open_not_closing_on_failure() {
     pixfmt = fmt.fmt.pix_mp.pixelformat;
     width = fmt.fmt.pix_mp.width;
     height = fmt.fmt.pix_mp.height;
-    // request mmap buffers, then map them to userspace and export DMABUF fds
+    n_planes = fmt.fmt.pix_mp.num_planes;
+    plane_sizes.resize(n_planes);
+    for (int i = 0; i < n_planes; i++) {
+        plane_sizes[i] = fmt.fmt.pix_mp.plane_fmt[i].sizeimage;
+    }
+    return true;
+}
+
+bool V4l2Device::alloc_buffers() {
+    // request mmap buffers and export DMABUF fds.
+    // DMABUF mode only reserves slots here, setup_buffer allocates the memory
     v4l2_requestbuffers reqbuf{};
     reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    reqbuf.memory = V4L2_MEMORY_MMAP;
+    reqbuf.memory = memory;
     reqbuf.count = buf_count;
 
     if (ioctl(v4l2_fd, VIDIOC_REQBUFS, &reqbuf) < 0) {
@@ -64,66 +148,85 @@ bool V4l2Device::open_not_closing_on_failure() {
     }
     buf_count = reqbuf.count;   // driver can have a minimum value defined.
 
-    int n_planes = fmt.fmt.pix_mp.num_planes;
+    dq_planes.assign(n_planes, v4l2_plane{});
+    // buffers can be added while other threads index into these, never let them reallocate
+    buffers.reserve(VIDEO_MAX_FRAME);
+    qbuf_planes.reserve(VIDEO_MAX_FRAME);
 
-    bool buf_err = false;
-    for (int i=0; i<buf_count && !buf_err; i++) {
-        v4l2_buffer vbuf{};
-        std::vector<v4l2_plane> planes(n_planes);
-        vbuf.type = reqbuf.type;
-        vbuf.index = i;
-        // for mplane
-        vbuf.length = n_planes;
-        vbuf.m.planes = planes.data();
-        if (ioctl(v4l2_fd, VIDIOC_QUERYBUF, &vbuf) < 0) {
-            std::cerr << "Failed to query buffer" << std::endl;
+    for (int i=0; i<buf_count; i++) {
+        if (!setup_buffer(i)) {
             return false;
         }
+    }
 
-        user_buffers_t buf(i, n_planes);
-        for (int j = 0; j < n_planes && !buf_err; ++j) {
-            auto &mem = buf.mem[j];
+    leases.reset(buf_count, [this](int index) { requeue(index); });
+    return true;
+}
 
-            // length
-            auto &plane = vbuf.m.planes[j];
-            mem.size = plane.length;
+void V4l2Device::free_buffers() {
+  for (auto &buf : buffers) {
+    for (auto &mem : buf.mem) {
+      mem.unmap();
+      if (mem.dma_fd >= 0) {
+        ::close(mem.dma_fd);
+        mem.dma_fd = -1;
+      }
+    }
+  }
+  buffers.clear();
+  qbuf_planes.clear();
+}
 
-            // mmap
-            void* userptr = ::mmap(nullptr, plane.length, PROT_READ | PROT_WRITE, MAP_SHARED, v4l2_fd, plane.m.mem_offset);
-            if (userptr == MAP_FAILED) {
-                printf("Failed to mmap buffer %d, plane %d, offset: %d: %s\n", i, j, plane.m.mem_offset, strerror(errno));
-                mem.ptr = nullptr;
-                buf_err = true;
-            } else {
-                mem.ptr = static_cast<unsigned char*>(userptr);
-            }
+bool V4l2Device::open_not_closing_on_failure() {
+    // non-blocking, frames are waited for with epoll in stream_on
+    v4l2_fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (v4l2_fd < 0) {
+        std::cerr << "Failed to open video device" << std::endl;
+        return false;
+    }
+    v4l2_capability cap{};
+    if (ioctl(v4l2_fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        std::cerr << "Failed to query video capabilities" << std::endl;
+        return false;
+    }
+    is_mplane = (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) != 0;
+    if (!is_mplane) {
+        std::cerr << "This tool only supports multi-plane (mplane) devices" << std::endl;
+        return false;
+    }
+    if (!query_format() || !alloc_buffers()) {
+        return false;
+    }
 
-            // export DMABUF fd for each plane
-            struct v4l2_exportbuffer expbuf{};
-            expbuf.type = reqbuf.type;
-            expbuf.index = i;
-            expbuf.plane = j;
-            if (ioctl(v4l2_fd, VIDIOC_EXPBUF, &expbuf) == -1) {
-                printf("Failed to export buffer %d, plane %d: %s\n", i, j, strerror(errno));
-                mem.dma_fd = -1;
-                buf_err = true;
-            } else {
-                mem.dma_fd = expbuf.fd;
-            }
-        }
-        buffers.push_back(buf);
+    // resolution and format changes are handled in place, see restart_capture
+    v4l2_event_subscription sub{};
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    if (ioctl(v4l2_fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) {
+        std::cerr << "Failed to subscribe to source change events: " << strerror(errno) << std::endl;
+    }
 
-        // qbuf
-        if (ioctl(v4l2_fd, VIDIOC_QBUF, &vbuf) < 0) {
-            std::cerr << "Failed to queue buffer" << std::endl;
-            buf_err = true;
-        }
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    no_signal_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (stop_fd < 0 || no_signal_fd < 0 || epoll_fd < 0) {
+        std::cerr << "Failed to create capture event fds: " << strerror(errno) << std::endl;
+        return false;
     }
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLPRI;
+    ev.data.fd = v4l2_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, v4l2_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = stop_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+    ev.data.fd = no_signal_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, no_signal_fd, &ev);
 
     return true;
 }
 
-V4l2Device::V4l2Device(const std::string device, int buf_count) : device(device), buf_count(buf_count), v4l2_fd(-1), is_mplane(false), is_streaming(false) {
+V4l2Device::V4l2Device(const std::string device, int buf_count, uint32_t memory) : device(device), v4l2_fd(-1), is_mplane(false), memory(memory), is_streaming(false) {
+    this->buf_count = buf_count;
     open();
 };
 
@@ -140,16 +243,11 @@ bool V4l2Device::close() {
   if (!is_open()) {
     return false;
   }
-  for (auto &buf : buffers) {
-    for (auto &mem : buf.mem) {
-      if (mem.dma_fd >= 0) {
-        ::close(mem.dma_fd);
-        mem.dma_fd = -1;
-      }
-      if (mem.ptr) {
-        ::munmap(mem.ptr, mem.size);
-        mem.ptr = nullptr;
-      }
+  free_buffers();
+  for (int* fd : {&epoll_fd, &stop_fd, &no_signal_fd}) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
     }
   }
   ::close(v4l2_fd);
@@ -157,7 +255,188 @@ bool V4l2Device::close() {
   return true;
 }
 
-bool V4l2Device::stream_on(bool& run_loop, std::function<void(user_buffers_t&, v4l2_buffer&)> on_data) { 
+bool V4l2Device::arm_no_signal_timer() {
+    itimerspec its{};
+    its.it_value.tv_sec = no_signal_timeout_ms / 1000;
+    its.it_value.tv_nsec = (no_signal_timeout_ms % 1000) * 1000000L;
+    // keep firing while the signal stays away, so a stuck source is still reported
+    its.it_interval = its.it_value;
+    return timerfd_settime(no_signal_fd, 0, &its, nullptr) == 0;
+}
+
+bool V4l2Device::handle_video_ready(const on_data_t& on_data) {
+    // drain everything the driver has ready, one epoll wakeup may cover more than one frame
+    while (true) {
+        v4l2_buffer vbuf{};
+        vbuf.type = is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        vbuf.memory = memory;
+        memset(dq_planes.data(), 0, dq_planes.size() * sizeof(v4l2_plane));
+        vbuf.m.planes = dq_planes.data();
+        vbuf.length = dq_planes.size();
+        if (ioctl(v4l2_fd, VIDIOC_DQBUF, &vbuf)) {
+            if (errno == EAGAIN) {
+                return true;
+            }
+            if (!is_streaming) {
+                return false;
+            }
+            std::cerr << "Failed to dequeue buffer: " << strerror(errno) << std::endl;
+            return errno != ENODEV;
+        }
+
+        arm_no_signal_timer();
+        if (signal_lost) {
+            signal_lost = false;
+            std::cout << "Input signal back" << std::endl;
+        }
+        if (source_change_ns) {
+            last_source_change_ms = (monotonic_ns() - source_change_ns) / 1e6;
+            source_change_ns = 0;
+            printf("[SOURCE] first frame %.1fms after source change\n", last_source_change_ms);
+        }
+
+        mark_captured(vbuf);
+        leases.mark_dequeued(vbuf.index);
+        // the buffer is queued back once this and every lease taken in on_data are dropped
+        FrameLease capture_lease = leases.acquire(vbuf.index, FrameConsumer::CAPTURE);
+        if (on_data) {
+            on_data(buffers[vbuf.index], vbuf);
+        }
+    }
+}
+
+void V4l2Device::requeue(int index) {
+    if (!is_open()) {
+        return;
+    }
+    auto& planes = qbuf_planes[index];
+    v4l2_buffer vbuf{};
+    vbuf.type = is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vbuf.memory = memory;
+    vbuf.index = index;
+    vbuf.m.planes = planes.data();
+    vbuf.length = planes.size();
+    for (size_t i = 0; i < planes.size(); i++) {
+        planes[i].length = buffers[index].mem[i].size;
+        if (memory == V4L2_MEMORY_DMABUF) {
+            planes[i].m.fd = buffers[index].mem[i].dma_fd;
+        }
+    }
+    if (ioctl(v4l2_fd, VIDIOC_QBUF, &vbuf)) {
+        std::cerr << "Failed to queue buffer: " << strerror(errno) << std::endl;
+    }
+}
+
+int V4l2Device::add_buffers(int count) {
+    if (!is_open() || buf_count + count > VIDEO_MAX_FRAME) {
+        return 0;
+    }
+    v4l2_create_buffers create{};
+    create.count = count;
+    create.memory = memory;
+    create.format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (ioctl(v4l2_fd, VIDIOC_G_FMT, &create.format) < 0) {
+        std::cerr << "Failed to get video format" << std::endl;
+        return 0;
+    }
+    // allowed while streaming, unlike REQBUFS
+    if (ioctl(v4l2_fd, VIDIOC_CREATE_BUFS, &create) < 0) {
+        std::cerr << "Failed to create buffers: " << strerror(errno) << std::endl;
+        return 0;
+    }
+    if ((int)create.index != buf_count) {
+        std::cerr << "Unexpected buffer index " << create.index << " from CREATE_BUFS" << std::endl;
+        return 0;
+    }
+
+    int added = 0;
+    for (unsigned i = 0; i < create.count; i++) {
+        if (!setup_buffer(create.index + i)) {
+            break;
+        }
+        added++;
+    }
+    leases.grow(added);
+    buf_count += added;
+    return added;
+}
+
+void V4l2Device::set_video_events(uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = v4l2_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, v4l2_fd, &ev);
+}
+
+bool V4l2Device::handle_events() {
+    bool changed = false;
+    v4l2_event ev{};
+    while (ioctl(v4l2_fd, VIDIOC_DQEVENT, &ev) == 0) {
+        if (ev.type == V4L2_EVENT_SOURCE_CHANGE && (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return true;
+    }
+    std::cout << "Input source changed" << std::endl;
+    return restart_capture();
+}
+
+bool V4l2Device::restart_capture() {
+    source_change_ns = monotonic_ns();
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    ioctl(v4l2_fd, VIDIOC_STREAMOFF, &type);
+    // vb2 reports EPOLLERR while not streaming, only listen for events until buffers are back
+    set_video_events(EPOLLPRI);
+
+    if (!buffers.empty()) {
+        // reallocate what the tuner settled on, parked buffers are freed here
+        buf_count = leases.active_count();
+        if (on_buffers_released) {
+            on_buffers_released();
+        }
+        // freeing under a live lease closes fds a consumer still maps, wait however long it takes
+        for (int waited_s = 1; !leases.drain(1000); waited_s++) {
+            std::cerr << "Capture buffers still leased after " << waited_s << "s, waiting" << std::endl;
+            leases.report(0);
+            if (stop_pending()) {
+                // left to close(), once the consumers are gone
+                return true;
+            }
+        }
+        free_buffers();
+        v4l2_requestbuffers reqbuf{};
+        reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        reqbuf.memory = memory;
+        reqbuf.count = 0;
+        if (ioctl(v4l2_fd, VIDIOC_REQBUFS, &reqbuf) < 0) {
+            std::cerr << "Failed to release buffers: " << strerror(errno) << std::endl;
+        }
+    }
+
+    // no signal yet, the next source change event brings us back here
+    if (!query_format()) {
+        return true;
+    }
+    if (!alloc_buffers()) {
+        free_buffers();
+        return false;
+    }
+    if (on_buffers_ready) {
+        on_buffers_ready();
+    }
+    if (ioctl(v4l2_fd, VIDIOC_STREAMON, &type) < 0) {
+        std::cerr << "Failed to restart streaming: " << strerror(errno) << std::endl;
+        return false;
+    }
+    set_video_events(EPOLLIN | EPOLLPRI);
+    arm_no_signal_timer();
+    return true;
+}
+
+bool V4l2Device::stream_on(bool& run_loop, on_data_t on_data) { 
     if (is_streaming) {
         return true;
     }
@@ -168,34 +447,71 @@ bool V4l2Device::stream_on(bool& run_loop, std::function<void(user_buffers_t&, v
     }
 
     is_streaming = true;
-    while(run_loop && this->is_open()) {
-        // process data
-        v4l2_buffer vbuf{};
-        vbuf.type = is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vbuf.memory = V4L2_MEMORY_MMAP;
-        std::vector<v4l2_plane> planes(buffers[0].num_planes());
-        vbuf.m.planes = planes.data();
-        vbuf.length = buffers[0].num_planes();
-        // this will block until a buffer is available
-        if(ioctl(v4l2_fd, VIDIOC_DQBUF, &vbuf)) {
-            if (!is_streaming) {
-                break;
+    signal_lost = false;
+    arm_no_signal_timer();
+
+    epoll_event events[4];
+    bool stop = false;
+    while(!stop && run_loop && this->is_open()) {
+        int n = epoll_wait(epoll_fd, events, 4, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            std::cerr << "Failed to dequeue buffer: " << strerror(errno) << std::endl;
-            continue;
-        }
-        if (on_data) {
-            on_data(buffers[vbuf.index], vbuf);
+            std::cerr << "Failed to wait for capture events: " << strerror(errno) << std::endl;
+            break;
         }
-        // queue the buffer back
-        if (ioctl(v4l2_fd, VIDIOC_QBUF, &vbuf)) {
-            std::cerr << "Failed to queue buffer: " << strerror(errno) << std::endl;
-            continue;
+        for (int i = 0; i < n; i++) {
+            uint64_t counter;
+            if (events[i].data.fd == stop_fd) {
+                read(stop_fd, &counter, sizeof(counter));
+                stop = true;
+            } else if (events[i].data.fd == no_signal_fd) {
+                read(no_signal_fd, &counter, sizeof(counter));
+                if (!signal_lost) {
+                    signal_lost = true;
+                    no_signal_count++;
+                    std::cerr << "No input signal for " << no_signal_timeout_ms << "ms" << std::endl;
+                    if (on_signal_lost) {
+                        on_signal_lost();
+                    }
+                }
+            } else if (events[i].data.fd == v4l2_fd) {
+                if (events[i].events & EPOLLPRI) {
+                    // buffers may have been reallocated, readiness from before is stale, let epoll report it again
+                    if (!handle_events()) {
+                        stop = true;
+                    }
+                } else if (!handle_video_ready(on_data)) {
+                    stop = true;
+                } else if (events[i].events & EPOLLERR) {
+                    // vb2 reports EPOLLERR once the queue stops streaming or hits an error, it will not recover
+                    std::cerr << "Capture queue error" << std::endl;
+                    stop = true;
+                }
+            }
         }
     }
+
+    // disarm, a stopped stream is not a lost signal
+    itimerspec its{};
+    timerfd_settime(no_signal_fd, 0, &its, nullptr);
     return true;
 }
 
+bool V4l2Device::stop_pending() const {
+    // polled, not read, the capture loop still sees the stop
+    pollfd pfd = {stop_fd, POLLIN, 0};
+    return stop_fd >= 0 && poll(&pfd, 1, 0) > 0;
+}
+
+void V4l2Device::request_stop() {
+    if (stop_fd >= 0) {
+        uint64_t one = 1;
+        write(stop_fd, &one, sizeof(one));
+    }
+}
+
 bool V4l2Device::stream_off() {
     if (!is_streaming) {
         return true;
@@ -5,57 +5,90 @@
 #include <functional>
 #include <linux/videodev2.h>
 
-class V4l2Device {
+#include "frame_source.hpp"
+
+class V4l2Device : public FrameSource {
 public:
-    V4l2Device(const std::string device, int buf_count);
+    /**
+     * memory: V4L2_MEMORY_MMAP exports driver buffers, V4L2_MEMORY_DMABUF queues buffers from DmaHeapAllocator::shared()'s heap, never a fallback
+     */
+    V4l2Device(const std::string device, int buf_count, uint32_t memory = V4L2_MEMORY_MMAP);
     ~V4l2Device() {
         stream_off();
         close();
     }
 
-    struct user_buf_info_t {
-        user_buf_info_t() : ptr(nullptr), size(0), dma_fd(-1) {}
-
-        unsigned char* ptr;
-        size_t size;
-        int dma_fd;
-    };
-    struct user_buffers_t {
-        user_buffers_t(int index, size_t num_planes)
-            : index(index), mem(num_planes) {}
-        
-        int index;
-        std::vector<user_buf_info_t> mem;
-
-        size_t num_planes() const { return mem.size(); }
-    };
+    /**
+     * set up buffers and export DMABUF fds, CPU mappings are made on demand
+     */
+    bool open() override;
+    bool close() override;
 
     /**
-     * set up buffers, map to userspace, export DMABUF fd
+     * epoll loop over the video fd, stop eventfd and no-signal timerfd.
+     * no heap allocation per frame.
      */
-    bool open();
-    bool close();
+    bool stream_on(bool& run_loop, on_data_t on_data) override;
+    bool stream_off() override;
+    void request_stop() override;
 
-    bool stream_on(bool& run_loop, std::function<void(user_buffers_t&, v4l2_buffer&)> on_data);
-    bool stream_off();
+    // VIDIOC_CREATE_BUFS, works while streaming
+    int add_buffers(int count) override;
 
-    bool is_open() const { return v4l2_fd >= 0; }
+    bool is_open() const override { return v4l2_fd >= 0; }
     
     // public
     std::string device;
     int v4l2_fd;
     bool is_mplane;
-    std::vector<user_buffers_t> buffers;
-    int buf_count;
+    uint32_t memory;
+
+    // no frame for this long counts as signal loss
+    int no_signal_timeout_ms = 500;
+    uint64_t no_signal_count = 0;
+    // called from the capture thread when frames stop arriving
+    std::function<void()> on_signal_lost;
 
-    int pixfmt;
-    int width;
-    int height;
+    // time from the last V4L2_EVENT_SOURCE_CHANGE to the first frame in the new format
+    double last_source_change_ms = 0;
 
 private:
     bool open_not_closing_on_failure();
+    // QUERY_DV_TIMINGS and G_FMT, false without a signal
+    bool query_format();
+    // REQBUFS buf_count and set up every buffer
+    bool alloc_buffers();
+    void free_buffers();
+    // QUERYBUF, EXPBUF (or allocate for DMABUF) and QBUF one buffer
+    bool setup_buffer(int index);
+    /**
+     * resolution or format changed: stop, drain leases, reallocate for the new format and stream again.
+     * the fd, epoll loop and everything downstream of on_buffers_* stay alive.
+     * buffers are never freed while leased, a stop requested meanwhile leaves them to close()
+     */
+    bool restart_capture();
+    // request_stop() was called, without consuming it
+    bool stop_pending() const;
+    bool handle_events();
+    void set_video_events(uint32_t events);
+    bool arm_no_signal_timer();
+    void requeue(int index);
+    bool handle_video_ready(const on_data_t& on_data);
 
     bool is_streaming;
+    bool signal_lost = false;
+    uint64_t source_change_ns = 0;
+
+    int epoll_fd = -1;
+    int stop_fd = -1;
+    int no_signal_fd = -1;
+
+    int n_planes = 0;
+    // from G_FMT, what DMABUF mode allocates per plane
+    std::vector<uint32_t> plane_sizes;
+    // reused by every DQBUF, and per buffer for QBUF which may come from any consumer thread
+    std::vector<v4l2_plane> dq_planes;
+    std::vector<std::vector<v4l2_plane>> qbuf_planes;
 };
 
 inline int print_hex(void* ptr, size_t size, size_t line_size = 16) {
@@ -0,0 +1,233 @@
+#include "video_compositor.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <libdrm/drm_fourcc.h>
+
+
+// same dialect as the ImGui backend, the context takes ES 3.0 shaders
+static const char* vertex_source = R"(#version 300 es
+layout(location = 0) in vec2 pos;
+layout(location = 1) in vec2 uv;
+out vec2 frag_uv;
+void main() {
+    frag_uv = uv;
+    gl_Position = vec4(pos, 0.0, 1.0);
+}
+)";
+
+// BT.709 limited range, what HDMI sources send at HD and above.
+// highp: fp16 texture coordinates cannot address single texels across a 3840-wide plane
+static const char* fragment_source = R"(#version 300 es
+precision highp float;
+precision highp sampler2D;
+uniform sampler2D y_tex;
+uniform sampler2D uv_tex;
+in vec2 frag_uv;
+out vec4 color;
+void main() {
+    float y = (texture(y_tex, frag_uv).r - 16.0 / 255.0) * 1.164;
+    vec2 c = texture(uv_tex, frag_uv).rg - vec2(128.0 / 255.0);
+    color = vec4(y + 1.793 * c.y, y - 0.213 * c.x - 0.533 * c.y, y + 2.112 * c.x, 1.0);
+}
+)";
+
+bool VideoCompositor::init(EGLDisplay display) {
+    if (ready()) {
+        return true;
+    }
+    this->display = display;
+    const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_EXT_image_dma_buf_import")) {
+        fprintf(stderr, "EGL cannot import dma-bufs, no GPU composition\n");
+        return false;
+    }
+    create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    if (!create_image || !destroy_image || !gl_load()) {
+        return false;
+    }
+    program = gl_link_program(vertex_source, fragment_source);
+    if (!program) {
+        return false;
+    }
+    gl.UseProgram(program);
+    gl.Uniform1i(gl.GetUniformLocation(program, "y_tex"), 0);
+    gl.Uniform1i(gl.GetUniformLocation(program, "uv_tex"), 1);
+    gl.UseProgram(0);
+
+    // 4 vertices of pos.xy, uv.xy, refilled per draw
+    gl.GenVertexArrays(1, &vao);
+    gl.GenBuffers(1, &vbo);
+    gl.BindVertexArray(vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+    gl.BufferData(GL_ARRAY_BUFFER, 16 * sizeof(float), nullptr, GL_STREAM_DRAW);
+    gl.VertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    gl.VertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
+    gl.EnableVertexAttribArray(0);
+    gl.EnableVertexAttribArray(1);
+    gl.BindVertexArray(0);
+    gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+    printf("GPU composition: capture buffers imported as EGLImages\n");
+    return true;
+}
+
+void VideoCompositor::close() {
+    for (Image& image : images) {
+        // the textures went with the context
+        image.textures[0] = image.textures[1] = 0;
+    }
+    release_images();
+    program = 0;
+    vao = 0;
+    vbo = 0;
+}
+
+void VideoCompositor::release_images() {
+    for (Image& image : images) {
+        release(image);
+    }
+    images.clear();
+}
+
+void VideoCompositor::release(Image& image) {
+    if (image.textures[0]) {
+        glDeleteTextures(2, image.textures);
+    }
+    for (EGLImageKHR& plane : image.planes) {
+        if (plane != EGL_NO_IMAGE_KHR) {
+            destroy_image(display, plane);
+            plane = EGL_NO_IMAGE_KHR;
+        }
+    }
+    image = Image();
+}
+
+bool VideoCompositor::import(Image& image, int dma_fd, int width, int height, int pixfmt) {
+    // chroma plane size and bytes per chroma row, laid out as DRMDevice::import_dmabuf expects
+    int chroma_w, chroma_h;
+    switch (pixfmt) {
+    case DRM_FORMAT_NV12:
+        chroma_w = width / 2;
+        chroma_h = height / 2;
+        break;
+    case DRM_FORMAT_NV16:
+        chroma_w = width / 2;
+        chroma_h = height;
+        break;
+    case DRM_FORMAT_NV24:
+        chroma_w = width;
+        chroma_h = height;
+        break;
+    default:
+        if (unsupported_pixfmt != pixfmt) {
+            fprintf(stderr, "GPU composition does not support %.4s\n", (const char*)&pixfmt);
+            unsupported_pixfmt = pixfmt;
+        }
+        return false;
+    }
+    struct {
+        uint32_t fourcc;
+        int w, h, offset, pitch;
+    } planes[2] = {
+        {DRM_FORMAT_R8, width, height, 0, width},
+        {DRM_FORMAT_GR88, chroma_w, chroma_h, width * height, chroma_w * 2},
+    };
+    glGenTextures(2, image.textures);
+    for (int i = 0; i < 2; i++) {
+        EGLint attribs[] = {
+            EGL_WIDTH, planes[i].w,
+            EGL_HEIGHT, planes[i].h,
+            EGL_LINUX_DRM_FOURCC_EXT, (EGLint)planes[i].fourcc,
+            EGL_DMA_BUF_PLANE0_FD_EXT, dma_fd,
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT, planes[i].offset,
+            EGL_DMA_BUF_PLANE0_PITCH_EXT, planes[i].pitch,
+            EGL_NONE
+        };
+        image.planes[i] = create_image(display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+        if (image.planes[i] == EGL_NO_IMAGE_KHR) {
+            fprintf(stderr, "Failed to import capture buffer plane %d as EGLImage, err: 0x%x\n", i, eglGetError());
+            release(image);
+            return false;
+        }
+        glBindTexture(GL_TEXTURE_2D, image.textures[i]);
+        gl.EGLImageTargetTexture2DOES(GL_TEXTURE_2D, image.planes[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    image.dma_fd = dma_fd;
+    image.width = width;
+    image.height = height;
+    image.pixfmt = pixfmt;
+    return true;
+}
+
+bool VideoCompositor::draw(int index, int dma_fd, int width, int height, int pixfmt, const LayerGeometry& geometry) {
+    if (!ready() || index < 0 || dma_fd < 0) {
+        return false;
+    }
+    if (index >= (int)images.size()) {
+        images.resize(index + 1);
+    }
+    Image& image = images[index];
+    if (image.dma_fd != dma_fd || image.width != width || image.height != height || image.pixfmt != pixfmt) {
+        release(image);
+        if (!import(image, dma_fd, width, height, pixfmt)) {
+            return false;
+        }
+    }
+
+    // the screen is the input size, as for the video plane
+    LayerGeometry g = geometry.resolved(width, height, width, height);
+    // which source corner lands on each dst corner, the walk LayerSampler does per pixel
+    bool swap = g.swaps_axes();
+    bool r180 = g.rotation & DRM_MODE_ROTATE_180;
+    bool flip_x = (g.rotation & DRM_MODE_REFLECT_X) != 0;
+    bool flip_y = (g.rotation & DRM_MODE_REFLECT_Y) != 0;
+    if (swap) {
+        flip_x ^= (g.rotation & DRM_MODE_ROTATE_90) != 0;
+        flip_y ^= (g.rotation & DRM_MODE_ROTATE_270) != 0;
+    } else {
+        flip_x ^= r180;
+        flip_y ^= r180;
+    }
+    static const int corners[4][2] = {{0, 0}, {1, 0}, {0, 1}, {1, 1}};
+    float vertices[16];
+    for (int i = 0; i < 4; i++) {
+        int cx = corners[i][0];
+        int cy = corners[i][1];
+        int u = swap ? cy : cx;
+        int v = swap ? cx : cy;
+        u = flip_x ? 1 - u : u;
+        v = flip_y ? 1 - v : v;
+        // the FBO's first row in memory is GL's bottom one, so screen y runs up in clip space
+        vertices[i * 4 + 0] = (g.dst.x + cx * g.dst.w) * 2.0f / width - 1.0f;
+        vertices[i * 4 + 1] = (g.dst.y + cy * g.dst.h) * 2.0f / height - 1.0f;
+        vertices[i * 4 + 2] = (g.src.x + u * g.src.w) / (float)width;
+        vertices[i * 4 + 3] = (g.src.y + v * g.src.h) / (float)height;
+    }
+
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    if (g.dst != LayerRect{0, 0, width, height}) {
+        // letterbox, the canvas is opaque in this mode
+        glClearColor(0, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    gl.UseProgram(program);
+    gl.BindVertexArray(vao);
+    gl.BindBuffer(GL_ARRAY_BUFFER, vbo);
+    gl.BufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STREAM_DRAW);
+    gl.ActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, image.textures[1]);
+    gl.ActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, image.textures[0]);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl.BindVertexArray(0);
+    gl.BindBuffer(GL_ARRAY_BUFFER, 0);
+    gl.UseProgram(0);
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "gl_loader.hpp"
+#include "layer_geometry.hpp"
+
+/**
+ * Draws capture buffers into the canvas on the GPU, for outputs with no plane that scans out the video.
+ *
+ * Each buffer is imported once per index: its luma and chroma planes become R8 and GR88 EGLImages
+ * (EGL_EXT_image_dma_buf_import) bound to plain 2D textures, converted to RGB (BT.709, limited range)
+ * in the shader. Unlike an external texture this needs no samplerExternalOES, two plane images work on
+ * every driver and on Mesa's software rasterizer. NV12, NV16 and NV24.
+ *
+ * Everything runs on the thread whose context is current.
+ */
+class VideoCompositor {
+public:
+    ~VideoCompositor() { close(); }
+
+    // shader and quad, once the context is current. display is where the images are created
+    bool init(EGLDisplay display);
+    // images only, GL objects go with the context
+    void close();
+
+    /**
+     * into the bound framebuffer, at geometry resolved against the input size as the video plane would
+     * show it. imports the buffer on first use, again if its fd or format changed
+     */
+    bool draw(int index, int dma_fd, int width, int height, int pixfmt, const LayerGeometry& geometry);
+
+    // the source is freeing its buffers, the images must not keep them alive
+    void release_images();
+
+    bool ready() const { return program != 0; }
+
+private:
+    struct Image {
+        int dma_fd = -1;
+        int width = 0;
+        int height = 0;
+        int pixfmt = 0;
+        EGLImageKHR planes[2] = {EGL_NO_IMAGE_KHR, EGL_NO_IMAGE_KHR};
+        GLuint textures[2] = {0, 0};
+    };
+
+    bool import(Image& image, int dma_fd, int width, int height, int pixfmt);
+    void release(Image& image);
+
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLCREATEIMAGEKHRPROC create_image = nullptr;
+    PFNEGLDESTROYIMAGEKHRPROC destroy_image = nullptr;
+
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    // by capture buffer index
+    std::vector<Image> images;
+    // warned once per format
+    int unsupported_pixfmt = 0;
+};
@@ -469,6 +469,8 @@ static int get_rga_fmt(image_format_t fmt) {
         return RK_FORMAT_YCbCr_420_SP;
     case IMAGE_FORMAT_YUV420SP_NV21:
         return RK_FORMAT_YCrCb_420_SP;
+    case IMAGE_FORMAT_YUV444SP_NV24:
+        return RK_FORMAT_YCbCr_444_SP;
     default:
         return -1;
     }
@@ -490,6 +492,8 @@ int get_image_size(image_buffer_t* image)
     case IMAGE_FORMAT_YUV420SP_NV12:
     case IMAGE_FORMAT_YUV420SP_NV21:
         return image->width * image->height * 3 / 2;
+    case IMAGE_FORMAT_YUV444SP_NV24:
+        return image->width * image->height * 3;
     default:
         break;
     }
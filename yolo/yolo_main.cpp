@@ -2,13 +2,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <vector>
 
 #include "yolo11.h"
 #include "image_utils.h"
 #include "file_utils.h"
 #include "image_drawing.h"
 
-#include "imgui.h"
+#include "detection_overlay.hpp"
 
 rknn_app_context_t rknn_app_ctx;
 
@@ -28,7 +30,10 @@ bool yolo_main_pre(const char *model_path, const char* label_list_file) {
 }
 
 // imgfmt does not support NV24. so only NV12 works here.
-bool yolo_main_on_frame(int v2ld_dma_fd, int width, int height, image_format_t imgfmt) {
+// boxes: gets every box to draw, for DetectionOverlay or draw_detections
+// detections: if set, gets "name prop x1 y1 x2 y2;" for every box
+bool yolo_main_on_frame(int v2ld_dma_fd, int width, int height, image_format_t imgfmt, std::vector<Detection>& boxes,
+                        std::string* detections) {
     image_buffer_t src_image {
         .width = width,
         .height = height,
@@ -48,7 +53,6 @@ bool yolo_main_on_frame(int v2ld_dma_fd, int width, int height, image_format_t i
 
     // 画框和概率
     char text[256]{};
-    ImDrawList* drawlist = ImGui::GetForegroundDrawList();
     for (int i = 0; i < od_results.count; i++)
     {
         object_detect_result *det_result = &(od_results.results[i]);
@@ -75,9 +79,11 @@ bool yolo_main_on_frame(int v2ld_dma_fd, int width, int height, image_format_t i
         int x2 = det_result->box.right;
         int y2 = det_result->box.bottom;
 
-        sprintf(text, "%s %.1f%%", coco_cls_to_name(det_result->cls_id), det_result->prop * 100);
-        drawlist->AddRect(ImVec2(x1, y1), ImVec2(x2, y2), IM_COL32(0, 255, 0, 255), 0.0f, ImDrawFlags_RoundCornersAll, 3.0f);
-        drawlist->AddText(nullptr, 128, ImVec2(x1, y1 - 128), IM_COL32(255, 0, 0, 255), text);
+        boxes.push_back(Detection{cls_name, det_result->prop, x1, y1, x2, y2});
+        if (detections) {
+            snprintf(text, sizeof(text), "%s %.3f %d %d %d %d;", coco_cls_to_name(det_result->cls_id), det_result->prop, x1, y1, x2, y2);
+            *detections += text;
+        }
     }
 
     return true;